@@ -0,0 +1,334 @@
+/*
+ * File:        keyflood.c
+ *
+ * Author:      fossette
+ *
+ * Description: Floods a playing fsplayer with key storms through the
+ *              XTest extension: seek bursts, a held seek key, pause
+ *              toggling, volume spam, audio track cycling and keypad
+ *              repositioning, then ESC.  fsplayer must still be alive
+ *              after every storm, and catch up with it: two keypad
+ *              moves follow each storm, and the next one waits until
+ *              the video window got to the second.  Run by keyflood.sh
+ *              on Xvfb, which then checks fsplayer's --timings report.
+ *
+ * Parameter:   --pid=<pid> of the fsplayer to watch.
+ *              --pause=<ms> once a storm is caught up with, for its
+ *              last seek to settle, 500 by default.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS''
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include <X11/Xlib.h>
+#include <X11/keysym.h>
+#include <X11/extensions/XTest.h>
+
+
+
+
+/*
+ *  Constants
+ */
+
+#define KEYFLOOD_MAXKEYS         9
+#define KEYFLOOD_PAUSEMS         500      // Lets the last seek settle
+#define KEYFLOOD_CATCHUPMS       30000    // fsplayer is stuck beyond
+#define KEYFLOOD_NOMOVEMS        1500     // See CatchUp()
+#define KEYFLOOD_POLLMS          10
+
+#define ERROR_KEYFLOOD_USAGE     1
+#define ERROR_KEYFLOOD_X11       2
+#define ERROR_KEYFLOOD_DEAD      3
+#define ERROR_KEYFLOOD_BEHIND    4
+
+
+
+
+/*
+ *  Types
+ */
+
+// Presses cycling through aKeys, iGapUs apart
+typedef struct
+{
+   const char  *szName;
+   int         nKeys,
+               nPresses,
+               iGapUs;
+   KeySym      aKeys[KEYFLOOD_MAXKEYS];
+} STORM;
+
+
+
+
+/*
+ *  Global variables
+ */
+
+// What the operators do to fsplayer, only much faster.  Pauses are
+// pressed an even number of times so the video plays on afterwards.
+const STORM gaStorms[] =
+{
+   { "seek_forward",  1, 100, 5000,  { XK_Right } },
+   { "seek_backward", 1, 100, 5000,  { XK_Left } },
+   { "seek_mixed",    4, 120, 3000,  { XK_Up, XK_Page_Up, XK_Down,
+                                       XK_Page_Down } },
+   { "seek_held",     1, 150, 33000, { XK_Right } },   // 30 Hz autorepeat
+   { "pause",         1, 20,  50000, { XK_space } },
+   { "volume",        2, 400, 1000,  { XK_KP_Add, XK_KP_Subtract } },
+   { "audio_track",   1, 60,  20000, { XK_KP_Multiply } },
+   { "view",          9, 180, 5000,  { XK_KP_End, XK_KP_Down,
+                                       XK_KP_Page_Down, XK_KP_Left,
+                                       XK_KP_Begin, XK_KP_Right,
+                                       XK_KP_Home, XK_KP_Up,
+                                       XK_KP_Page_Up } }
+};
+
+
+
+
+/*
+ *  FakeKey
+ */
+
+void
+FakeKey(Display *pX11Display, KeySym ks)
+{
+   KeyCode kc;
+
+
+   kc = XKeysymToKeycode(pX11Display, ks);
+   if (kc)
+   {
+      XTestFakeKeyEvent(pX11Display, kc, True, CurrentTime);
+      XTestFakeKeyEvent(pX11Display, kc, False, CurrentTime);
+      XFlush(pX11Display);
+   }
+}
+
+
+
+
+/*
+ *  ProcessAlive
+ */
+
+int
+ProcessAlive(pid_t pid)
+{
+   return(!pid || !kill(pid, 0));
+}
+
+
+
+
+/*
+ *  FindVideoWindow
+ *
+ *  fsplayer's video window is the child of the root window's child
+ *  named "fsplayer".  Returns 0 when there's none.
+ */
+
+Window
+FindVideoWindow(Display *pX11Display)
+{
+   char           *szName;
+   unsigned int   i,
+                  nChildren,
+                  nVideo;
+   Window         w,
+                  wInput = 0,
+                  wVideo = 0,
+                  *pChildren,
+                  *pVideo;
+
+
+   if (XQueryTree(pX11Display, DefaultRootWindow(pX11Display),     &w, &w,
+                  &pChildren, &nChildren))
+   {
+      for (i = 0 ; i < nChildren && !wInput ; i++)
+         if (XFetchName(pX11Display, pChildren[i],     &szName))
+         {
+            if (!strcmp(szName, "fsplayer"))
+               wInput = pChildren[i];
+            XFree(szName);
+         }
+      if (pChildren)
+         XFree(pChildren);
+   }
+
+   if (wInput && XQueryTree(pX11Display, wInput,     &w, &w,
+                            &pVideo, &nVideo))
+   {
+      if (nVideo)
+         wVideo = pVideo[0];
+      if (pVideo)
+         XFree(pVideo);
+   }
+
+   return(wVideo);
+}
+
+
+
+
+/*
+ *  CatchUp
+ *
+ *  Keys are handled in order, so once fsplayer moved the video window
+ *  to the keypad's bottom-left then top-right, it went through every
+ *  key sent before.  The first move makes sure the second one happens.
+ *  A video as wide or as tall as the screen doesn't move, there's only
+ *  waiting then.
+ *  Returns 0 when fsplayer didn't catch up.
+ */
+
+int
+CatchUp(Display *pX11Display, Window wVideo, pid_t pid)
+{
+   int            iCaughtUp = 0,
+                  iScreenHeight,
+                  iScreenWidth,
+                  iWaitedMs,
+                  x,
+                  y;
+   unsigned int   iBorder,
+                  iDepth,
+                  iHeight,
+                  iWidth;
+   Window         wRoot;
+
+
+   iScreenWidth = DisplayWidth(pX11Display, DefaultScreen(pX11Display));
+   iScreenHeight = DisplayHeight(pX11Display, DefaultScreen(pX11Display));
+   if (wVideo
+       && XGetGeometry(pX11Display, wVideo,     &wRoot, &x, &y,
+                       &iWidth, &iHeight, &iBorder, &iDepth)
+       && (int)iWidth < iScreenWidth && (int)iHeight < iScreenHeight)
+   {
+      FakeKey(pX11Display, XK_KP_End);
+      FakeKey(pX11Display, XK_KP_Page_Up);
+      for (iWaitedMs = 0 ; !iCaughtUp && iWaitedMs < KEYFLOOD_CATCHUPMS
+                           && ProcessAlive(pid) ;
+           iWaitedMs += KEYFLOOD_POLLMS)
+      {
+         usleep(KEYFLOOD_POLLMS * 1000);
+         if (XGetGeometry(pX11Display, wVideo,     &wRoot, &x, &y,
+                          &iWidth, &iHeight, &iBorder, &iDepth))
+            iCaughtUp = (y == 0 && x + (int)iWidth == iScreenWidth);
+      }
+   }
+   else
+   {
+      usleep(KEYFLOOD_NOMOVEMS * 1000);
+      iCaughtUp = 1;
+   }
+
+   return(iCaughtUp);
+}
+
+
+
+
+/*
+ *  main
+ */
+
+int
+main(int argc, char **argv)
+{
+   int      i,
+            iErr = 0,
+            iEventBase,
+            iErrorBase,
+            iMajor,
+            iMinor,
+            iPauseMs = KEYFLOOD_PAUSEMS,
+            iStorm,
+            nPresses = 0;
+   pid_t    pid = 0;
+   Display  *pX11Display = NULL;
+   Window   wVideo = 0;
+
+
+   for (i = 1 ; i < argc && !iErr ; i++)
+   {
+      if (!strncmp(argv[i], "--pid=", 6))
+         pid = atoi(argv[i] + 6);
+      else if (!strncmp(argv[i], "--pause=", 8))
+         iPauseMs = atoi(argv[i] + 8);
+      else
+         iErr = ERROR_KEYFLOOD_USAGE;
+   }
+
+   if (!iErr)
+   {
+      pX11Display = XOpenDisplay(NULL);
+      if (!pX11Display
+          || !XTestQueryExtension(pX11Display,     &iEventBase, &iErrorBase,
+                                  &iMajor, &iMinor))
+         iErr = ERROR_KEYFLOOD_X11;
+      else
+         wVideo = FindVideoWindow(pX11Display);
+   }
+
+   for (iStorm = 0 ; !iErr
+                     && iStorm < sizeof(gaStorms) / sizeof(STORM) ; iStorm++)
+   {
+      for (i = 0 ; i < gaStorms[iStorm].nPresses ; i++)
+      {
+         FakeKey(pX11Display,
+                 gaStorms[iStorm].aKeys[i % gaStorms[iStorm].nKeys]);
+         usleep(gaStorms[iStorm].iGapUs);
+      }
+      nPresses += gaStorms[iStorm].nPresses;
+
+      // The X server has sent every key, fsplayer goes through them
+      // however long it takes
+      XSync(pX11Display, False);
+      if (!CatchUp(pX11Display, wVideo, pid))
+         iErr = ERROR_KEYFLOOD_BEHIND;
+      else
+         usleep(iPauseMs * 1000);
+      if (!ProcessAlive(pid))
+         iErr = ERROR_KEYFLOOD_DEAD;
+      printf("keyflood: %-13s %4d keys, %s\n", gaStorms[iStorm].szName,
+             gaStorms[iStorm].nPresses,
+             iErr == ERROR_KEYFLOOD_DEAD ? "fsplayer died!"
+             : iErr ? "fsplayer didn't catch up!" : "ok");
+   }
+
+   if (!iErr)
+   {
+      FakeKey(pX11Display, XK_Escape);
+      XSync(pX11Display, False);
+      printf("keyflood: %d keys in %d storms\n", nPresses + 1, iStorm);
+   }
+
+   if (iErr == ERROR_KEYFLOOD_USAGE)
+      printf("USAGE: keyflood [--pid=<pid>] [--pause=<ms>]\n");
+   else if (iErr == ERROR_KEYFLOOD_X11)
+      printf("X11 ERROR: No display, or no XTest extension!\n");
+
+   if (pX11Display)
+      XCloseDisplay(pX11Display);
+
+   return(iErr);
+}
@@ -0,0 +1,143 @@
+#!/bin/sh
+#
+# File:        keyflood.sh
+#
+# Author:      fossette
+#
+# Description: Plays a generated video with fsplayer --timings on Xvfb,
+#              floods it with keyflood's key storms, and checks that
+#              fsplayer lived through them, that its X event queue never
+#              backed up, that its event loop never stalled and that
+#              every kind of key kept a bounded latency.  Run from the
+#              top directory by "make bench-keyflood".  Needs Xvfb,
+#              xdpyinfo, xwininfo and ffmpeg.
+#
+#              The limits may be changed through the environment, the
+#              latencies are 99th percentiles in milliseconds:
+#                KEYFLOOD_SEEK_P99, KEYFLOOD_PAUSE_P99,
+#                KEYFLOOD_VOLUME_P99, KEYFLOOD_AUDIO_TRACK_P99,
+#                KEYFLOOD_VIEW_P99, KEYFLOOD_QUEUE_MAX,
+#                KEYFLOOD_BUSY_MAX_US
+#
+
+DISPLAYNUM=${KEYFLOOD_DISPLAY:-:99}
+WORKDIR=`mktemp -d /tmp/keyflood.XXXXXX`
+FAILED=0
+XVFB=
+FSPLAYER=
+
+cleanup()
+{
+   [ -n "$FSPLAYER" ] && kill $FSPLAYER 2>/dev/null
+   [ -n "$XVFB" ] && kill $XVFB 2>/dev/null
+   rm -rf "$WORKDIR"
+}
+trap cleanup EXIT INT TERM
+
+# check <name> <value> <max>
+check()
+{
+   if [ -z "$2" ]; then
+      echo "FAIL: $1 not reported"
+      FAILED=1
+   elif awk "BEGIN { exit !($2 <= $3) }"; then
+      echo "ok:   $1 = $2 (max $3)"
+   else
+      echo "FAIL: $1 = $2 (max $3)"
+      FAILED=1
+   fi
+}
+
+# waitfor <seconds> <command...>, until the command succeeds
+waitfor()
+{
+   n=`expr $1 \* 10`
+   shift
+   until "$@" >/dev/null 2>&1; do
+      n=`expr $n - 1`
+      [ $n -le 0 ] && return 1
+      sleep 0.1
+   done
+}
+
+# fsplayer's window up, and the video probed: its event loop is next
+fsplayerready()
+{
+   xwininfo -name fsplayer | grep -q IsViewable \
+      && grep -q "^Video " "$WORKDIR/fsplayer.log"
+}
+
+# p99 <latency kind>
+p99()
+{
+   sed -n "s/.*\"$1\":{\"n\":[0-9]*,\"p50\":[0-9.]*,\"p95\":[0-9.]*,\"p99\":\([0-9.]*\)}.*/\1/p" \
+       "$WORKDIR/timings.json"
+}
+
+# member <name>
+member()
+{
+   sed -n "s/.*\"$1\":\([0-9.]*\).*/\1/p" "$WORKDIR/timings.json"
+}
+
+# Twenty minutes, so the 10 minutes jumps have room, with two audio
+# tracks for '*' to cycle through
+echo "Generating the test video..."
+ffmpeg -loglevel error -f lavfi -i testsrc2=size=320x240:rate=10 \
+       -f lavfi -i sine=frequency=440 -f lavfi -i sine=frequency=880 \
+       -map 0 -map 1 -map 2 -t 1200 -c:v libx264 -preset ultrafast \
+       -c:a aac -b:a 32k "$WORKDIR/flood.mkv" || exit 1
+
+Xvfb $DISPLAYNUM -screen 0 1280x720x24 -nolisten tcp >/dev/null 2>&1 &
+XVFB=$!
+export DISPLAY=$DISPLAYNUM
+if ! waitfor 10 xdpyinfo; then
+   echo "FAIL: Xvfb didn't start on $DISPLAYNUM"
+   exit 1
+fi
+
+# No cache, configuration or key bindings of the user's.  Its output
+# is line buffered so the log tells when the video is ready.
+FSPLAYER_CACHE= XDG_CONFIG_HOME="$WORKDIR" \
+   stdbuf -oL ./fsplayer --timings "$WORKDIR/flood.mkv" \
+   >"$WORKDIR/fsplayer.log" 2>"$WORKDIR/timings.json" &
+FSPLAYER=$!
+if ! waitfor 30 fsplayerready; then
+   echo "FAIL: fsplayer's video never showed up"
+   cat "$WORKDIR/fsplayer.log"
+   exit 1
+fi
+
+bench/keyflood --pid=$FSPLAYER || FAILED=1
+
+# ESC was the last key
+for i in 1 2 3 4 5 6 7 8 9 10; do
+   kill -0 $FSPLAYER 2>/dev/null || break
+   sleep 1
+done
+if kill -0 $FSPLAYER 2>/dev/null; then
+   echo "FAIL: fsplayer didn't quit on ESC"
+   FAILED=1
+else
+   wait $FSPLAYER || { echo "FAIL: fsplayer exit status $?"; FAILED=1; }
+fi
+FSPLAYER=
+
+if ! grep -q fsplayer_timings "$WORKDIR/timings.json"; then
+   echo "FAIL: no --timings report"
+   cat "$WORKDIR/fsplayer.log" "$WORKDIR/timings.json"
+   exit 1
+fi
+
+check seek_p99_ms "`p99 seek`" ${KEYFLOOD_SEEK_P99:-2000}
+check pause_p99_ms "`p99 pause`" ${KEYFLOOD_PAUSE_P99:-500}
+check volume_p99_ms "`p99 volume`" ${KEYFLOOD_VOLUME_P99:-250}
+check audio_track_p99_ms "`p99 audio_track`" ${KEYFLOOD_AUDIO_TRACK_P99:-500}
+check view_p99_ms "`p99 view`" ${KEYFLOOD_VIEW_P99:-250}
+check x11_queue_max "`member x11_queue_max`" ${KEYFLOOD_QUEUE_MAX:-64}
+check loop_busy_max_us "`member loop_busy_max_us`" \
+      ${KEYFLOOD_BUSY_MAX_US:-16000}
+check control_dropped "`member control_dropped`" 0
+
+[ $FAILED = 0 ] && echo "keyflood: passed" || echo "keyflood: FAILED"
+exit $FAILED
@@ -0,0 +1,650 @@
+/*
+ * File:        yuvbench.c
+ *
+ * Author:      fossette
+ *
+ * Description: Checks that fsyuv.c's SIMD kernels are bit exact with
+ *              the scalar one, for every format, matrix and range and
+ *              for odd widths, then times every kernel the CPU can run
+ *              at 1080p and 4K.  GB/s counts the YUV bytes read and the
+ *              BGRA bytes written.  Run by "make bench-yuv".
+ *
+ *              fsscale.c's kernels are checked the same way, then 4K
+ *              I420 is halved to 1080p before converting it, as fsshm.c
+ *              does, and compared with converting all of it.
+ *
+ *              Last, both are timed on fspool.c's threads, from 1 up to
+ *              one by core, and checked against 1 thread's output.
+ *
+ * Parameter:   --seconds=<s> each kernel is timed for, 0.5 by default.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS''
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "../fspool.h"
+#include "../fsscale.h"
+#include "../fsyuv.h"
+
+
+
+
+/*
+ *  Constants
+ */
+
+#define YUVBENCH_SECONDS         0.5
+#define YUVBENCH_MAXW            3840
+#define YUVBENCH_MAXH            2160
+
+#define ERROR_YUVBENCH_USAGE     1
+#define ERROR_YUVBENCH_MEMORY    2
+#define ERROR_YUVBENCH_MISMATCH  3
+
+
+
+
+/*
+ *  Types
+ */
+
+// A YUV picture in one buffer, see PictureLayout()
+typedef struct
+{
+   int            iFormat;
+   unsigned int   width,
+                  height;
+   size_t         iBytes;
+   FSYUVIMAGE     image;
+} PICTURE;
+
+// A frame for ThreadsJob(), shrunk first when iScaled
+typedef struct
+{
+   int            iScaled;
+   unsigned int   width,
+                  height;
+   const FSYUV    *pYuv;
+   FSSCALE        *aScale;
+   FSYUVIMAGE     *pSrc,
+                  *pScaled;
+   uint8_t        *pDst;
+} THREADSFRAME;
+
+
+
+
+/*
+ *  Global variables
+ */
+
+const char *gszFormatName[FSYUV_FORMATS] = { "I420", "NV12", "YUY2" };
+
+// The check's sizes, odd widths leave a tail to every kernel
+const unsigned int giCheckSize[][2] =
+{
+   { 2, 2 }, { 7, 4 }, { 17, 6 }, { 33, 8 }, { 333, 202 }, { 1920, 1080 }
+};
+
+// The timed sizes
+const unsigned int giBenchSize[][2] =
+{
+   { 1920, 1080 }, { 3840, 2160 }
+};
+
+// The halvings' checks, odd sizes leave a column and a row out
+const unsigned int giCheckScale[][2] =
+{
+   { 4, 4 }, { 66, 40 }, { 333, 202 }, { 101, 77 }, { 1920, 1080 },
+   { 3840, 2160 }
+};
+
+
+
+
+/*
+ *  MonotonicSec
+ */
+
+double
+MonotonicSec(void)
+{
+   struct timespec ts;
+
+
+   clock_gettime(CLOCK_MONOTONIC,     &ts);
+
+   return(ts.tv_sec + ts.tv_nsec / 1e9);
+}
+
+
+
+
+/*
+ *  PictureLayout
+ *
+ *  Lays a picture out within pBuffer, without padding.
+ */
+
+void
+PictureLayout(int iFormat, unsigned int width, unsigned int height,
+              const uint8_t *pBuffer,     PICTURE *pPicture)
+{
+   unsigned int cw = (width + 1) / 2,
+                ch = (height + 1) / 2;
+
+
+   memset(pPicture, 0, sizeof(PICTURE));
+   pPicture->iFormat = iFormat;
+   pPicture->width = width;
+   pPicture->height = height;
+   pPicture->image.apPlanes[0] = pBuffer;
+   if (iFormat == FSYUV_YUY2)
+   {
+      pPicture->image.aPitches[0] = cw * 4;
+      pPicture->iBytes = (size_t)cw * 4 * height;
+   }
+   else
+   {
+      pPicture->image.aPitches[0] = width;
+      pPicture->image.apPlanes[1] = pBuffer + (size_t)width * height;
+      if (iFormat == FSYUV_NV12)
+      {
+         pPicture->image.aPitches[1] = cw * 2;
+         pPicture->iBytes = (size_t)width * height + (size_t)cw * 2 * ch;
+      }
+      else
+      {
+         pPicture->image.aPitches[1] = pPicture->image.aPitches[2] = cw;
+         pPicture->image.apPlanes[2] = pPicture->image.apPlanes[1]
+                                       + (size_t)cw * ch;
+         pPicture->iBytes = (size_t)width * height + (size_t)cw * 2 * ch;
+      }
+   }
+}
+
+
+
+
+/*
+ *  Check
+ *
+ *  Returns the number of kernels that didn't match the scalar one.
+ */
+
+int
+Check(const uint8_t *pSrc, uint8_t *pRef, uint8_t *pDst, int iBestKernel)
+{
+   int            i,
+                  iFormat,
+                  iFullRange,
+                  iKernel,
+                  iMatrix,
+                  nBad = 0,
+                  nChecked = 0;
+   unsigned int   height,
+                  width;
+   FSYUV          yuv;
+   PICTURE        picture;
+
+
+   for (iFormat = 0 ; iFormat < FSYUV_FORMATS ; iFormat++)
+      for (i = 0 ; i < sizeof(giCheckSize) / sizeof(giCheckSize[0]) ; i++)
+      {
+         width = giCheckSize[i][0];
+         height = giCheckSize[i][1];
+         PictureLayout(iFormat, width, height, pSrc,     &picture);
+         for (iMatrix = FSYUV_BT601 ; iMatrix <= FSYUV_BT709 ; iMatrix++)
+            for (iFullRange = 0 ; iFullRange <= 1 ; iFullRange++)
+            {
+               FsYuvInit(iFormat, FSYUV_SCALAR, iMatrix, iFullRange,
+                                                             &yuv);
+               FsYuvConvert(&yuv, &picture.image, pRef, width * 4, width,
+                            height);
+               for (iKernel = FSYUV_SCALAR + 1 ; iKernel <= iBestKernel
+                                               ; iKernel++)
+               {
+                  if (FsYuvInit(iFormat, iKernel, iMatrix, iFullRange,
+                                                              &yuv))
+                     continue;
+                  memset(pDst, 0, (size_t)width * height * 4);
+                  FsYuvConvert(&yuv, &picture.image, pDst, width * 4, width,
+                               height);
+                  nChecked++;
+                  if (memcmp(pRef, pDst, (size_t)width * height * 4))
+                  {
+                     printf("yuvbench: %s %ux%u %s %s range, %s MISMATCH!\n",
+                            gszFormatName[iFormat], width, height,
+                            iMatrix == FSYUV_BT709 ? "BT.709" : "BT.601",
+                            iFullRange ? "full" : "limited",
+                            FsYuvKernelName(iKernel));
+                     nBad++;
+                  }
+               }
+            }
+      }
+   printf("yuvbench: %d kernel runs bit exact with scalar, %d not\n",
+          nChecked - nBad, nBad);
+
+   return(nBad);
+}
+
+
+
+
+/*
+ *  Bench
+ */
+
+void
+Bench(const uint8_t *pSrc, uint8_t *pDst, int iBestKernel, double tSeconds)
+{
+   int            i,
+                  iFormat,
+                  iKernel,
+                  n;
+   unsigned int   height,
+                  width;
+   double         t,
+                  tRun;
+   FSYUV          yuv;
+   PICTURE        picture;
+
+
+   for (i = 0 ; i < sizeof(giBenchSize) / sizeof(giBenchSize[0]) ; i++)
+      for (iFormat = 0 ; iFormat < FSYUV_FORMATS ; iFormat++)
+      {
+         width = giBenchSize[i][0];
+         height = giBenchSize[i][1];
+         PictureLayout(iFormat, width, height, pSrc,     &picture);
+         for (iKernel = FSYUV_SCALAR ; iKernel <= iBestKernel ; iKernel++)
+         {
+            if (FsYuvInit(iFormat, iKernel, FSYUV_BT709, 0,     &yuv))
+               continue;
+
+            // One run to warm the caches up, then as many as fit
+            FsYuvConvert(&yuv, &picture.image, pDst, width * 4, width,
+                         height);
+            n = 0;
+            t = MonotonicSec();
+            do
+            {
+               FsYuvConvert(&yuv, &picture.image, pDst, width * 4, width,
+                            height);
+               n++;
+               tRun = MonotonicSec() - t;
+            }
+            while (tRun < tSeconds);
+
+            printf("yuvbench: %s %4ux%-4u %-6s %8.3f ms %7.2f GB/s\n",
+                   gszFormatName[iFormat], width, height,
+                   FsYuvKernelName(iKernel), tRun * 1000 / n,
+                   (picture.iBytes + (double)width * height * 4) * n
+                   / tRun / 1e9);
+         }
+      }
+}
+
+
+
+
+/*
+ *  CheckScale
+ *
+ *  Returns the number of kernels that didn't match the scalar one.
+ */
+
+int
+CheckScale(const uint8_t *pSrc, uint8_t *pRef, uint8_t *pDst,
+           int iBestKernel)
+{
+   int            i,
+                  iKernel,
+                  nBad = 0,
+                  nChecked = 0;
+   const unsigned *pSize;
+   FSSCALE        scale;
+
+
+   for (i = 0 ; i < sizeof(giCheckScale) / sizeof(giCheckScale[0]) ; i++)
+   {
+      pSize = giCheckScale[i];
+      FsScaleInit(pSize[0], pSize[1], FSYUV_SCALAR,     &scale);
+      FsScalePlane(&scale, pSrc, pSize[0], pRef, scale.dstw);
+      for (iKernel = FSYUV_SSE2 ; iKernel <= iBestKernel ; iKernel++)
+      {
+         if (iKernel == FSYUV_SSSE3
+             || FsScaleInit(pSize[0], pSize[1], iKernel,     &scale))
+            continue;
+         memset(pDst, 0, (size_t)scale.dstw * scale.dsth);
+         FsScalePlane(&scale, pSrc, pSize[0], pDst, scale.dstw);
+         nChecked++;
+         if (memcmp(pRef, pDst, (size_t)scale.dstw * scale.dsth))
+         {
+            printf("yuvbench: halve %ux%u, %s MISMATCH!\n",
+                   pSize[0], pSize[1], FsYuvKernelName(iKernel));
+            nBad++;
+         }
+      }
+   }
+   printf("yuvbench: %d scaler runs bit exact with scalar, %d not\n",
+          nChecked - nBad, nBad);
+
+   return(nBad);
+}
+
+
+
+
+/*
+ *  BenchScale
+ *
+ *  Times converting 4K I420 as is against halving it to 1080p first,
+ *  with the best kernels.  The bytes count the YUV and BGRA read and
+ *  written, the X server's copy of the BGRA aside.
+ */
+
+void
+BenchScale(const uint8_t *pSrc, uint8_t *pDst, int iBestKernel,
+           double tSeconds)
+{
+   int            iPlane,
+                  n;
+   unsigned int   dsth = 1080,
+                  dstw = 1920,
+                  srch = 2160,
+                  srcw = 3840;
+   double         iBytesFull,
+                  iBytesScaled,
+                  t,
+                  tFull,
+                  tScaled;
+   uint8_t        *pScaled = NULL;
+   FSSCALE        aScale[2];
+   FSYUV          yuv;
+   PICTURE        picture,
+                  small;
+
+
+   if (posix_memalign((void **)&pScaled, 64, (size_t)dstw * dsth * 2))
+      return;
+   FsYuvInit(FSYUV_I420, iBestKernel, FSYUV_BT709, 0,     &yuv);
+   PictureLayout(FSYUV_I420, srcw, srch, pSrc,     &picture);
+   PictureLayout(FSYUV_I420, dstw, dsth, pScaled,     &small);
+   FsScaleInit(srcw, srch, iBestKernel,     aScale);
+   FsScaleInit(srcw / 2, srch / 2, iBestKernel,     aScale + 1);
+
+   n = 0;
+   t = MonotonicSec();
+   do
+   {
+      FsYuvConvert(&yuv, &picture.image, pDst, srcw * 4, srcw, srch);
+      n++;
+      tFull = MonotonicSec() - t;
+   }
+   while (tFull < tSeconds);
+   tFull /= n;
+   iBytesFull = picture.iBytes + (double)srcw * srch * 4;
+
+   n = 0;
+   t = MonotonicSec();
+   do
+   {
+      for (iPlane = 0 ; iPlane < 3 ; iPlane++)
+         FsScalePlane(aScale + !!iPlane, picture.image.apPlanes[iPlane],
+                      picture.image.aPitches[iPlane],
+                      (uint8_t *)small.image.apPlanes[iPlane],
+                      small.image.aPitches[iPlane]);
+      FsYuvConvert(&yuv, &small.image, pDst, dstw * 4, dstw, dsth);
+      n++;
+      tScaled = MonotonicSec() - t;
+   }
+   while (tScaled < tSeconds);
+   tScaled /= n;
+   iBytesScaled = picture.iBytes + small.iBytes * 2
+                  + (double)dstw * dsth * 4;
+
+   printf("yuvbench: 4K to %4ux%-4u %-6s %7.3f ms instead of %7.3f ms,"
+          " %5.1f MB instead of %5.1f MB, %5.1f MB less to the X server\n",
+          dstw, dsth, FsYuvKernelName(iBestKernel), tScaled * 1000,
+          tFull * 1000, iBytesScaled / 1e6, iBytesFull / 1e6,
+          ((double)srcw * srch - (double)dstw * dsth) * 4 / 1e6);
+   free(pScaled);
+}
+
+
+
+
+/*
+ *  ScaleJob
+ */
+
+void
+ScaleJob(void *pArg, unsigned int iSlice, unsigned int nSlices)
+{
+   int            iPlane;
+   THREADSFRAME   *pFrame = (THREADSFRAME *)pArg;
+
+
+   for (iPlane = 0 ; iPlane < 3 ; iPlane++)
+      FsScaleSlice(pFrame->aScale + !!iPlane,
+                   pFrame->pSrc->apPlanes[iPlane],
+                   pFrame->pSrc->aPitches[iPlane],
+                   (uint8_t *)pFrame->pScaled->apPlanes[iPlane],
+                   pFrame->pScaled->aPitches[iPlane], iSlice, nSlices);
+}
+
+
+
+
+/*
+ *  ConvertJob
+ */
+
+void
+ConvertJob(void *pArg, unsigned int iSlice, unsigned int nSlices)
+{
+   THREADSFRAME   *pFrame = (THREADSFRAME *)pArg;
+
+
+   FsYuvConvertSlice(pFrame->pYuv,
+                     pFrame->iScaled ? pFrame->pScaled : pFrame->pSrc,
+                     pFrame->pDst, pFrame->width * 4, pFrame->width,
+                     pFrame->height, iSlice, nSlices);
+}
+
+
+
+
+/*
+ *  ThreadsFrame
+ *
+ *  One frame as fsshm.c's FsShmDisplay() does it.
+ */
+
+void
+ThreadsFrame(FSPOOL *pPool, THREADSFRAME *pFrame)
+{
+   if (pFrame->iScaled)
+      FsPoolRun(pPool, ScaleJob, pFrame);
+   FsPoolRun(pPool, ConvertJob, pFrame);
+}
+
+
+
+
+/*
+ *  BenchThreads
+ *
+ *  Times converting 4K I420, and shrinking it to 1080p then converting
+ *  it, with the best kernels on 1 thread, then 2, 4 and so on up to one
+ *  by core.  Returns the number of outputs that weren't the same as
+ *  1 thread's.
+ */
+
+int
+BenchThreads(const uint8_t *pSrc, uint8_t *pRef, uint8_t *pDst,
+             int iBestKernel, double tSeconds)
+{
+   int            iScaled,
+                  n,
+                  nBad = 0,
+                  nCpus,
+                  nThreads;
+   double         t,
+                  tOne = 0,
+                  tThreads;
+   uint8_t        *pScaled = NULL;
+   FSPOOL         *pPool;
+   FSSCALE        aScale[2];
+   FSYUV          yuv;
+   PICTURE        picture,
+                  small;
+   THREADSFRAME   frame;
+
+
+   nCpus = sysconf(_SC_NPROCESSORS_ONLN);
+   if (nCpus < 1)
+      nCpus = 1;
+   if (nCpus > FSPOOL_MAXTHREADS)
+      nCpus = FSPOOL_MAXTHREADS;
+   if (posix_memalign((void **)&pScaled, 64, (size_t)1920 * 1080 * 2))
+      return(0);
+   FsYuvInit(FSYUV_I420, iBestKernel, FSYUV_BT709, 0,     &yuv);
+   PictureLayout(FSYUV_I420, 3840, 2160, pSrc,     &picture);
+   PictureLayout(FSYUV_I420, 1920, 1080, pScaled,     &small);
+   FsScaleInit(3840, 2160, iBestKernel,     aScale);
+   FsScaleInit(1920, 1080, iBestKernel,     aScale + 1);
+   frame.pYuv = &yuv;
+   frame.aScale = aScale;
+   frame.pSrc = &picture.image;
+   frame.pScaled = &small.image;
+
+   for (iScaled = 0 ; iScaled < 2 ; iScaled++)
+   {
+      frame.iScaled = iScaled;
+      frame.width = iScaled ? 1920 : 3840;
+      frame.height = iScaled ? 1080 : 2160;
+      for (nThreads = 1 ; nThreads <= nCpus ;
+           nThreads = nThreads * 2 > nCpus && nThreads < nCpus ?
+                      nCpus : nThreads * 2)
+      {
+         // The pool is opened once, as in fsshm.c, and isn't timed
+         pPool = FsPoolOpen(nThreads);
+         frame.pDst = nThreads == 1 ? pRef : pDst;
+         ThreadsFrame(pPool, &frame);
+         if (nThreads > 1
+             && memcmp(pRef, pDst, (size_t)frame.width * frame.height * 4))
+         {
+            printf("yuvbench: %d threads, %s MISMATCH!\n", nThreads,
+                   iScaled ? "4K to 1080p" : "4K");
+            nBad++;
+         }
+
+         n = 0;
+         t = MonotonicSec();
+         do
+         {
+            ThreadsFrame(pPool, &frame);
+            n++;
+            tThreads = MonotonicSec() - t;
+         }
+         while (tThreads < tSeconds);
+         tThreads /= n;
+         if (nThreads == 1)
+            tOne = tThreads;
+         FsPoolClose(pPool);
+
+         printf("yuvbench: %-11s %-6s %2d threads %7.3f ms, %5.2fx\n",
+                iScaled ? "4K to 1080p" : "4K", FsYuvKernelName(iBestKernel),
+                nThreads, tThreads * 1000, tOne / tThreads);
+      }
+   }
+   free(pScaled);
+
+   return(nBad);
+}
+
+
+
+
+/*
+ *  main
+ */
+
+int
+main(int argc, char **argv)
+{
+   int      i,
+            iBestKernel,
+            iErr = 0;
+   size_t   iBytes = (size_t)YUVBENCH_MAXW * YUVBENCH_MAXH * 4;
+   double   tSeconds = YUVBENCH_SECONDS;
+   uint8_t  *pDst = NULL,
+            *pRef = NULL,
+            *pSrc = NULL;
+
+
+   for (i = 1 ; i < argc && !iErr ; i++)
+   {
+      if (!strncmp(argv[i], "--seconds=", 10))
+         tSeconds = atof(argv[i] + 10);
+      else
+         iErr = ERROR_YUVBENCH_USAGE;
+   }
+
+   if (!iErr)
+   {
+      // Aligned like libvlc's and fsplayer's pictures
+      if (posix_memalign((void **)&pSrc, 64, iBytes)
+          || posix_memalign((void **)&pRef, 64, iBytes)
+          || posix_memalign((void **)&pDst, 64, iBytes))
+         iErr = ERROR_YUVBENCH_MEMORY;
+   }
+   if (!iErr)
+   {
+      // Every value, limits and overshoots included
+      srand(1);
+      for (i = 0 ; i < iBytes ; i++)
+         pSrc[i] = rand();
+
+      iBestKernel = FsYuvBestKernel();
+      printf("yuvbench: best kernel %s\n", FsYuvKernelName(iBestKernel));
+      if (Check(pSrc, pRef, pDst, iBestKernel)
+          + CheckScale(pSrc, pRef, pDst, iBestKernel))
+         iErr = ERROR_YUVBENCH_MISMATCH;
+   }
+   if (!iErr)
+   {
+      Bench(pSrc, pDst, iBestKernel, tSeconds);
+      BenchScale(pSrc, pDst, iBestKernel, tSeconds);
+      if (BenchThreads(pSrc, pRef, pDst, iBestKernel, tSeconds))
+         iErr = ERROR_YUVBENCH_MISMATCH;
+   }
+
+   if (iErr == ERROR_YUVBENCH_USAGE)
+      printf("USAGE: yuvbench [--seconds=<s>]\n");
+   else if (iErr == ERROR_YUVBENCH_MEMORY)
+      printf("ERROR: Out of memory!\n");
+
+   free(pSrc);
+   free(pRef);
+   free(pDst);
+
+   return(iErr);
+}
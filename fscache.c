@@ -0,0 +1,364 @@
+/*
+ * File:        fscache.c
+ *
+ * Author:      fossette
+ *
+ * Description: Persistent media probe cache.  Remembers the video size,
+ *              length and audio tracks of the files played so that a
+ *              video seen before can go straight to fullscreen and play
+ *              without being probed again.
+ *
+ *              The cache is a fixed size file, memory-mapped, holding
+ *              as many entries as FSCACHE_MAXBYTES allows.  Entries are
+ *              keyed by the file's device, inode, size and modification
+ *              time, so a file that's replaced or touched is probed
+ *              again.  When full, the least recently used entry is
+ *              evicted.  Several fsplayer instances can share the cache
+ *              since every access is done under flock().
+ *
+ *              The cache file is $FSPLAYER_CACHE if set (set it empty
+ *              to disable the cache), or fsplayer.cache under
+ *              $XDG_CACHE_HOME or $HOME/.cache.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS''
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "fscache.h"
+
+
+
+
+/*
+ *  Constants
+ */
+
+#define FSCACHE_MAGIC            "FSPCACH1"
+#define FSCACHE_MAXBYTES         (512 * 1024)
+#define FSCACHE_FILENAME         "fsplayer.cache"
+
+#define LNSZ                     200
+
+
+
+
+/*
+ *  Types
+ */
+
+typedef struct
+{
+   char           szMagic[8];
+   uint32_t       iEntrySize,
+                  nEntries;
+   uint64_t       iClock;        // Bumped at every use, for the LRU
+} FSCACHEHEADER;
+
+typedef struct
+{
+   uint64_t       iDev,
+                  iIno,
+                  iSize,
+                  iLastUse;      // 0 when the slot is free
+   int64_t        iMtimeSec,
+                  iMtimeNsec;
+   MEDIAINFO      info;
+} FSCACHEENTRY;
+
+struct FsCache
+{
+   int            fd;
+   size_t         iMapSize;
+   FSCACHEHEADER  *pHeader;
+   FSCACHEENTRY   *pEntries;
+};
+
+
+
+
+/*
+ *  FsCacheFilename
+ */
+
+int
+FsCacheFilename(char *szFilename)
+{
+   int         iFound = 0;
+   const char  *sz;
+
+
+   *szFilename = 0;
+   sz = getenv("FSPLAYER_CACHE");
+   if (sz)
+   {
+      if (*sz && strlen(sz) < LNSZ)
+      {
+         strcpy(szFilename, sz);
+         iFound = 1;
+      }
+   }
+   else
+   {
+      sz = getenv("XDG_CACHE_HOME");
+      if (sz && *sz && strlen(sz) + sizeof(FSCACHE_FILENAME) + 1 < LNSZ)
+      {
+         sprintf(szFilename, "%s/%s", sz, FSCACHE_FILENAME);
+         iFound = 1;
+      }
+      else
+      {
+         sz = getenv("HOME");
+         if (sz && *sz
+             && strlen(sz) + sizeof(FSCACHE_FILENAME) + 8 < LNSZ)
+         {
+            sprintf(szFilename, "%s/.cache", sz);
+            mkdir(szFilename, 0700);   // Fine if it already exists
+            strcat(szFilename, "/" FSCACHE_FILENAME);
+            iFound = 1;
+         }
+      }
+   }
+
+   return(iFound);
+}
+
+
+
+
+/*
+ *  FsCacheKey
+ */
+
+int
+FsCacheKey(const char *szFilename,     FSCACHEENTRY *pKey)
+{
+   int         iOk;
+   struct stat sStat;
+
+
+   iOk = !stat(szFilename,     &sStat);
+   if (iOk)
+   {
+      pKey->iDev = sStat.st_dev;
+      pKey->iIno = sStat.st_ino;
+      pKey->iSize = sStat.st_size;
+      pKey->iMtimeSec = sStat.st_mtim.tv_sec;
+      pKey->iMtimeNsec = sStat.st_mtim.tv_nsec;
+   }
+
+   return(iOk);
+}
+
+
+
+
+/*
+ *  FsCacheOpen
+ *
+ *  Returns NULL when there's no cache to use, which isn't an error.
+ */
+
+FSCACHE *
+FsCacheOpen(void)
+{
+   int            fd,
+                  iErr = 0;
+   unsigned int   nEntries;
+   size_t         iMapSize;
+   char           szFilename[LNSZ];
+   struct stat    sStat;
+   void           *pMap = MAP_FAILED;
+   FSCACHE        *pCache = NULL;
+   FSCACHEHEADER  *pHeader;
+
+
+   nEntries = (FSCACHE_MAXBYTES - sizeof(FSCACHEHEADER))
+              / sizeof(FSCACHEENTRY);
+   iMapSize = sizeof(FSCACHEHEADER) + nEntries * sizeof(FSCACHEENTRY);
+
+   fd = -1;
+   if (FsCacheFilename(szFilename))
+      fd = open(szFilename, O_RDWR|O_CREAT|O_CLOEXEC, 0600);
+   if (fd < 0)
+      iErr = 1;
+
+   if (!iErr)
+   {
+      flock(fd, LOCK_EX);
+      iErr = fstat(fd,     &sStat);
+      if (!iErr && sStat.st_size != (off_t)iMapSize)
+      {
+         // New cache, or one from a different build, start over
+         iErr = ftruncate(fd, 0) || ftruncate(fd, iMapSize);
+      }
+      if (!iErr)
+      {
+         pMap = mmap(NULL, iMapSize, PROT_READ|PROT_WRITE, MAP_SHARED,
+                     fd, 0);
+         if (pMap == MAP_FAILED)
+            iErr = 1;
+      }
+      if (!iErr)
+      {
+         pHeader = (FSCACHEHEADER *)pMap;
+         if (memcmp(pHeader->szMagic, FSCACHE_MAGIC, 8)
+             || pHeader->iEntrySize != sizeof(FSCACHEENTRY)
+             || pHeader->nEntries != nEntries)
+         {
+            memset(pMap, 0, iMapSize);
+            memcpy(pHeader->szMagic, FSCACHE_MAGIC, 8);
+            pHeader->iEntrySize = sizeof(FSCACHEENTRY);
+            pHeader->nEntries = nEntries;
+         }
+      }
+      flock(fd, LOCK_UN);
+   }
+
+   if (!iErr)
+   {
+      pCache = malloc(sizeof(FSCACHE));
+      if (pCache)
+      {
+         pCache->fd = fd;
+         pCache->iMapSize = iMapSize;
+         pCache->pHeader = (FSCACHEHEADER *)pMap;
+         pCache->pEntries = (FSCACHEENTRY *)(pCache->pHeader + 1);
+      }
+   }
+
+   if (!pCache)
+   {
+      if (pMap != MAP_FAILED)
+         munmap(pMap, iMapSize);
+      if (fd >= 0)
+         close(fd);
+   }
+
+   return(pCache);
+}
+
+
+
+
+/*
+ *  FsCacheClose
+ */
+
+void
+FsCacheClose(FSCACHE *pCache)
+{
+   if (pCache)
+   {
+      munmap(pCache->pHeader, pCache->iMapSize);
+      close(pCache->fd);
+      free(pCache);
+   }
+}
+
+
+
+
+/*
+ *  FsCacheLookup
+ *
+ *  Returns 1 and fills pInfo when the file was probed before.
+ */
+
+int
+FsCacheLookup(FSCACHE *pCache, const char *szFilename,
+                                                   MEDIAINFO *pInfo)
+{
+   int            iFound = 0;
+   unsigned int   i;
+   FSCACHEENTRY   key,
+                  *pEntry;
+
+
+   if (pCache && FsCacheKey(szFilename,     &key))
+   {
+      flock(pCache->fd, LOCK_EX);
+      for (i = 0 ; i < pCache->pHeader->nEntries && !iFound ; i++)
+      {
+         pEntry = pCache->pEntries + i;
+         iFound = (pEntry->iLastUse
+                   && pEntry->iIno == key.iIno
+                   && pEntry->iDev == key.iDev
+                   && pEntry->iSize == key.iSize
+                   && pEntry->iMtimeSec == key.iMtimeSec
+                   && pEntry->iMtimeNsec == key.iMtimeNsec
+                   && pEntry->info.iNumAudioTracks >= 0
+                   && pEntry->info.iNumAudioTracks <= FSCACHE_MAXTRACKS);
+         if (iFound)
+         {
+            pEntry->iLastUse = ++pCache->pHeader->iClock;
+            *pInfo = pEntry->info;
+         }
+      }
+      flock(pCache->fd, LOCK_UN);
+   }
+
+   return(iFound);
+}
+
+
+
+
+/*
+ *  FsCacheStore
+ */
+
+void
+FsCacheStore(FSCACHE *pCache, const char *szFilename,
+             const MEDIAINFO *pInfo)
+{
+   unsigned int   i;
+   FSCACHEENTRY   key,
+                  *pEntry,
+                  *pVictim = NULL;
+
+
+   if (pCache && FsCacheKey(szFilename,     &key))
+   {
+      flock(pCache->fd, LOCK_EX);
+
+      // Reuse the file's own entry, else a free one, else the LRU one
+      for (i = 0 ; i < pCache->pHeader->nEntries ; i++)
+      {
+         pEntry = pCache->pEntries + i;
+         if (pEntry->iLastUse && pEntry->iIno == key.iIno
+             && pEntry->iDev == key.iDev)
+         {
+            pVictim = pEntry;
+            break;
+         }
+         if (!pVictim || pEntry->iLastUse < pVictim->iLastUse)
+            pVictim = pEntry;
+      }
+
+      if (pVictim)
+      {
+         key.iLastUse = ++pCache->pHeader->iClock;
+         key.info = *pInfo;
+         *pVictim = key;
+      }
+      flock(pCache->fd, LOCK_UN);
+   }
+}
@@ -0,0 +1,59 @@
+/*
+ * File:        fscache.h
+ *
+ * Author:      fossette
+ *
+ * Description: Persistent media probe cache, see fscache.c.
+ *
+ */
+
+#ifndef FSCACHE_H
+#define FSCACHE_H
+
+#include <stdint.h>
+
+
+
+
+/*
+ *  Constants
+ */
+
+#define FSCACHE_MAXTRACKS        16
+#define FSCACHE_NAMESZ           48
+
+
+
+
+/*
+ *  Types
+ */
+
+// What fsplayer needs to know about a video before playing it
+typedef struct
+{
+   unsigned int   vidx,
+                  vidy;
+   int64_t        iLengthMs;
+   int            iNumAudioTracks,
+                  iAudioTrackId[FSCACHE_MAXTRACKS];
+   char           szAudioTrackName[FSCACHE_MAXTRACKS][FSCACHE_NAMESZ];
+} MEDIAINFO;
+
+typedef struct FsCache FSCACHE;
+
+
+
+
+/*
+ *  Prototypes
+ */
+
+FSCACHE *FsCacheOpen(void);
+void     FsCacheClose(FSCACHE *pCache);
+int      FsCacheLookup(FSCACHE *pCache, const char *szFilename,
+                                                   MEDIAINFO *pInfo);
+void     FsCacheStore(FSCACHE *pCache, const char *szFilename,
+                      const MEDIAINFO *pInfo);
+
+#endif // FSCACHE_H
@@ -0,0 +1,483 @@
+/*
+ * File:        fsframe.c
+ *
+ * Author:      fossette
+ *
+ * Description: Recycled I420 frames for libvlc to decode into.  fsshm.c
+ *              hands them over in its lock callback and gets them back
+ *              in its unlock callback, once libvlc is done displaying
+ *              or dropping them, through a free list.  As many frames
+ *              as libvlc may hold are mapped when the video output
+ *              opens, so playing allocates nothing.  The frames are
+ *              kept from one video to the next of the same size, as
+ *              fsplayer's server mode plays them.
+ *
+ *              Each frame is its own anonymous mapping instead of
+ *              malloc()'s, so its planes are page aligned and never
+ *              share the heap.  On request they're backed by reserved
+ *              huge pages, MAP_HUGETLB, or by transparent ones, mapped
+ *              on a huge page boundary and madvise()d as such, which
+ *              spares the TLB a 4K frame's 3000 pages.  Short of
+ *              reserved huge pages, transparent ones are used, and
+ *              short of those, small ones.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS''
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include "fsframe.h"
+
+
+
+
+/*
+ *  Constants
+ */
+
+#define FSFRAMES_MAX             16       // libvlc's, at most
+#define FSFRAME_ALIGNED(n)       (((n) + FSFRAME_ALIGN - 1) \
+                                  & ~(FSFRAME_ALIGN - 1))
+#define FSFRAME_HUGE             ((size_t)2 << 20)
+#define FSFRAME_HUGED(n)         (((n) + FSFRAME_HUGE - 1) \
+                                  & ~(FSFRAME_HUGE - 1))
+
+// FSFRAME.iState
+#define FSFRAME_FREE             0
+#define FSFRAME_LOCKED           1        // libvlc's, being decoded into
+#define FSFRAME_DISPLAYED        2        // ... and displayed at least once
+
+#ifndef MAP_ANONYMOUS
+#define MAP_ANONYMOUS            MAP_ANON
+#endif // MAP_ANONYMOUS
+
+
+
+
+/*
+ *  Types
+ */
+
+struct FsFrames
+{
+   pthread_mutex_t   mutex;         // libvlc locks frames on its decoder
+                                    // thread and displays them on its
+                                    // video output thread
+   pthread_cond_t    freed;
+   int               iPages;
+   unsigned int      width,
+                     height,
+                     nFrames,
+                     nInFlight;     // Locked, not unlocked yet
+   FSFRAME           *apFrames[FSFRAMES_MAX],
+                     *pFree;
+   FSFRAMESTATS      stats;
+};
+
+
+
+
+/*
+ *  Global variables
+ */
+
+const char *gszFsFramePagesName[] = { "small", "thp", "hugetlb" };
+
+
+
+
+/*
+ *  FsFrameMap
+ *
+ *  Maps iBytes for pFrame, with huge pages if iPages asks for them and
+ *  they can be had.  Returns 1 when out of memory.
+ */
+
+int
+FsFrameMap(size_t iBytes, int iPages,     FSFRAME *pFrame)
+{
+   int      iFlags = MAP_PRIVATE|MAP_ANONYMOUS;
+   size_t   iHead,
+            iMapped = 0;
+   uint8_t  *p = MAP_FAILED;
+
+
+#ifdef MAP_HUGETLB
+   if (iPages == FSFRAME_PAGES_HUGETLB)
+   {
+      iMapped = FSFRAME_HUGED(iBytes);
+      p = mmap(NULL, iMapped, PROT_READ|PROT_WRITE, iFlags|MAP_HUGETLB, -1,
+               0);
+   }
+#endif // MAP_HUGETLB
+   if (p == MAP_FAILED && iPages >= FSFRAME_PAGES_THP)
+   {
+      iPages = FSFRAME_PAGES_THP;
+      iMapped = FSFRAME_HUGED(iBytes);
+#ifdef MAP_ALIGNED_SUPER
+      // FreeBSD promotes superpages by itself, once aligned
+      p = mmap(NULL, iMapped, PROT_READ|PROT_WRITE,
+               iFlags|MAP_ALIGNED_SUPER, -1, 0);
+#else
+      // One huge page more, then trimmed to a huge page boundary
+      p = mmap(NULL, iMapped + FSFRAME_HUGE, PROT_READ|PROT_WRITE, iFlags,
+               -1, 0);
+      if (p != MAP_FAILED)
+      {
+         iHead = FSFRAME_HUGED((uintptr_t)p) - (uintptr_t)p;
+         if (iHead)
+            munmap(p, iHead);
+         munmap(p + iHead + iMapped, FSFRAME_HUGE - iHead);
+         p += iHead;
+#ifdef MADV_HUGEPAGE
+         madvise(p, iMapped, MADV_HUGEPAGE);
+#endif // MADV_HUGEPAGE
+      }
+#endif // MAP_ALIGNED_SUPER
+   }
+   if (p == MAP_FAILED)
+   {
+      iPages = FSFRAME_PAGES_SMALL;
+      iMapped = iBytes;
+      p = mmap(NULL, iMapped, PROT_READ|PROT_WRITE, iFlags, -1, 0);
+   }
+
+   if (p != MAP_FAILED)
+   {
+      pFrame->pBuffer = p;
+      pFrame->iMapped = iMapped;
+      pFrame->iPages = iPages;
+   }
+
+   return(p == MAP_FAILED);
+}
+
+
+
+
+/*
+ *  FsFrameNew
+ *
+ *  An I420 frame of width by height, each row 64 bytes aligned for the
+ *  SIMD kernels.  Returns NULL when out of memory.
+ */
+
+FSFRAME *
+FsFrameNew(unsigned int width, unsigned int height, int iPages)
+{
+   unsigned int   ch = (height + 1) / 2,
+                  cw = FSFRAME_ALIGNED((width + 1) / 2),
+                  yw = FSFRAME_ALIGNED(width);
+   FSFRAME        *pFrame;
+
+
+   pFrame = calloc(1, sizeof(FSFRAME));
+   if (pFrame
+       && FsFrameMap((size_t)yw * height + (size_t)cw * ch * 2, iPages,
+                                                                 pFrame))
+   {
+      free(pFrame);
+      pFrame = NULL;
+   }
+   if (pFrame)
+   {
+      pFrame->image.apPlanes[0] = pFrame->pBuffer;
+      pFrame->image.apPlanes[1] = pFrame->pBuffer + (size_t)yw * height;
+      pFrame->image.apPlanes[2] = pFrame->image.apPlanes[1]
+                                  + (size_t)cw * ch;
+      pFrame->image.aPitches[0] = yw;
+      pFrame->image.aPitches[1] = pFrame->image.aPitches[2] = cw;
+   }
+
+   return(pFrame);
+}
+
+
+
+
+/*
+ *  FsFrameFree
+ */
+
+void
+FsFrameFree(FSFRAME *pFrame)
+{
+   if (pFrame)
+   {
+      munmap(pFrame->pBuffer, pFrame->iMapped);
+      free(pFrame);
+   }
+}
+
+
+
+
+/*
+ *  FsFramePagesName
+ */
+
+const char *
+FsFramePagesName(int iPages)
+{
+   return(gszFsFramePagesName[iPages]);
+}
+
+
+
+
+/*
+ *  FsFramesEmpty
+ *
+ *  Unmaps every frame, none being libvlc's anymore.
+ */
+
+void
+FsFramesEmpty(FSFRAMES *pFrames)
+{
+   unsigned int   i;
+
+
+   for (i = 0 ; i < pFrames->nFrames ; i++)
+      FsFrameFree(pFrames->apFrames[i]);
+   pFrames->nFrames = pFrames->nInFlight = 0;
+   pFrames->pFree = NULL;
+}
+
+
+
+
+/*
+ *  FsFramesOpen
+ *
+ *  iPages is the FSFRAME_PAGES_* the frames should be backed by.
+ */
+
+FSFRAMES *
+FsFramesOpen(int iPages)
+{
+   FSFRAMES *pFrames;
+
+
+   pFrames = calloc(1, sizeof(FSFRAMES));
+   if (pFrames)
+   {
+      pFrames->iPages = iPages;
+      pthread_mutex_init(&pFrames->mutex, NULL);
+      pthread_cond_init(&pFrames->freed, NULL);
+   }
+
+   return(pFrames);
+}
+
+
+
+
+/*
+ *  FsFramesClose
+ */
+
+void
+FsFramesClose(FSFRAMES *pFrames)
+{
+   if (pFrames)
+   {
+      FsFramesEmpty(pFrames);
+      pthread_cond_destroy(&pFrames->freed);
+      pthread_mutex_destroy(&pFrames->mutex);
+      free(pFrames);
+   }
+}
+
+
+
+
+/*
+ *  FsFramesFormat
+ *
+ *  For libvlc's format callback, a video output opening that may hold
+ *  nMax frames of width by height at once.  Frames of another size are
+ *  unmapped, the others are all free again, and the missing ones are
+ *  mapped now, so FsFramesLock() always has one.  pPitches gets the
+ *  planes'.  Returns 1 when out of memory.
+ */
+
+int
+FsFramesFormat(FSFRAMES *pFrames, unsigned int width, unsigned int height,
+               unsigned int nMax,     unsigned int *pPitches)
+{
+   int            iErr = 0;
+   unsigned int   i;
+   FSFRAME        *pFrame;
+
+
+   pthread_mutex_lock(&pFrames->mutex);
+   if (width != pFrames->width || height != pFrames->height
+       || nMax < pFrames->nFrames)
+      FsFramesEmpty(pFrames);
+   pFrames->width = width;
+   pFrames->height = height;
+   pFrames->nInFlight = 0;
+   pFrames->pFree = NULL;
+   for (i = 0 ; i < pFrames->nFrames ; i++)
+   {
+      pFrame = pFrames->apFrames[i];
+      pFrame->iState = FSFRAME_FREE;
+      pFrame->pNext = pFrames->pFree;
+      pFrames->pFree = pFrame;
+   }
+
+   if (nMax > FSFRAMES_MAX)
+      iErr = 1;
+   while (!iErr && pFrames->nFrames < nMax)
+   {
+      pFrame = FsFrameNew(width, height, pFrames->iPages);
+      if (pFrame)
+      {
+         pFrames->apFrames[pFrames->nFrames++] = pFrame;
+         pFrame->pNext = pFrames->pFree;
+         pFrames->pFree = pFrame;
+         pFrames->stats.nMisses++;
+      }
+      else
+         iErr = 1;
+   }
+   if (iErr)
+      FsFramesEmpty(pFrames);
+   else
+      memcpy(pPitches, pFrames->apFrames[0]->image.aPitches,
+             3 * sizeof(unsigned int));
+   pthread_mutex_unlock(&pFrames->mutex);
+
+   return(iErr);
+}
+
+
+
+
+/*
+ *  FsFramesLock
+ *
+ *  For libvlc's lock callback, a free frame to decode the next picture
+ *  into.  libvlc never holds more than FsFramesFormat()'s nMax, so
+ *  there's always one, else this waits for FsFramesUnlock().
+ */
+
+FSFRAME *
+FsFramesLock(FSFRAMES *pFrames)
+{
+   FSFRAME  *pFrame;
+
+
+   pthread_mutex_lock(&pFrames->mutex);
+   while (!pFrames->pFree)
+      pthread_cond_wait(&pFrames->freed, &pFrames->mutex);
+   pFrame = pFrames->pFree;
+   pFrames->pFree = pFrame->pNext;
+   pFrame->iState = FSFRAME_LOCKED;
+   pFrames->nInFlight++;
+   pFrames->stats.nHits++;
+   if (pFrames->nInFlight > pFrames->stats.nPeak)
+      pFrames->stats.nPeak = pFrames->nInFlight;
+   pthread_mutex_unlock(&pFrames->mutex);
+
+   return(pFrame);
+}
+
+
+
+
+/*
+ *  FsFramesDisplayed
+ *
+ *  For libvlc's display callback, which only reads pFrame, maybe more
+ *  than once.
+ */
+
+void
+FsFramesDisplayed(FSFRAMES *pFrames, FSFRAME *pFrame)
+{
+   pthread_mutex_lock(&pFrames->mutex);
+   if (pFrame->iState == FSFRAME_LOCKED)
+      pFrame->iState = FSFRAME_DISPLAYED;
+   pthread_mutex_unlock(&pFrames->mutex);
+}
+
+
+
+
+/*
+ *  FsFramesUnlock
+ *
+ *  For libvlc's unlock callback, libvlc is done with pFrame, displayed
+ *  or dropped, and it goes back to the free list.
+ */
+
+void
+FsFramesUnlock(FSFRAMES *pFrames, FSFRAME *pFrame)
+{
+   pthread_mutex_lock(&pFrames->mutex);
+   if (pFrame->iState != FSFRAME_FREE)
+   {
+      if (pFrame->iState == FSFRAME_LOCKED)
+         pFrames->stats.nDropped++;
+      pFrame->iState = FSFRAME_FREE;
+      pFrame->pNext = pFrames->pFree;
+      pFrames->pFree = pFrame;
+      pFrames->nInFlight--;
+      pthread_cond_signal(&pFrames->freed);
+   }
+   pthread_mutex_unlock(&pFrames->mutex);
+}
+
+
+
+
+/*
+ *  FsFramesStats
+ */
+
+void
+FsFramesStats(FSFRAMES *pFrames,     FSFRAMESTATS *pStats)
+{
+   unsigned int   i;
+
+
+   pthread_mutex_lock(&pFrames->mutex);
+   *pStats = pFrames->stats;
+   pStats->nFrames = pFrames->nFrames;
+   pStats->iPages = pFrames->nFrames
+                    ? pFrames->apFrames[pFrames->nFrames - 1]->iPages
+                    : pFrames->iPages;
+   for (i = 0 ; i < pFrames->nFrames ; i++)
+      pStats->iMapped += pFrames->apFrames[i]->iMapped;
+   pthread_mutex_unlock(&pFrames->mutex);
+}
+
+
+
+
+/*
+ *  FsFramesResetStats
+ */
+
+void
+FsFramesResetStats(FSFRAMES *pFrames)
+{
+   pthread_mutex_lock(&pFrames->mutex);
+   memset(&pFrames->stats, 0, sizeof(FSFRAMESTATS));
+   pthread_mutex_unlock(&pFrames->mutex);
+}
@@ -0,0 +1,86 @@
+/*
+ * File:        fsframe.h
+ *
+ * Author:      fossette
+ *
+ * Description: Recycled I420 frames for libvlc to decode into, see
+ *              fsframe.c.
+ *
+ */
+
+#ifndef FSFRAME_H
+#define FSFRAME_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "fsyuv.h"
+
+
+
+
+/*
+ *  Constants
+ */
+
+#define FSFRAME_ALIGN            64       // Each row, for the SIMD kernels
+
+// What backs the frames
+#define FSFRAME_PAGES_SMALL      0
+#define FSFRAME_PAGES_THP        1        // Transparent huge pages
+#define FSFRAME_PAGES_HUGETLB    2        // Reserved huge pages
+
+
+
+
+/*
+ *  Types
+ */
+
+// An I420 picture of its own mapping, see FsFrameNew()
+typedef struct FsFrame
+{
+   struct FsFrame *pNext;        // In the free list
+   int            iState,        // FSFRAMES' use, see fsframe.c
+                  iPages;        // FSFRAME_PAGES_SMALL to _HUGETLB
+   size_t         iMapped;
+   uint8_t        *pBuffer;
+   FSYUVIMAGE     image;
+} FSFRAME;
+
+// What the frames did since FsFramesResetStats()
+typedef struct
+{
+   unsigned int   nHits,         // Locks given a free frame
+                  nMisses,       // Frames mapped
+                  nDropped,      // Unlocked without being displayed
+                  nPeak,         // Most frames libvlc held at once
+                  nFrames;       // Mapped now
+   int            iPages;        // The last frame's backing
+   uint64_t       iMapped;       // Bytes, for nFrames
+} FSFRAMESTATS;
+
+typedef struct FsFrames FSFRAMES;
+
+
+
+
+/*
+ *  Prototypes
+ */
+
+FSFRAME    *FsFrameNew(unsigned int width, unsigned int height, int iPages);
+void        FsFrameFree(FSFRAME *pFrame);
+const char *FsFramePagesName(int iPages);
+
+FSFRAMES   *FsFramesOpen(int iPages);
+void        FsFramesClose(FSFRAMES *pFrames);
+int         FsFramesFormat(FSFRAMES *pFrames, unsigned int width,
+                           unsigned int height, unsigned int nMax,
+                                               unsigned int *pPitches);
+FSFRAME    *FsFramesLock(FSFRAMES *pFrames);
+void        FsFramesDisplayed(FSFRAMES *pFrames, FSFRAME *pFrame);
+void        FsFramesUnlock(FSFRAMES *pFrames, FSFRAME *pFrame);
+void        FsFramesStats(FSFRAMES *pFrames,     FSFRAMESTATS *pStats);
+void        FsFramesResetStats(FSFRAMES *pFrames);
+
+#endif // FSFRAME_H
@@ -45,29 +45,57 @@
  *                - 1-9          Move a smaller view to the
  *                               specified area within the screen.
  *
+ *              These are the default bindings, fsplayer.keys may
+ *              change them, see KeyBindingsLoad().  Holding a jump
+ *              key makes its jumps grow, see SeekStep().
+ *
  *              Note that since fullscreen mode is not well implemented
  *              and/or documented in X11 and window managers, the
  *              technique used here is simply to offset the window
  *              decorations out of the visible screen area.  However,
- *              minimal MOTIF wizardry is attempted first should a
- *              'modern' window manager be present.
+ *              minimal MOTIF wizardry is attempted first, and a window
+ *              manager listing _NET_WM_STATE_FULLSCREEN in
+ *              _NET_SUPPORTED is simply asked for fullscreen instead.
+ *
+ *              libvlc draws into a child window of fsplayer's own
+ *              background window, so several instances of fsplayer,
+ *              or VLC itself, can share the same display.
+ *              The black background goes fullscreen first, and the
+ *              video window is only mapped once sized and placed, so
+ *              the first frame shows up where it belongs.
  *
- *              Known issues:
- *                1) There's a 1 second short play before fullscreen is
- *                   kicked in.  This is because libvlc creates its
- *                   playing thread only at the PLAY command, and there's
- *                   a delay before video stats are made available.
+ *              The event loop sleeps in epoll_wait() until a key is
+ *              pressed, libvlc has news, a signal is received or the
+ *              video should be over, so keys take effect at once and
+ *              nothing runs while nothing happens.  On FreeBSD, epoll,
+ *              eventfd, signalfd and timerfd come from libepoll-shim.
+ *              The libvlc calls the keys ask for are made by a control
+ *              thread fed through a lock-free ring, since libvlc may
+ *              hold them up while it's busy decoding.
  *
- *                2) Can't run fsplayer with other instances of fsplayer
- *                   or even have VLC open.  This is because libvlc
- *                   doesn't provide a way to get the window-id that it
- *                   creates.
+ * Parameter:   The video file to play, or --server to stay resident
+ *              with the X11 connection, windows and VLC engine ready.
+ *              When a server is running, "fsplayer <file>" hands the
+ *              file over to it through a Unix socket and returns when
+ *              the video ends.
  *
- *                3) There's a 0.4 second max delay when pressing the
- *                   video browsing keys.  This will get fixed when I'll
- *                   have a better understanding of X11.
+ *              --profile=tuned starts libvlc with a curated set of
+ *              arguments, pinned outputs and no configuration file,
+ *              which loads faster than libvlc's defaults.  It may also
+ *              be set in fsplayer.conf, see ConfigRead().
+ *              --bench-startup compares both profiles.
+ *              --render=shm has libvlc decode into fsplayer's pictures,
+ *              which fsplayer converts and puts in wVideo itself through
+ *              MIT-SHM, see fsshm.c, instead of libvlc's video output.
+ *              It may also be set in fsplayer.conf.
+ *              --hugepages=thp or hugetlb backs those pictures with huge
+ *              pages, see fsframe.c.  It may also be set in fsplayer.conf.
  *
- * Parameter:   The video file to play.
+ *              --timings prints, on stderr at exit, one JSON line with
+ *              the time each startup phase ended, in milliseconds since
+ *              main() started.
+ *              It also has how long each kind of key took to show its
+ *              effect, which SIGUSR1 prints at any time.
  *
  * Web:         https://github.com/fossette/fsplayer/wiki
  *
@@ -85,16 +113,38 @@
  *
  */
 
+#ifndef __FreeBSD__
+#define _GNU_SOURCE                       // struct ucred
+#endif // __FreeBSD__
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/select.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
 #include <sys/stat.h>
+#include <sys/timerfd.h>
+#include <sys/un.h>
+#include <time.h>
 #include <unistd.h>
 #include <vlc/vlc.h>
 #include <X11/Xlib.h>
 #include <X11/keysym.h>
 #include <X11/Xatom.h>
 #include <X11/extensions/xf86vmode.h>
+#include "fscache.h"
+#include "fsframe.h"
+#include "fsshm.h"
 
 
 
@@ -107,18 +157,443 @@
 #define FSPLAYER_10SEC           10000
 #define FSPLAYER_1MIN            60000
 #define FSPLAYER_10MIN           600000
-#define FSPLAYER_LIBVLCWMNAME    "VLC media player"
+#define FSPLAYER_READYTIMEOUT    5000     // Max wait for the video stats
+#define FSPLAYER_PARSETIMEOUT    3000     // Max wait for the media parsing
+#define FSPLAYER_MAPTIMEOUT      1000     // Max wait for the WM to map us
+#define FSPLAYER_EXITTIMEOUT     1000     // Max wait for libvlc at exit
+#define FSPLAYER_CLIENTTIMEOUT   2000     // Max wait for a client's request
+#define FSPLAYER_SEEKDEBOUNCE    120      // Quiet time ending a key burst
+#define FSPLAYER_SEEKMAXWAIT     400      // A held key seeks this often
+#define FSPLAYER_SEEKTIMEOUT     1000     // Max wait for a seek to settle
+#define FSPLAYER_SEEKSETTLE      1000     // Clock this close to the target
+#define FSPLAYER_CLOCKHOLD       1000     // Max clock run without libvlc
+#define FSPLAYER_HOLDGAP         700      // Autorepeat presses come closer
+#define FSPLAYER_HOLDDOUBLE      1000     // A held jump key doubles so often
+#define FSPLAYER_HOLDMAXSHIFT    6        // ... up to 64 times its step
 #define FSPLAYER_WMNAME          "fsplayer"
+#define FSPLAYER_CONFIG          "fsplayer.conf"
+#define FSPLAYER_KEYS            "fsplayer.keys"
+#define FSPLAYER_BENCHRUNS       5
+#define FSPLAYER_MAXVLCARGS      24
+#define FSPLAYER_MAXEVENTS       8
+#define FSPLAYER_CTLRING         256      // Power of 2, see RingPush()
+#define FSPLAYER_BUSYBUCKETS     7        // See giBusyBoundUs
+#define FSPLAYER_LATSAMPLES      512      // The latest kept, see LATENCY
+#define FSPLAYER_LATPENDING      64       // Keys awaiting their effect
+
+// What woke up ReactorWait()
+#define FSPLAYER_R_X11           0x01
+#define FSPLAYER_R_VLC           0x02
+#define FSPLAYER_R_SIGNAL        0x04
+#define FSPLAYER_R_TIMER         0x08
+#define FSPLAYER_R_CLIENT        0x10
+#define FSPLAYER_R_DUMP          0x20     // SIGUSR1, see LatencyDump()
+
+// The libvlc calls made by ControlThread(), see ControlSend()
+#define FSPLAYER_C_SEEK          1        // iArg is the time
+#define FSPLAYER_C_PAUSE         2
+#define FSPLAYER_C_VOLUME        3        // iArg is the change
+#define FSPLAYER_C_AUDIOTRACK    4        // iArg is the track id
+
+// What the seek timer is armed for, see SeekArmTimer()
+#define FSPLAYER_S_NONE          0
+#define FSPLAYER_S_DEBOUNCE      1        // The burst of keys to end
+#define FSPLAYER_S_INFLIGHT      2        // The seek sent to give up on
+
+// What the keys' latency is measured for, see gszLatencyName
+#define FSPLAYER_L_SEEK          0        // Up to the seek settled
+#define FSPLAYER_L_PAUSE         1        // Up to libvlc's state change
+#define FSPLAYER_L_VOLUME        2        // Up to the volume set
+#define FSPLAYER_L_AUDIOTRACK    3        // Up to the track set
+#define FSPLAYER_L_VIEW          4        // Up to wVideo's ConfigureNotify
+#define FSPLAYER_L_QUIT          5        // Up to BackgroundHide()
+#define FSPLAYER_L_COUNT         6
+
+// Startup phases of the --timings report, see gszTimingName
+#define FSPLAYER_T_ARGS          0
+#define FSPLAYER_T_XOPENDISPLAY  1
+#define FSPLAYER_T_MODELINE      2
+#define FSPLAYER_T_WINDOWS       3
+#define FSPLAYER_T_BACKGROUND    4
+#define FSPLAYER_T_LIBVLCNEW     5
+#define FSPLAYER_T_MEDIAOPEN     6
+#define FSPLAYER_T_FIRSTPLAY     7
+#define FSPLAYER_T_VIDEOSIZE     8
+#define FSPLAYER_T_LAYOUT        9
+#define FSPLAYER_T_FIRSTFRAME    10
+#define FSPLAYER_T_ENDREACHED    11
+#define FSPLAYER_T_EXIT          12
+#define FSPLAYER_T_HIDDEN        13
+#define FSPLAYER_T_RELEASED      14
+#define FSPLAYER_T_COUNT         15
+
+// Atoms interned at once by X11Open(), see gszAtomName
+#define FSPLAYER_A_MOTIFWMHINTS  0
+#define FSPLAYER_A_NETSUPPORTED  1
+#define FSPLAYER_A_NETWMSTATE    2
+#define FSPLAYER_A_NETWMSTATEFS  3
+#define FSPLAYER_A_COUNT         4
+
+// Key actions, see gszKeyActionName and KeyBindingsLoad()
+#define FSPLAYER_K_NONE          0
+#define FSPLAYER_K_QUIT          1
+#define FSPLAYER_K_PAUSE         2
+#define FSPLAYER_K_START         3
+#define FSPLAYER_K_END           4
+#define FSPLAYER_K_BACK10SEC     5        // The jumps, see giKeySeekMs
+#define FSPLAYER_K_FWD10SEC      6
+#define FSPLAYER_K_BACK1MIN      7
+#define FSPLAYER_K_FWD1MIN       8
+#define FSPLAYER_K_BACK10MIN     9
+#define FSPLAYER_K_FWD10MIN      10
+#define FSPLAYER_K_VOLUP         11
+#define FSPLAYER_K_VOLDOWN       12
+#define FSPLAYER_K_AUDIOTRACK    13
+#define FSPLAYER_K_VIEW1         14       // PositionWindow()'s 1 to 9
+#define FSPLAYER_K_VIEW2         15
+#define FSPLAYER_K_VIEW3         16
+#define FSPLAYER_K_VIEW4         17
+#define FSPLAYER_K_VIEW5         18
+#define FSPLAYER_K_VIEW6         19
+#define FSPLAYER_K_VIEW7         20
+#define FSPLAYER_K_VIEW8         21
+#define FSPLAYER_K_VIEW9         22
+#define FSPLAYER_K_COUNT         23
+
+#define FSPLAYER_PROFILE_DEFAULT 0        // libvlc_new(0, NULL)
+#define FSPLAYER_PROFILE_TUNED   1        // FSPLAYER_TUNEDARGS
+#define FSPLAYER_RENDER_VOUT     0        // libvlc draws into wVideo
+#define FSPLAYER_RENDER_SHM      1        // fsplayer does, see fsshm.c
+#define FSPLAYER_TUNEDVOUT       "xcb_x11"
+#ifdef __FreeBSD__
+#define FSPLAYER_TUNEDAOUT       "oss"
+#else
+#define FSPLAYER_TUNEDAOUT       "alsa"
+#endif
+
+// libvlc_new() arguments of the tuned profile, the outputs are added
+// to these.  Every module search and configuration file read that's
+// skipped here is time saved at every launch.
+#define FSPLAYER_TUNEDARGS       "--ignore-config",                \
+                                 "--plugins-cache",                \
+                                 "--no-plugins-scan",              \
+                                 "--no-video-title-show",          \
+                                 "--no-osd",                       \
+                                 "--no-snapshot-preview",          \
+                                 "--no-stats",                     \
+                                 "--no-lua",                       \
+                                 "--no-sub-autodetect-file",       \
+                                 "--no-metadata-network-access"
 
 #define ERROR_FSPLAYER_USAGE     1
 #define ERROR_FSPLAYER_X11       2
 #define ERROR_FSPLAYER_VLC       3
-#define ERROR_FSPLAYER_FAIL      4
+#define ERROR_FSPLAYER_FAIL      4        // No longer returned
 #define ERROR_FSPLAYER_MEM       5
-#define ERROR_FSPLAYER_VLCRUN    6
+#define ERROR_FSPLAYER_VLCRUN    6        // No longer returned
+#define ERROR_FSPLAYER_SOCKET    7
+#define ERROR_FSPLAYER_REACTOR   8
 
 #define LNSZ                     200
 
+// Counts the X requests waiting for the server's reply
+#define X11REPLY(x)              (giX11RoundTrips++, (x))
+
+
+
+
+/*
+ *  Types
+ */
+
+// What the command line and the configuration file asked for
+typedef struct
+{
+   int               iBenchStartup,
+                     iPages,
+                     iProfile,
+                     iRender,
+                     iServer,
+                     iTimings;
+   const char        *szFilename;
+   char              szAout[LNSZ],
+                     szVout[LNSZ];
+} FSOPTIONS;
+
+// libvlc_new()'s arguments, argv pointing within the structure
+typedef struct
+{
+   int               argc;
+   const char        *argv[FSPLAYER_MAXVLCARGS];
+   char              szAout[LNSZ + 8],
+                     szVout[LNSZ + 8];
+} VLCARGS;
+
+// What libvlc told us so far through its events
+typedef struct
+{
+   pthread_mutex_t   mutex;
+   pthread_cond_t    cond;
+   int               fdWakeup,   // ReactorWait()'s eventfd, or -1
+                     iClockRunning,
+                     iEnded,     // EndReached, Stopped or EncounteredError
+                     iError,
+                     iNumAudioEs,
+                     iNumVideoEs,
+                     iNumVout,
+                     iParsedStatus,
+                     iPaused;
+   float             fRate;
+   double            tClock,     // When iClockMs was heard of
+                     tEnded,
+                     tFirstFrame,
+                     tPauseChanged, // The last Playing or Paused
+                     tReleased,  // VlcTeardownThread() is done
+                     tSeekIssued,
+                     tSeekSettled;
+   libvlc_time_t     iClockMs,   // See VlcClockNow()
+                     iLengthMs,
+                     iSeekTarget;   // The seek in flight, or -1
+   unsigned int      iSeekGen,      // The last seek sent, never reset
+                     iSeekDone;     // The last one libvlc took
+} VLCSTATE;
+
+// Navigation keys pile up here, see SeekQueue() and SeekIssue()
+typedef struct
+{
+   int               iDue,          // The debounce is over
+                     iTimer,        // FSPLAYER_S_*
+                     nKeys,
+                     nSeeks;
+   libvlc_time_t     iTargetMs;     // Not sent to libvlc yet, or -1
+   double            tBurst,        // The burst's first key
+                     tFirstKey,     // The first key since the last seek
+                     tQueued,       // The last key
+                     tInFlight;     // When the seek in flight was sent
+   int               iHeldAction;   // The jump key held, see SeekStep()
+   Time              tHeld,         // When it went down, X server time
+                     tLastKey;      // Its last autorepeat
+} SEEKQUEUE;
+
+// How long one kind of key took to show its effect, see LatencyKey()
+typedef struct
+{
+   double            atPending[FSPLAYER_LATPENDING]; // Keys' times, FIFO
+   int               iPending,         // The oldest key awaiting
+                     nPending,
+                     nSamples;         // Ever taken, the latest are kept
+   float             afSamplesMs[FSPLAYER_LATSAMPLES];
+} LATENCY;
+
+// When each startup phase ended, in CLOCK_MONOTONIC milliseconds
+typedef struct
+{
+   double            t0,
+                     t[FSPLAYER_T_COUNT];
+   int               iLoopRoundTrips,  // X11REPLY()s while playing
+                     iX11QueueMax,     // Most X events read but unhandled
+                     nLoopWakeups,     // ReactorWait() returns
+                     nPausedWakeups,   // ... while paused
+                     nSeekKeys,
+                     nSeeks;
+   double            tSeekSettleMs;    // The last burst of seek keys
+   int               aLoopBusy[FSPLAYER_BUSYBUCKETS], // See TimingsBusy()
+                     nControlCmds,
+                     nControlDropped;
+   double            tLoopBusyMaxMs,
+                     tControlMaxMs,    // The slowest libvlc call
+                     tLoopMs,          // The event loop's whole run
+                     tPausedMs;        // ... paused
+   long              nPausedSwitches;  // See ContextSwitches(), or -1
+   LATENCY           aLatency[FSPLAYER_L_COUNT];
+   int               iShm;             // The video went through fsshm.c
+   FSSHMSTATS        shm;
+} TIMINGS;
+
+// What PlayMedia() and ServerRun() wait on, see ReactorOpen()
+typedef struct
+{
+   int               fdEpoll,
+                     fdEvent,    // eventfd, signalled by libvlc's events
+                     fdSignal,   // signalfd, SIGHUP, SIGINT, SIGTERM, SIGUSR1
+                     fdTimer,    // timerfd, the next deadline
+                     iSignal;    // The last signal received
+} REACTOR;
+
+// A libvlc call for ControlThread(), and then its outcome
+typedef struct
+{
+   int               iCmd,             // FSPLAYER_C_*
+                     iResult;
+   unsigned int      iSeekGen;         // VLCSTATE's, for FSPLAYER_C_SEEK
+   int64_t           iArg;
+   double            tQueued,
+                     tDone;
+} CONTROLCMD;
+
+// Single producer, single consumer ring, see RingPush() and RingPop().
+// Each end is on its own cache line.
+typedef struct
+{
+   _Alignas(64) atomic_uint iHead;     // Next to pop, the consumer's
+   _Alignas(64) atomic_uint iTail;     // Next to push, the producer's
+   CONTROLCMD        aCmd[FSPLAYER_CTLRING];
+} CONTROLRING;
+
+// The libvlc control thread of the video playing, see ControlStart()
+typedef struct
+{
+   CONTROLRING       toVlc,            // From the event loop
+                     fromVlc;          // Back to it, with the results
+   int               fdControl,        // eventfd, wakes ControlThread()
+                     fdWakeup,         // A dup of REACTOR fdEvent, the
+                                       // thread's own
+                     iStarted,
+                     iRunning;         // Until ControlThread() returns,
+                                       // under pState's mutex
+   atomic_int        iQuit;
+   pthread_t         thread;
+   VLCSTATE          *pState;          // Its cond tells iRunning changed
+   libvlc_media_player_t *pVlcPlayer;  // Retained by the thread
+} CONTROL;
+
+// The VLC engine loading and media parsing, done in the background
+typedef struct
+{
+   const char        *szFilename;
+   VLCSTATE          *pState;
+   int               iCacheHit,
+                     iErr,
+                     iProbed;    // info is complete, no need to parse
+   char              szErr[LNSZ];
+   MEDIAINFO         info;
+   TIMINGS           *pTimings;
+   VLCARGS           vlcArgs;
+   libvlc_instance_t *pVlcInst;
+   libvlc_media_t    *pVlcMedia;
+} VLCSTARTUP;
+
+// What's left of libvlc at exit, released in the background
+typedef struct
+{
+   VLCSTATE              *pState;
+   libvlc_instance_t     *pVlcInst;
+   libvlc_media_t        *pVlcMedia;
+   libvlc_media_player_t *pVlcPlayer;
+} VLCTEARDOWN;
+
+// A default key binding, see KeyBindingsLoad()
+typedef struct
+{
+   KeySym            ks;
+   int               iAction;
+} KEYBINDING;
+
+// What outlives a single video, kept warm in server mode
+typedef struct
+{
+   int               iX11DefaultScreen;
+   unsigned int      scrx,
+                     scry,
+                     vidh,             // wVideo's size, see VideoLayout()
+                     vidw;
+   int               iVideoPos,        // Its keypad position
+                     iX11TimeSynced;   // See X11TimeMs()
+   double            tX11TimeOffset;
+   Display           *pX11Display;
+   unsigned char     aKeyAction[256];  // FSPLAYER_K_*, by keycode
+   int               iEwmhFullscreen;  // The WM does _NET_WM_STATE
+   Atom              aAtoms[FSPLAYER_A_COUNT];
+   Window            wInput,
+                     wInputMaster,     // wInput's WM frame, if any
+                     wRoot,
+                     wTaskbar,         // Unmapped while playing
+                     wVideo;
+   libvlc_instance_t *pVlcInst;
+   FSCACHE           *pCache;
+   FSSHM             *pShm;            // NULL when libvlc draws
+   REACTOR           reactor;
+   CONTROL           control;
+   TIMINGS           timings;
+   VLCSTATE          vlcState;
+} FSPLAYER;
+
+
+
+
+/*
+ *  Global variables
+ */
+
+const char *gszTimingName[FSPLAYER_T_COUNT] =
+{
+   "args", "xopendisplay", "modeline", "windows", "background",
+   "libvlc_new", "media_open", "first_play", "video_size", "layout",
+   "first_frame", "end_reached", "exit", "hidden", "released"
+};
+
+char *gszAtomName[FSPLAYER_A_COUNT] =
+{
+   "_MOTIF_WM_HINTS", "_NET_SUPPORTED", "_NET_WM_STATE",
+   "_NET_WM_STATE_FULLSCREEN"
+};
+
+const char *gszKeyActionName[FSPLAYER_K_COUNT] =
+{
+   "none", "quit", "pause", "start", "end", "back_10s", "forward_10s",
+   "back_1min", "forward_1min", "back_10min", "forward_10min",
+   "volume_up", "volume_down", "audio_track", "view_1", "view_2",
+   "view_3", "view_4", "view_5", "view_6", "view_7", "view_8", "view_9"
+};
+
+// The unaccelerated step of each action that jumps, 0 otherwise
+const libvlc_time_t giKeySeekMs[FSPLAYER_K_COUNT] =
+{
+   0, 0, 0, 0, 0, -FSPLAYER_10SEC, FSPLAYER_10SEC,
+   -FSPLAYER_1MIN, FSPLAYER_1MIN, -FSPLAYER_10MIN, FSPLAYER_10MIN,
+   0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0
+};
+
+const KEYBINDING gaDefaultKeys[] =
+{
+   { XK_Escape,       FSPLAYER_K_QUIT       },
+   { XK_space,        FSPLAYER_K_PAUSE      },
+   { XK_Home,         FSPLAYER_K_START      },
+   { XK_End,          FSPLAYER_K_END        },
+   { XK_Left,         FSPLAYER_K_BACK10SEC  },
+   { XK_Right,        FSPLAYER_K_FWD10SEC   },
+   { XK_Down,         FSPLAYER_K_BACK1MIN   },
+   { XK_Up,           FSPLAYER_K_FWD1MIN    },
+   { XK_Page_Down,    FSPLAYER_K_BACK10MIN  },
+   { XK_Page_Up,      FSPLAYER_K_FWD10MIN   },
+   { XK_KP_Add,       FSPLAYER_K_VOLUP      },
+   { XK_KP_Subtract,  FSPLAYER_K_VOLDOWN    },
+   { XK_KP_Multiply,  FSPLAYER_K_AUDIOTRACK },
+   { XK_KP_End,       FSPLAYER_K_VIEW1      },
+   { XK_KP_Down,      FSPLAYER_K_VIEW2      },
+   { XK_KP_Page_Down, FSPLAYER_K_VIEW3      },
+   { XK_KP_Left,      FSPLAYER_K_VIEW4      },
+   { XK_KP_Begin,     FSPLAYER_K_VIEW5      },
+   { XK_KP_Right,     FSPLAYER_K_VIEW6      },
+   { XK_KP_Home,      FSPLAYER_K_VIEW7      },
+   { XK_KP_Up,        FSPLAYER_K_VIEW8      },
+   { XK_KP_Page_Up,   FSPLAYER_K_VIEW9      }
+};
+
+const char *gszLatencyName[FSPLAYER_L_COUNT] =
+{
+   "seek", "pause", "volume", "audio_track", "view", "quit"
+};
+
+// Upper bounds of the event loop's busy time buckets, the last one
+// has none
+const int giBusyBoundUs[FSPLAYER_BUSYBUCKETS - 1] =
+{
+   100, 250, 1000, 4000, 16000, 64000
+};
+
+int giX11RoundTrips = 0;   // See X11REPLY()
+
 
 
 
@@ -144,292 +619,186 @@ FilenameExist(const char *szFilename)
 
 
 /*
- *  MapState2sz
+ *  MonotonicMs
  */
 
-void
-MapState2sz(long iState,     char *pState)
+double
+MonotonicMs(void)
 {
-   if (iState == IsUnmapped)
-      strcpy(pState, "IsUnmapped");
-   else if (iState == IsUnviewable)
-      strcpy(pState, "IsUnviewable");
-   else if (iState == IsViewable)
-      strcpy(pState, "IsViewable");
-   else
-      sprintf(pState, "%ld", iState);
+   struct timespec ts;
+
+
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+
+   return(ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0);
 }
 
 
 
 
 /*
- *  FindMaster
+ *  ContextSwitches
+ *
+ *  The main thread's context switches so far, from /proc/self/status,
+ *  or -1 without procfs.  The main thread runs the event loop, so
+ *  these are its wakeups, whatever woke it up.
  */
 
-void
-FindMaster(Display *pX11Display, Window w,     Window *pMaster)
+long
+ContextSwitches(void)
 {
-   int            iRet;
-   unsigned int   nChildren;
-   Window         wParent,
-                  wRoot,
-                  *pChildren;
-
+   long  n,
+         nSwitches = -1;
+   char  szLine[LNSZ];
+   FILE  *pFile;
 
-   *pMaster = w;
 
-   do
+   pFile = fopen("/proc/self/status", "r");
+   if (pFile)
    {
-      pChildren = NULL;
-      iRet = XQueryTree(pX11Display, w,     &wRoot, &wParent,
-                                            &pChildren, &nChildren);
-      if (pChildren)
-         XFree(pChildren);
-      if (iRet)
-      {
-         if (wParent == wRoot)
-            *pMaster = w;
-         else
-            w = wParent;
-      }
+      while (fgets(szLine, LNSZ, pFile))
+         if (sscanf(szLine, "voluntary_ctxt_switches: %ld", &n) == 1
+             || sscanf(szLine, "nonvoluntary_ctxt_switches: %ld", &n) == 1)
+            nSwitches = (nSwitches < 0 ? 0 : nSwitches) + n;
+      fclose(pFile);
    }
-   while (iRet && wParent != wRoot);
+
+   return(nSwitches);
 }
 
 
 
 
 /*
- *  FindX11Window
+ *  TimingsReset
  */
 
-int
-FindX11Window(Display *pX11Display, Window w, Atom aName, Atom aType,
-              char *szValue,     Window *pReturn, Window *pMaster)
+void
+TimingsReset(TIMINGS *pTimings)
 {
-   int            i,
-                  iFormat,
-                  iFound = 0,
-                  iRet;
-   unsigned int   nChildren;
-   unsigned long  iNumItems,
-                  iByteRemaining;
-   unsigned char  *pProperty = NULL;
-   Atom           aRet;
-   Status         iStatus;
-   Window         wParent,
-                  wRoot,
-                  *pChildren = NULL;
-
+   memset(pTimings, 0, sizeof(TIMINGS));
+   pTimings->t0 = MonotonicMs();
+   giX11RoundTrips = 0;
+}
 
-   iRet = XGetWindowProperty(pX11Display, w, aName, 0, 4, 0, aType,
-             &aRet, &iFormat, &iNumItems, &iByteRemaining, &pProperty);
-   if (iRet == Success && pProperty)
-   {
-      iFound = !strcmp((char *)pProperty, szValue);
-      if (iFound)
-         *pReturn = w;  // Note that pMaster was found earlier in the tree
-   }
 
-   // Check the window's children if needed
-   if (!iFound && XQueryTree(pX11Display, w,     &wRoot, &wParent,
-                                                 &pChildren, &nChildren))
-   {
-      if (pChildren && nChildren)
-         for (i = 0 ; i < nChildren && !iFound ; i++)
-            if (pChildren[i] != w && pChildren[i] != wRoot
-                && pChildren[i] != wParent)
-            {
-               if (w == wRoot)
-                  *pMaster = pChildren[i];
-               iFound = FindX11Window(pX11Display, pChildren[i], aName,
-                                      aType, szValue,
-                                                        pReturn, pMaster);
-            }
-   }
 
-   if (pChildren)
-      XFree(pChildren);
 
-   if (pProperty)
-      XFree(pProperty);
+/*
+ *  TimingMark
+ *
+ *  Only the first time a phase is reached counts.
+ */
 
-   return(iFound);
+void
+TimingMark(TIMINGS *pTimings, int iPhase)
+{
+   if (pTimings && !pTimings->t[iPhase])
+      pTimings->t[iPhase] = MonotonicMs();
 }
 
 
 
 
 /*
- *  FindVlcWindow
+ *  TimingsBusy
+ *
+ *  Counts one turn of the event loop in its busy time bucket.  Any
+ *  turn past the first buckets is a stall the keys had to wait for.
  */
 
-int
-FindVlcWindow(Display *pX11Display, Window wRoot,
-                                       Window *pWinVlc, Window *pMaster)
+void
+TimingsBusy(TIMINGS *pTimings, double tBusyMs)
 {
-   int  iErr = 0;
-   Atom aName,
-        aTypeStr;
-
+   int i;
 
-   // WM_NAME(STRING) = "VLC media player"
-   *pWinVlc = 0;  // The VLC window
-   *pMaster = 0;  // The VLC parent window that has ROOT as its parent
-   aName = XInternAtom(pX11Display, "WM_NAME", False);
-   aTypeStr = XInternAtom(pX11Display, "STRING", False);
-   if (aName != None && aTypeStr != None)
-      FindX11Window(pX11Display, wRoot, aName, aTypeStr,
-                    FSPLAYER_LIBVLCWMNAME,     pWinVlc, pMaster);
-   if (!(*pWinVlc))
-      iErr = ERROR_FSPLAYER_FAIL;
 
-   return(iErr);
+   for (i = 0 ; i < FSPLAYER_BUSYBUCKETS - 1
+                && tBusyMs * 1000 >= giBusyBoundUs[i] ; i++)
+      ;
+   pTimings->aLoopBusy[i]++;
+   if (tBusyMs > pTimings->tLoopBusyMaxMs)
+      pTimings->tLoopBusyMaxMs = tBusyMs;
 }
 
 
 
 
 /*
- *  PositionWindow
+ *  TimingsPaused
+ *
+ *  Adds a pause that began at tPaused, with nSwitches context switches
+ *  so far, to the time and wakeups spent paused.
  */
 
 void
-PositionWindow(Display *pX11Display, Window w, int iKeypadPos,
-               unsigned int scrx, unsigned int scry)
+TimingsPaused(TIMINGS *pTimings, double tPaused, long nSwitches)
 {
-   int            x,
-                  y;
-   unsigned int   iBorder,
-                  iDepth,
-                  iHeight,
-                  iWidth;
-   Window         wRoot;
-
-
-   if (XGetGeometry(pX11Display, w,     &wRoot, &x, &y, &iWidth, &iHeight,
-                                        &iBorder, &iDepth))
-      if (iWidth < scrx && iHeight < scry)
-      {
-         if (iKeypadPos == 1 || iKeypadPos == 4 || iKeypadPos == 7)
-            x = 0;
-         else if (iKeypadPos == 3 || iKeypadPos == 6 || iKeypadPos == 9)
-            x = scrx - iWidth;
-         else
-            x = (scrx - iWidth) / 2;
+   long n;
 
-         if (iKeypadPos == 7 || iKeypadPos == 8 || iKeypadPos == 9)
-            y = 0;
-         else if (iKeypadPos == 1 || iKeypadPos == 2 || iKeypadPos == 3)
-            y = scry - iHeight;
-         else
-            y = (scry - iHeight) / 2;
 
-         XMoveWindow(pX11Display, w, x, y);
-      }
+   pTimings->tPausedMs += MonotonicMs() - tPaused;
+   n = ContextSwitches();
+   if (n < 0 || nSwitches < 0 || pTimings->nPausedSwitches < 0)
+      pTimings->nPausedSwitches = -1;
+   else
+      pTimings->nPausedSwitches += n - nSwitches;
 }
 
 
 
 
 /*
- *  TaskbarFindAndUnmap
+ *  LatencyKey
  *
- *  Very environment dependant.  This code currently looks for the xload
- *  program.  Other toolbar programs could also be tested if needed.
+ *  A key of the iClass kind was pressed at tKey, its effect is awaited.
  */
 
 void
-TaskbarFindAndUnmap(Display *pX11Display, Window wRoot,
-                                                      Window *pTaskbar)
+LatencyKey(TIMINGS *pTimings, int iClass, double tKey)
 {
-   int      iRet;
-   Atom     aName,
-            aTypeStr;
-   Window   wMaster = 0,
-            wXload = 0;
-   XWindowAttributes attrib;
-
-#ifdef FSPLAYER_DEBUG
-   char     szState[LNSZ];
-#endif // FSPLAYER_DEBUG
-
-
-   *pTaskbar = 0;
-   // WM_NAME(STRING) = "xload"
-   aName = XInternAtom(pX11Display, "WM_NAME", False);
-   aTypeStr = XInternAtom(pX11Display, "STRING", False);
-   if (aName != None && aTypeStr != None)
-      FindX11Window(pX11Display, wRoot, aName, aTypeStr, "xload",
-                                                      &wXload, &wMaster);
-   if (wXload)
-      if (XGetWindowAttributes(pX11Display, wMaster,     &attrib))
-         if (attrib.override_redirect && attrib.map_state == IsViewable)
-         {
-            *pTaskbar = wMaster;
+   LATENCY *pLatency = pTimings->aLatency + iClass;
 
-            //
-            // Oldschool fullscreen, get rid of the taskbar
-            //
-            iRet = XUnmapWindow(pX11Display, wMaster);
-#ifdef FSPLAYER_DEBUG
-            printf("%d=XUnmapWindow(w=0x%lX)\n", iRet, wMaster);
-#endif // FSPLAYER_DEBUG
 
-            // Wait for the unmap to occur (so it seems)
-            if (XGetWindowAttributes(pX11Display, wMaster,     &attrib))
-            {
-#ifdef FSPLAYER_DEBUG
-               MapState2sz(attrib.map_state,     szState);
-               printf("XGetWindowAttributes: w=0x%lX, x=%d, y=%d,"
-                      " width=%d, h=%d, state=%s, OvRedir=%d\n", wMaster,
-                      attrib.x, attrib.y, attrib.width, attrib.height,
-                      szState, attrib.override_redirect);
-#endif // FSPLAYER_DEBUG
-            }
-         }
+   if (pLatency->nPending == FSPLAYER_LATPENDING)
+   {
+      // The oldest key will never be heard of, it's forgotten
+      pLatency->iPending = (pLatency->iPending + 1) % FSPLAYER_LATPENDING;
+      pLatency->nPending--;
+   }
+   pLatency->atPending[(pLatency->iPending + pLatency->nPending)
+                       % FSPLAYER_LATPENDING] = tKey;
+   pLatency->nPending++;
 }
 
 
 
 
 /*
- *  TaskbarRaise
+ *  LatencyEffect
+ *
+ *  What the iClass keys pressed up to tCause led to was seen at
+ *  tEffect.  A tEffect of 0 means it failed, and these keys are
+ *  forgotten without a sample.
  */
 
 void
-TaskbarRaise(Display *pX11Display, Window wTaskbar)
+LatencyEffect(TIMINGS *pTimings, int iClass, double tCause, double tEffect)
 {
-   int iRet;
-   XWindowAttributes attrib;
-
-#ifdef FSPLAYER_DEBUG
-   char szState[LNSZ];
-#endif // FSPLAYER_DEBUG
+   LATENCY *pLatency = pTimings->aLatency + iClass;
 
 
-   //
-   // Oldschool fullscreen, restore the taskbar
-   //
-   if (wTaskbar)
+   while (pLatency->nPending
+          && pLatency->atPending[pLatency->iPending] <= tCause)
    {
-      iRet = XMapRaised(pX11Display, wTaskbar);
-#ifdef FSPLAYER_DEBUG
-      printf("%d=XMapRaised(w=0x%lX)\n", iRet, wTaskbar);
-#endif // FSPLAYER_DEBUG
-
-      // Wait for the raise to occur (so it seems)
-      if (XGetWindowAttributes(pX11Display, wTaskbar,     &attrib))
+      if (tEffect)
       {
-#ifdef FSPLAYER_DEBUG
-         MapState2sz(attrib.map_state,     szState);
-         printf("XGetWindowAttributes: w=0x%lX, x=%d, y=%d, width=%d,"
-                " h=%d, state=%s, OvRedir=%d\n", wTaskbar, attrib.x,
-                attrib.y, attrib.width, attrib.height, szState,
-                attrib.override_redirect);
-#endif // FSPLAYER_DEBUG
+         pLatency->afSamplesMs[pLatency->nSamples % FSPLAYER_LATSAMPLES]
+            = tEffect - pLatency->atPending[pLatency->iPending];
+         pLatency->nSamples++;
       }
+      pLatency->iPending = (pLatency->iPending + 1) % FSPLAYER_LATPENDING;
+      pLatency->nPending--;
    }
 }
 
@@ -437,720 +806,3565 @@ TaskbarRaise(Display *pX11Display, Window wTaskbar)
 
 
 /*
- *  SetWindowFullscreen
+ *  FloatCompare
  */
 
-void
-SetWindowFullscreen(Display *pX11Display, Window w, Window wMaster,
-                    Window wRoot, unsigned int scrx, unsigned int scry)
+int
+FloatCompare(const void *p1, const void *p2)
 {
-   int    iRet,
-          x = 0,
-          y = 0;
-   Bool   iOverrideRedirect;
-   Atom   aMotifWmHints,
-          aWmState,
-          aWmStateFs;
-   Window w2;
-   XEvent ev;
-   XSetWindowAttributes attribSet;
-   XWindowAttributes attribGet;
+   float f1 = *(const float *)p1,
+         f2 = *(const float *)p2;
 
 
-   //
-   // Remove the window decorations
-   //
-   struct
-   {
-      unsigned long flags;
-      unsigned long functions;
-      unsigned long decorations;
-      long input_mode;
-      unsigned long status;
-   } sMotifWmHints;
+   return((f1 > f2) - (f1 < f2));
+}
 
-   memset(&sMotifWmHints, 0, sizeof(sMotifWmHints));
-   sMotifWmHints.flags = 2;   // MWM_HINTS_DECORATIONS;
-   sMotifWmHints.decorations = 0;
-   aMotifWmHints = XInternAtom(pX11Display, "_MOTIF_WM_HINTS", False);
-   if (aMotifWmHints != None)
-      XChangeProperty(pX11Display, w, aMotifWmHints, aMotifWmHints, 32,
-                      PropModeReplace, (unsigned char *)&sMotifWmHints,
-                      sizeof(sMotifWmHints) / sizeof(long));
 
-   iRet = XMoveResizeWindow(pX11Display, w, 0, 0, scrx, scry);
 
-#ifdef FSPLAYER_DEBUG
-   printf("%d=XMoveResizeWindow(0x%lX)\n", iRet, w);
-#endif // FSPLAYER_DEBUG
 
-   //
-   // Notify the parent window to go fullscreen
-   //
-   aWmState = XInternAtom(pX11Display, "_NET_WM_STATE", False);
-   aWmStateFs = XInternAtom(pX11Display, "_NET_WM_STATE_FULLSCREEN",
-                            False);
-   if (aWmState != None && aWmStateFs != None)
-   {
-      memset(&ev, 0, sizeof(ev));
-      ev.type = ClientMessage;
-      ev.xclient.window = w;
-      ev.xclient.message_type = aWmState;
-      ev.xclient.format = 32;
-      ev.xclient.data.l[0] = 1;
-      ev.xclient.data.l[1] = aWmStateFs;
-      ev.xclient.data.l[2] = 0;
-      if (!XSendEvent(pX11Display, wRoot, 0, SubstructureNotifyMask, &ev))
-         printf("WARNING: XSendEvent(_NET_WM_STATE) aborted!\n");
-   }
+/*
+ *  LatencyPrint
+ *
+ *  The "latency_ms" member of the JSON lines, with the 50th, 95th and
+ *  99th percentiles of each kind of key pressed.
+ */
 
-   //
-   // Oldschool fullscreen, just move the window decorations out of view
-   //
-   iRet = XTranslateCoordinates(pX11Display, w, wRoot, 0, 0,
-                                                            &x, &y, &w2);
-#ifdef FSPLAYER_DEBUG
-   printf("%d=XTranslateCoordinates(w=0x%lX,     x=%d, y=%d, w2=0x%lX)\n", iRet, w, x, y, w2);
-#endif // FSPLAYER_DEBUG
+void
+LatencyPrint(const TIMINGS *pTimings)
+{
+   int               i,
+                     iClass,
+                     n,
+                     nClasses = 0;
+   float             afSorted[FSPLAYER_LATSAMPLES];
+   const LATENCY     *pLatency;
+   static const int  aiPercent[3] = { 50, 95, 99 };
 
-   if (x > 0 || y > 0)
+
+   for (iClass = 0 ; iClass < FSPLAYER_L_COUNT ; iClass++)
    {
-      if (XGetWindowAttributes(pX11Display, wMaster,     &attribGet))
-      {
-         iOverrideRedirect = attribGet.override_redirect;
-         if (!iOverrideRedirect)
-         {
-            memset(&attribSet, 0, sizeof(attribSet));
-            attribSet.override_redirect = 1;
-            iRet = XChangeWindowAttributes(pX11Display, wMaster,
-                                           CWOverrideRedirect, &attribSet);
+      pLatency = pTimings->aLatency + iClass;
+      if (!pLatency->nSamples)
+         continue;
+
+      n = pLatency->nSamples;
+      if (n > FSPLAYER_LATSAMPLES)
+         n = FSPLAYER_LATSAMPLES;
+      memcpy(afSorted, pLatency->afSamplesMs, n * sizeof(float));
+      qsort(afSorted, n, sizeof(float), FloatCompare);
+
+      fprintf(stderr, "%s\"%s\":{\"n\":%d",
+              nClasses++ ? "," : ",\"latency_ms\":{",
+              gszLatencyName[iClass], pLatency->nSamples);
+      for (i = 0 ; i < 3 ; i++)
+         fprintf(stderr, ",\"p%d\":%.3f", aiPercent[i],
+                 afSorted[(aiPercent[i] * n + 99) / 100 - 1]);
+      fprintf(stderr, "}");
+   }
+   if (nClasses)
+      fprintf(stderr, "}");
+}
 
-#ifdef FSPLAYER_DEBUG
-            printf("%d=XChangeWindowAttributes(w=0x%lX, OvRedir=1)\n",
-                   iRet, wMaster);
-#endif // FSPLAYER_DEBUG
-         }
-      }
-      else
-         iOverrideRedirect = 1;
 
-      iRet = XMoveWindow(pX11Display, wMaster, -x, -y);
 
-#ifdef FSPLAYER_DEBUG
-      printf("%d=XMoveWindow(w=0x%lX, x=%d, y=%d)\n",
-             iRet, wMaster, -x, -y);
-#endif // FSPLAYER_DEBUG
 
-      // Wait for the move to occur (so it seems)
-      if (XGetWindowAttributes(pX11Display, wMaster,     &attribGet))
-      {
-#ifdef FSPLAYER_DEBUG
-         printf("XGetWindowAttributes: w=0x%lX, x=%d, y=%d, width=%d,"
-                " h=%d, OvRedir=%d\n", wMaster, attribGet.x, attribGet.y,
-                attribGet.width, attribGet.height,
-                attribGet.override_redirect);
+/*
+ *  LatencyDump
+ *
+ *  SIGUSR1 asks for the latencies so far, while the video plays.
+ */
+
+void
+LatencyDump(const TIMINGS *pTimings)
+{
+   fprintf(stderr, "{\"fsplayer_latency\":1");
+   LatencyPrint(pTimings);
+   fprintf(stderr, "}\n");
+   fflush(stderr);
+}
+
+
+
+
+/*
+ *  TimingsPrint
+ *
+ *  One JSON line on stderr, each phase in milliseconds since t0, null
+ *  when it wasn't reached.
+ */
+
+void
+TimingsPrint(const TIMINGS *pTimings, const char *szMode, int iCacheHit)
+{
+   int i;
+
+
+   fprintf(stderr, "{\"fsplayer_timings\":1,\"mode\":\"%s\","
+                   "\"cache_hit\":%s", szMode, iCacheHit ? "true" : "false");
+   for (i = 0 ; i < FSPLAYER_T_COUNT ; i++)
+      if (pTimings->t[i])
+         fprintf(stderr, ",\"%s_ms\":%.3f", gszTimingName[i],
+                 pTimings->t[i] - pTimings->t0);
+      else
+         fprintf(stderr, ",\"%s_ms\":null", gszTimingName[i]);
+
+   // How long exit took, to notice the end, to be out of sight and for
+   // libvlc to let go
+   if (pTimings->t[FSPLAYER_T_EXIT])
+   {
+      if (pTimings->t[FSPLAYER_T_ENDREACHED])
+         fprintf(stderr, ",\"end_latency_ms\":%.3f",
+                 pTimings->t[FSPLAYER_T_EXIT]
+                 - pTimings->t[FSPLAYER_T_ENDREACHED]);
+      if (pTimings->t[FSPLAYER_T_HIDDEN])
+         fprintf(stderr, ",\"exit_hide_ms\":%.3f",
+                 pTimings->t[FSPLAYER_T_HIDDEN]
+                 - pTimings->t[FSPLAYER_T_EXIT]);
+      if (pTimings->t[FSPLAYER_T_RELEASED])
+         fprintf(stderr, ",\"exit_teardown_ms\":%.3f",
+                 pTimings->t[FSPLAYER_T_RELEASED]
+                 - pTimings->t[FSPLAYER_T_EXIT]);
+      else
+         fprintf(stderr, ",\"exit_teardown_ms\":null");
+   }
+   if (pTimings->nSeekKeys)
+   {
+      fprintf(stderr, ",\"seek_keys\":%d,\"seeks\":%d", pTimings->nSeekKeys,
+              pTimings->nSeeks);
+      if (pTimings->tSeekSettleMs)
+         fprintf(stderr, ",\"seek_settle_ms\":%.3f",
+                 pTimings->tSeekSettleMs);
+      else
+         fprintf(stderr, ",\"seek_settle_ms\":null");
+   }
+   if (pTimings->nControlCmds || pTimings->nControlDropped)
+      fprintf(stderr, ",\"control_cmds\":%d,\"control_dropped\":%d"
+                      ",\"control_max_ms\":%.3f", pTimings->nControlCmds,
+              pTimings->nControlDropped, pTimings->tControlMaxMs);
+   LatencyPrint(pTimings);
+   fprintf(stderr, ",\"loop_busy_us\":{");
+   for (i = 0 ; i < FSPLAYER_BUSYBUCKETS - 1 ; i++)
+      fprintf(stderr, "\"%d\":%d,", giBusyBoundUs[i],
+              pTimings->aLoopBusy[i]);
+   fprintf(stderr, "\"inf\":%d},\"loop_busy_max_us\":%.0f",
+           pTimings->aLoopBusy[i], pTimings->tLoopBusyMaxMs * 1000);
+   if (pTimings->tLoopMs > 0)
+      fprintf(stderr, ",\"loop_wakeups\":%d,\"loop_wakeups_per_s\":%.3f",
+              pTimings->nLoopWakeups,
+              pTimings->nLoopWakeups * 1000 / pTimings->tLoopMs);
+   if (pTimings->tPausedMs > 0)
+   {
+      fprintf(stderr, ",\"paused_s\":%.3f,\"paused_loop_wakeups\":%d",
+              pTimings->tPausedMs / 1000, pTimings->nPausedWakeups);
+      if (pTimings->nPausedSwitches >= 0)
+         fprintf(stderr, ",\"paused_wakeups_per_s\":%.3f",
+                 pTimings->nPausedSwitches * 1000 / pTimings->tPausedMs);
+      else
+         fprintf(stderr, ",\"paused_wakeups_per_s\":null");
+   }
+   if (pTimings->iShm)
+   {
+      fprintf(stderr, ",\"shm_frames\":%u,\"shm_waits\":%u"
+                      ",\"shm_wait_ms\":%.3f,\"shm_kernel\":\"%s\""
+                      ",\"shm_convert_ms\":%.3f,\"shm_threads\":%d",
+              pTimings->shm.nFrames, pTimings->shm.nWaits,
+              pTimings->shm.tWaitMs, pTimings->shm.szKernel,
+              pTimings->shm.tConvertMs, pTimings->shm.nThreads);
+      fprintf(stderr, ",\"shm_frame_hits\":%u,\"shm_frame_misses\":%u"
+                      ",\"shm_frame_dropped\":%u,\"shm_frames_peak\":%u"
+                      ",\"shm_frames_mb\":%.1f,\"shm_frame_pages\":\"%s\"",
+              pTimings->shm.frames.nHits, pTimings->shm.frames.nMisses,
+              pTimings->shm.frames.nDropped, pTimings->shm.frames.nPeak,
+              pTimings->shm.frames.iMapped / 1e6,
+              FsFramePagesName(pTimings->shm.frames.iPages));
+   }
+   if (pTimings->shm.iSavedPixels)
+      fprintf(stderr, ",\"shm_scale_ms\":%.3f,\"shm_saved_mb\":%.1f",
+              pTimings->shm.tScaleMs, pTimings->shm.iSavedPixels * 4 / 1e6);
+   fprintf(stderr, ",\"x11_queue_max\":%d", pTimings->iX11QueueMax);
+   fprintf(stderr, ",\"x11_roundtrips\":%d,\"loop_x11_roundtrips\":%d"
+                   ",\"total_ms\":%.3f}\n", giX11RoundTrips,
+           pTimings->iLoopRoundTrips, MonotonicMs() - pTimings->t0);
+   fflush(stderr);
+}
+
+
+
+
+/*
+ *  ConfigFilename
+ *
+ *  Where the szName configuration file is: $XDG_CONFIG_HOME/szName, or
+ *  ~/.config/szName.  Returns 0 when neither variable is usable.
+ */
+
+int
+ConfigFilename(const char *szName,     char *szFilename)
+{
+   int         iFound = 0;
+   const char  *sz;
+
+
+   sz = getenv("XDG_CONFIG_HOME");
+   if (sz && *sz && strlen(sz) + strlen(szName) + 2 < LNSZ)
+   {
+      sprintf(szFilename, "%s/%s", sz, szName);
+      iFound = 1;
+   }
+   else
+   {
+      sz = getenv("HOME");
+      if (sz && *sz && strlen(sz) + strlen(szName) + 10 < LNSZ)
+      {
+         sprintf(szFilename, "%s/.config/%s", sz, szName);
+         iFound = 1;
+      }
+   }
+
+   return(iFound);
+}
+
+
+
+
+/*
+ *  ConfigRead
+ *
+ *  Reads the "key = value" lines of $XDG_CONFIG_HOME/fsplayer.conf, or
+ *  ~/.config/fsplayer.conf.  Known keys are:
+ *    profile     default or tuned, libvlc_new()'s startup profile
+ *    vout        Video output module of the tuned profile
+ *    aout        Audio output module of the tuned profile
+ *    render      vout or shm, who draws the video, see fsshm.c
+ *    hugepages   no, thp or hugetlb, what backs shm's pictures
+ */
+
+void
+ConfigRead(FSOPTIONS *pOptions)
+{
+   char        szFilename[LNSZ],
+               szKey[LNSZ],
+               szLine[LNSZ],
+               szValue[LNSZ];
+   FILE        *pFile = NULL;
+
+
+   if (ConfigFilename(FSPLAYER_CONFIG,     szFilename))
+      pFile = fopen(szFilename, "r");
+
+   if (pFile)
+   {
+      while (fgets(szLine, LNSZ, pFile))
+      {
+         if (*szLine == '#'
+             || sscanf(szLine, " %[^= \t] = %s", szKey, szValue) != 2)
+            continue;
+
+         if (!strcmp(szKey, "profile"))
+            pOptions->iProfile = !strcmp(szValue, "tuned")
+                                 ? FSPLAYER_PROFILE_TUNED
+                                 : FSPLAYER_PROFILE_DEFAULT;
+         else if (!strcmp(szKey, "vout"))
+            strcpy(pOptions->szVout, szValue);
+         else if (!strcmp(szKey, "aout"))
+            strcpy(pOptions->szAout, szValue);
+         else if (!strcmp(szKey, "render"))
+            pOptions->iRender = !strcmp(szValue, "shm")
+                                ? FSPLAYER_RENDER_SHM
+                                : FSPLAYER_RENDER_VOUT;
+         else if (!strcmp(szKey, "hugepages"))
+            pOptions->iPages = !strcmp(szValue, "hugetlb")
+                               ? FSFRAME_PAGES_HUGETLB
+                               : !strcmp(szValue, "thp")
+                                 ? FSFRAME_PAGES_THP
+                                 : FSFRAME_PAGES_SMALL;
+         else
+            printf("WARNING: Unknown %s setting: %s\n", szFilename, szKey);
+      }
+      fclose(pFile);
+   }
+}
+
+
+
+
+/*
+ *  KeyBindingsLoad
+ *
+ *  Fills aKeyAction, indexed by keycode, with gaDefaultKeys and then
+ *  the "keysym = action" lines of fsplayer.keys, next to fsplayer.conf.
+ *  Keysyms are named as in <X11/keysymdef.h> without the XK_ prefix,
+ *  actions as in gszKeyActionName, and "none" unbinds a key.  Looking
+ *  an action up while playing is then a single array access.
+ */
+
+void
+KeyBindingsLoad(FSPLAYER *pFsp)
+{
+   int         i,
+               iAction,
+               nMissing = 0;
+   char        szFilename[LNSZ],
+               szKey[LNSZ],
+               szLine[LNSZ],
+               szValue[LNSZ];
+   FILE        *pFile = NULL;
+   KeyCode     kc;
+   KeySym      ks;
+
+
+   memset(pFsp->aKeyAction, FSPLAYER_K_NONE, sizeof(pFsp->aKeyAction));
+
+   // The keyboard mapping is fetched once by the first lookup
+   giX11RoundTrips++;
+   for (i = 0 ; i < sizeof(gaDefaultKeys) / sizeof(KEYBINDING) ; i++)
+   {
+      kc = XKeysymToKeycode(pFsp->pX11Display, gaDefaultKeys[i].ks);
+      if (kc)
+         pFsp->aKeyAction[kc] = gaDefaultKeys[i].iAction;
+      else
+         nMissing++;
+   }
+   if (nMissing)
+      printf("WARNING: X11 keycodes weren't all found so some video"
+             " browsing features may be missing at this time.\n");
+
+   if (ConfigFilename(FSPLAYER_KEYS,     szFilename))
+      pFile = fopen(szFilename, "r");
+   if (pFile)
+   {
+      while (fgets(szLine, LNSZ, pFile))
+      {
+         if (*szLine == '#'
+             || sscanf(szLine, " %[^= \t] = %s", szKey, szValue) != 2)
+            continue;
+
+         for (iAction = 0 ; iAction < FSPLAYER_K_COUNT
+                            && strcmp(szValue, gszKeyActionName[iAction])
+                          ; iAction++)
+            ;
+         kc = 0;
+         ks = XStringToKeysym(szKey);
+         if (ks != NoSymbol)
+            kc = XKeysymToKeycode(pFsp->pX11Display, ks);
+
+         if (iAction == FSPLAYER_K_COUNT)
+            printf("WARNING: Unknown %s action: %s\n", szFilename, szValue);
+         else if (!kc)
+            printf("WARNING: Unknown %s key: %s\n", szFilename, szKey);
+         else
+            pFsp->aKeyAction[kc] = iAction;
+      }
+      fclose(pFile);
+   }
+}
+
+
+
+
+/*
+ *  VlcArgsBuild
+ */
+
+void
+VlcArgsBuild(int iProfile, const FSOPTIONS *pOptions,     VLCARGS *pArgs)
+{
+   int               i;
+   static const char *pTunedArgs[] = { FSPLAYER_TUNEDARGS };
+
+
+   memset(pArgs, 0, sizeof(VLCARGS));
+   if (iProfile == FSPLAYER_PROFILE_TUNED)
+   {
+      for (i = 0 ; i < sizeof(pTunedArgs) / sizeof(char *) ; i++)
+         pArgs->argv[pArgs->argc++] = pTunedArgs[i];
+
+      sprintf(pArgs->szVout, "--vout=%s",
+              *pOptions->szVout ? pOptions->szVout : FSPLAYER_TUNEDVOUT);
+      pArgs->argv[pArgs->argc++] = pArgs->szVout;
+      sprintf(pArgs->szAout, "--aout=%s",
+              *pOptions->szAout ? pOptions->szAout : FSPLAYER_TUNEDAOUT);
+      pArgs->argv[pArgs->argc++] = pArgs->szAout;
+   }
+}
+
+
+
+
+/*
+ *  BenchStartup
+ *
+ *  Compares libvlc_new()'s time with each startup profile.  The first
+ *  run of all may include loading the libraries from the disk.
+ */
+
+void
+BenchStartup(const FSOPTIONS *pOptions)
+{
+   int               i,
+                     iProfile;
+   double            t,
+                     tMin,
+                     tSum;
+   libvlc_instance_t *pVlcInst;
+   VLCARGS           vlcArgs;
+
+
+   printf("LibVLC Version %s, %s\n",
+          libvlc_get_version(), libvlc_get_compiler());
+   for (iProfile = FSPLAYER_PROFILE_DEFAULT
+        ; iProfile <= FSPLAYER_PROFILE_TUNED ; iProfile++)
+   {
+      VlcArgsBuild(iProfile, pOptions,     &vlcArgs);
+      tMin = tSum = 0;
+      for (i = 0 ; i < FSPLAYER_BENCHRUNS ; i++)
+      {
+         t = MonotonicMs();
+         pVlcInst = libvlc_new(vlcArgs.argc, vlcArgs.argv);
+         t = MonotonicMs() - t;
+         if (!pVlcInst)
+         {
+            printf("libvlc_new() failed with the %s profile!\n",
+                   iProfile ? "tuned" : "default");
+            break;
+         }
+         libvlc_release(pVlcInst);
+
+         tSum += t;
+         if (!i || t < tMin)
+            tMin = t;
+      }
+      if (i)
+         printf("libvlc_new(), %-7s profile: min %7.1f ms,"
+                " avg %7.1f ms (%d runs)\n",
+                iProfile ? "tuned" : "default", tMin, tSum / i, i);
+   }
+}
+
+
+
+
+/*
+ *  VlcStateInit
+ */
+
+void
+VlcStateInit(VLCSTATE *pState)
+{
+   pthread_condattr_t condAttr;
+
+
+   memset(pState, 0, sizeof(VLCSTATE));
+   pState->fdWakeup = -1;
+   pState->fRate = 1;
+   pState->iSeekTarget = -1;
+   pthread_mutex_init(&pState->mutex, NULL);
+   pthread_condattr_init(&condAttr);
+   pthread_condattr_setclock(&condAttr, CLOCK_MONOTONIC);
+   pthread_cond_init(&pState->cond, &condAttr);
+   pthread_condattr_destroy(&condAttr);
+}
+
+
+
+
+/*
+ *  VlcStateFree
+ */
+
+void
+VlcStateFree(VLCSTATE *pState)
+{
+   pthread_cond_destroy(&pState->cond);
+   pthread_mutex_destroy(&pState->mutex);
+}
+
+
+
+
+/*
+ *  VlcStateReset
+ *
+ *  Forget about the previous video's events.
+ */
+
+void
+VlcStateReset(VLCSTATE *pState)
+{
+   pthread_mutex_lock(&pState->mutex);
+   pState->iEnded = 0;
+   pState->iError = 0;
+   pState->tEnded = 0;
+   pState->iNumAudioEs = 0;
+   pState->iNumVideoEs = 0;
+   pState->iNumVout = 0;
+   pState->iParsedStatus = 0;
+   pState->tFirstFrame = 0;
+   pState->tPauseChanged = 0;
+   pState->iPaused = 0;
+   pState->iLengthMs = 0;
+   pState->iSeekTarget = -1;
+   pState->tSeekIssued = 0;
+   pState->tSeekSettled = 0;
+   pState->iClockRunning = 0;
+   pState->iClockMs = 0;
+   pState->fRate = 1;
+   pthread_mutex_unlock(&pState->mutex);
+}
+
+
+
+
+/*
+ *  VlcClockNow
+ *
+ *  libvlc's time as last heard of, moved along since then at the
+ *  playing rate, for at most FSPLAYER_CLOCKHOLD so a stalled input
+ *  doesn't run away.  pState->mutex must be held.
+ */
+
+libvlc_time_t
+VlcClockNow(const VLCSTATE *pState)
+{
+   double tElapsed = 0;
+
+
+   if (pState->iClockRunning)
+   {
+      tElapsed = MonotonicMs() - pState->tClock;
+      if (tElapsed > FSPLAYER_CLOCKHOLD)
+         tElapsed = FSPLAYER_CLOCKHOLD;
+   }
+
+   return(pState->iClockMs + (libvlc_time_t)(tElapsed * pState->fRate));
+}
+
+
+
+
+/*
+ *  VlcClockSet
+ *
+ *  pState->mutex must be held.
+ */
+
+void
+VlcClockSet(VLCSTATE *pState, libvlc_time_t iTimeMs)
+{
+   pState->iClockMs = iTimeMs;
+   pState->tClock = MonotonicMs();
+}
+
+
+
+
+/*
+ *  VlcEventCallback
+ *
+ *  Called from one of libvlc's threads, so only take note of the news
+ *  and wake up whoever is waiting for it.
+ */
+
+void
+VlcEventCallback(const libvlc_event_t *pEvent, void *pData)
+{
+   int            iWake;
+   uint64_t       iOne = 1;
+   libvlc_time_t  iTimeMs = -1;
+   VLCSTATE       *pState = (VLCSTATE *)pData;
+
+
+   // Wake up the event loop too, but not for every tick of the clock
+   iWake = (pEvent->type != libvlc_MediaPlayerTimeChanged
+            && pEvent->type != libvlc_MediaPlayerPositionChanged);
+
+   pthread_mutex_lock(&pState->mutex);
+   switch (pEvent->type)
+   {
+      case libvlc_MediaPlayerVout:
+         pState->iNumVout = pEvent->u.media_player_vout.new_count;
+         break;
+
+      case libvlc_MediaPlayerESAdded:
+         if (pEvent->u.media_player_es_changed.i_type == libvlc_track_audio)
+            pState->iNumAudioEs++;
+         else if (pEvent->u.media_player_es_changed.i_type
+                  == libvlc_track_video)
+            pState->iNumVideoEs++;
+         break;
+
+      case libvlc_MediaPlayerLengthChanged:
+         pState->iLengthMs = pEvent->u.media_player_length_changed.new_length;
+         break;
+
+      case libvlc_MediaPlayerTimeChanged:
+         iTimeMs = pEvent->u.media_player_time_changed.new_time;
+
+         // libvlc has no "frame shown" event, the clock moving with a
+         // video output around is the closest thing
+         if (!pState->tFirstFrame && pState->iNumVout > 0 && iTimeMs > 0)
+            pState->tFirstFrame = MonotonicMs();
+         break;
+
+      case libvlc_MediaPlayerPositionChanged:
+         if (pState->iLengthMs > 0)
+            iTimeMs = pEvent->u.media_player_position_changed.new_position
+                      * pState->iLengthMs;
+         break;
+
+      case libvlc_MediaPlayerPlaying:
+         VlcClockSet(pState, VlcClockNow(pState));
+         pState->iClockRunning = 1;
+         pState->iPaused = 0;
+         pState->tPauseChanged = MonotonicMs();
+         break;
+
+      case libvlc_MediaPlayerPaused:
+         VlcClockSet(pState, VlcClockNow(pState));
+         pState->iClockRunning = 0;
+         pState->iPaused = 1;
+         pState->tPauseChanged = MonotonicMs();
+         break;
+
+      case libvlc_MediaParsedChanged:
+         pState->iParsedStatus = pEvent->u.media_parsed_changed.new_status;
+         break;
+
+      case libvlc_MediaPlayerEncounteredError:
+         pState->iError = 1;
+         // It's over too
+         /* FALLTHROUGH */
+
+      case libvlc_MediaPlayerEndReached:
+      case libvlc_MediaPlayerStopped:
+         if (!pState->iEnded)
+         {
+            pState->iEnded = 1;
+            pState->tEnded = MonotonicMs();
+         }
+         pState->iClockRunning = 0;
+         break;
+   }
+
+   if (iTimeMs >= 0)
+   {
+      if (pState->iSeekTarget < 0)
+         VlcClockSet(pState, iTimeMs);
+      else if (pState->iSeekDone == pState->iSeekGen
+               && iTimeMs > pState->iSeekTarget - FSPLAYER_SEEKSETTLE
+               && iTimeMs < pState->iSeekTarget + FSPLAYER_SEEKSETTLE)
+      {
+         // libvlc took the seek, see ControlThread().  It only queued
+         // it for its input thread though, so the seek is done once the
+         // clock shows up near its target.  Until then, the news are
+         // stale and the clock goes on from the target.
+         VlcClockSet(pState, iTimeMs);
+         pState->iSeekTarget = -1;
+         pState->tSeekSettled = MonotonicMs();
+         iWake = 1;
+      }
+   }
+
+   if (iWake && pState->fdWakeup >= 0)
+      write(pState->fdWakeup, &iOne, sizeof(iOne));
+   pthread_cond_broadcast(&pState->cond);
+   pthread_mutex_unlock(&pState->mutex);
+}
+
+
+
+
+/*
+ *  VlcAttachEvents
+ */
+
+int
+VlcAttachEvents(libvlc_media_player_t *pVlcPlayer, VLCSTATE *pState)
+{
+   int                     iErr = 0;
+   libvlc_event_manager_t  *pEventMgr;
+
+
+   pEventMgr = libvlc_media_player_event_manager(pVlcPlayer);
+   if (!pEventMgr)
+      iErr = ERROR_FSPLAYER_VLC;
+   if (!iErr)
+      if (libvlc_event_attach(pEventMgr, libvlc_MediaPlayerVout,
+                              VlcEventCallback, pState)
+          || libvlc_event_attach(pEventMgr, libvlc_MediaPlayerESAdded,
+                                 VlcEventCallback, pState)
+          || libvlc_event_attach(pEventMgr, libvlc_MediaPlayerLengthChanged,
+                                 VlcEventCallback, pState)
+          || libvlc_event_attach(pEventMgr, libvlc_MediaPlayerTimeChanged,
+                                 VlcEventCallback, pState)
+          || libvlc_event_attach(pEventMgr,
+                                 libvlc_MediaPlayerPositionChanged,
+                                 VlcEventCallback, pState)
+          || libvlc_event_attach(pEventMgr, libvlc_MediaPlayerPlaying,
+                                 VlcEventCallback, pState)
+          || libvlc_event_attach(pEventMgr, libvlc_MediaPlayerPaused,
+                                 VlcEventCallback, pState)
+          || libvlc_event_attach(pEventMgr, libvlc_MediaPlayerStopped,
+                                 VlcEventCallback, pState)
+          || libvlc_event_attach(pEventMgr, libvlc_MediaPlayerEndReached,
+                                 VlcEventCallback, pState)
+          || libvlc_event_attach(pEventMgr,
+                                 libvlc_MediaPlayerEncounteredError,
+                                 VlcEventCallback, pState))
+         iErr = ERROR_FSPLAYER_VLC;
+
+   return(iErr);
+}
+
+
+
+
+/*
+ *  MonotonicDeadline
+ */
+
+void
+MonotonicDeadline(int iTimeoutMs,     struct timespec *pDeadline)
+{
+   clock_gettime(CLOCK_MONOTONIC, pDeadline);
+   pDeadline->tv_sec += iTimeoutMs / 1000;
+   pDeadline->tv_nsec += (iTimeoutMs % 1000) * 1000000L;
+   if (pDeadline->tv_nsec >= 1000000000L)
+   {
+      pDeadline->tv_sec++;
+      pDeadline->tv_nsec -= 1000000000L;
+   }
+}
+
+
+
+
+/*
+ *  VlcWaitReady
+ *
+ *  Wait until the video output exists and the length is known, which is
+ *  when libvlc_video_get_size() and libvlc_media_player_get_length() have
+ *  something to say.  A stream without a length is as ready as it gets
+ *  once its clock runs, and an error or the end won't bring anything
+ *  more.  Gives up after iTimeoutMs, leaving the caller's checks to
+ *  report what's missing.
+ */
+
+int
+VlcWaitReady(VLCSTATE *pState, int iTimeoutMs)
+{
+   int               iReady,
+                     iRet = 0;
+   struct timespec   tsDeadline;
+
+
+   MonotonicDeadline(iTimeoutMs,     &tsDeadline);
+   pthread_mutex_lock(&pState->mutex);
+   do
+   {
+      iReady = (pState->iEnded
+                || (pState->iNumVout > 0
+                    && (pState->iLengthMs > 0
+                        || (pState->iClockRunning && pState->iClockMs > 0))));
+      if (!iReady)
+         iRet = pthread_cond_timedwait(&pState->cond, &pState->mutex,
+                                       &tsDeadline);
+   }
+   while (!iReady && iRet != ETIMEDOUT);
+#ifdef FSPLAYER_DEBUG
+   printf("%d=VlcWaitReady(vout=%d, video=%d, audio=%d, length=%ld)\n",
+          iReady, pState->iNumVout, pState->iNumVideoEs,
+          pState->iNumAudioEs, (long)pState->iLengthMs);
+#endif // FSPLAYER_DEBUG
+   pthread_mutex_unlock(&pState->mutex);
+
+   return(iReady);
+}
+
+
+
+
+/*
+ *  VlcParseMedia
+ *
+ *  Local parse of the media, to get the video size, length and audio
+ *  tracks without having to play it.
+ */
+
+void
+VlcParseMedia(VLCSTARTUP *pStartup)
+{
+   int                     i,
+                           iParsed = 0,
+                           iRet = 0;
+   unsigned int            nTracks;
+   struct timespec         tsDeadline;
+   libvlc_event_manager_t  *pEventMgr;
+   libvlc_media_track_t    **pTracks;
+   MEDIAINFO               *pInfo = &pStartup->info;
+   VLCSTATE                *pState = pStartup->pState;
+
+
+   pEventMgr = libvlc_media_event_manager(pStartup->pVlcMedia);
+   if (pEventMgr && !libvlc_event_attach(pEventMgr,
+                                         libvlc_MediaParsedChanged,
+                                         VlcEventCallback, pState))
+   {
+      if (!libvlc_media_parse_with_options(pStartup->pVlcMedia,
+                                           libvlc_media_parse_local,
+                                           FSPLAYER_PARSETIMEOUT))
+      {
+         // libvlc enforces the timeout, add some slack in case it doesn't
+         MonotonicDeadline(FSPLAYER_PARSETIMEOUT + 1000,     &tsDeadline);
+         pthread_mutex_lock(&pState->mutex);
+         while (!pState->iParsedStatus && iRet != ETIMEDOUT)
+            iRet = pthread_cond_timedwait(&pState->cond, &pState->mutex,
+                                          &tsDeadline);
+         iParsed = (pState->iParsedStatus
+                    == libvlc_media_parsed_status_done);
+         pthread_mutex_unlock(&pState->mutex);
+      }
+      libvlc_event_detach(pEventMgr, libvlc_MediaParsedChanged,
+                          VlcEventCallback, pState);
+   }
+
+   if (iParsed)
+   {
+      pInfo->iLengthMs = libvlc_media_get_duration(pStartup->pVlcMedia);
+
+      // Like libvlc_audio_get_track_description(), the first audio
+      // track is "Disable"
+      pInfo->iAudioTrackId[0] = -1;
+      strcpy(pInfo->szAudioTrackName[0], "Disable");
+      pInfo->iNumAudioTracks = 1;
+
+      nTracks = libvlc_media_tracks_get(pStartup->pVlcMedia,     &pTracks);
+      for (i = 0 ; i < nTracks ; i++)
+      {
+         if (pTracks[i]->i_type == libvlc_track_video && !pInfo->vidx)
+         {
+            pInfo->vidx = pTracks[i]->video->i_width;
+            pInfo->vidy = pTracks[i]->video->i_height;
+         }
+         else if (pTracks[i]->i_type == libvlc_track_audio)
+         {
+            if (pInfo->iNumAudioTracks < FSCACHE_MAXTRACKS)
+            {
+               pInfo->iAudioTrackId[pInfo->iNumAudioTracks]
+                  = pTracks[i]->i_id;
+               snprintf(pInfo->szAudioTrackName[pInfo->iNumAudioTracks],
+                        FSCACHE_NAMESZ, "%s",
+                        pTracks[i]->psz_description
+                           ? pTracks[i]->psz_description
+                           : (pTracks[i]->psz_language
+                              ? pTracks[i]->psz_language : "?"));
+            }
+            else
+               iParsed = 0;   // Too many to remember, let libvlc tell
+            pInfo->iNumAudioTracks++;
+         }
+      }
+      if (nTracks)
+         libvlc_media_tracks_release(pTracks, nTracks);
+      if (pInfo->iNumAudioTracks == 1)
+         pInfo->iNumAudioTracks = 0;   // Only "Disable", no audio
+
+      // Not every demuxer knows the video size before decoding
+      pStartup->iProbed = (iParsed && pInfo->vidx && pInfo->vidy
+                           && pInfo->iLengthMs > 0);
+   }
+
+#ifdef FSPLAYER_DEBUG
+   printf("%d=VlcParseMedia(%ux%u, length=%ld, %d audio tracks)\n",
+          pStartup->iProbed, pInfo->vidx, pInfo->vidy,
+          (long)pInfo->iLengthMs, pInfo->iNumAudioTracks);
+#endif // FSPLAYER_DEBUG
+}
+
+
+
+
+/*
+ *  VlcOpenMedia
+ */
+
+void
+VlcOpenMedia(VLCSTARTUP *pStartup)
+{
+   VlcStateReset(pStartup->pState);
+
+   if (!pStartup->iErr)
+   {
+      pStartup->pVlcMedia = libvlc_media_new_path(pStartup->pVlcInst,
+                                                  pStartup->szFilename);
+      if (!pStartup->pVlcMedia)
+      {
+         pStartup->iErr = ERROR_FSPLAYER_VLC;
+         strcat(pStartup->szErr, "libvlc_media_new_path() failed!");
+      }
+   }
+   if (!pStartup->iErr && !pStartup->iProbed)
+      VlcParseMedia(pStartup);
+   if (!pStartup->iErr)
+      TimingMark(pStartup->pTimings, FSPLAYER_T_MEDIAOPEN);
+}
+
+
+
+
+/*
+ *  VlcStartupThread
+ *
+ *  Loads the VLC engine and opens the media, if any, while main() builds
+ *  the X11 side.  libvlc_new() and its plugin loading is what a cold
+ *  start mostly waits for.
+ */
+
+void *
+VlcStartupThread(void *pData)
+{
+   VLCSTARTUP *pStartup = (VLCSTARTUP *)pData;
+
+
+   pStartup->pVlcInst = libvlc_new(pStartup->vlcArgs.argc,
+                                   pStartup->vlcArgs.argv);
+   TimingMark(pStartup->pTimings, FSPLAYER_T_LIBVLCNEW);
+   if (!pStartup->pVlcInst && pStartup->vlcArgs.argc)
+   {
+      printf("WARNING: libvlc_new() refused the startup profile,"
+             " using the default one.\n");
+      pStartup->pVlcInst = libvlc_new(0, NULL);
+   }
+   if (!pStartup->pVlcInst)
+   {
+      pStartup->iErr = ERROR_FSPLAYER_VLC;
+      strcat(pStartup->szErr, "libvlc_new() failed!");
+   }
+   if (!pStartup->iErr && pStartup->szFilename)
+      VlcOpenMedia(pStartup);
+
+   return(NULL);
+}
+
+
+
+
+/*
+ *  VlcTeardownThread
+ *
+ *  Stopping can block on some demuxers and audio outputs, so it's done
+ *  once fsplayer is already off the screen.
+ */
+
+void *
+VlcTeardownThread(void *pData)
+{
+   VLCTEARDOWN *pTeardown = (VLCTEARDOWN *)pData;
+
+
+   if (pTeardown->pVlcPlayer)
+   {
+      libvlc_media_player_stop(pTeardown->pVlcPlayer);
+      libvlc_media_player_release(pTeardown->pVlcPlayer);
+   }
+   if (pTeardown->pVlcMedia)
+      libvlc_media_release(pTeardown->pVlcMedia);
+   if (pTeardown->pVlcInst)
+   {
+#ifdef FSPLAYER_DEBUG
+      printf("libvlc_release()\n");
+#endif // FSPLAYER_DEBUG
+      libvlc_release(pTeardown->pVlcInst);
+   }
+
+   pthread_mutex_lock(&pTeardown->pState->mutex);
+   pTeardown->pState->tReleased = MonotonicMs();
+   pthread_cond_broadcast(&pTeardown->pState->cond);
+   pthread_mutex_unlock(&pTeardown->pState->mutex);
+
+   return(NULL);
+}
+
+
+
+
+/*
+ *  VlcWaitReleased
+ *
+ *  Returns when VlcTeardownThread() was done, or 0 if it's still busy
+ *  after iTimeoutMs.
+ */
+
+double
+VlcWaitReleased(VLCSTATE *pState, int iTimeoutMs)
+{
+   int               iRet = 0;
+   double            tReleased;
+   struct timespec   tsDeadline;
+
+
+   MonotonicDeadline(iTimeoutMs,     &tsDeadline);
+   pthread_mutex_lock(&pState->mutex);
+   while (!pState->tReleased && iRet != ETIMEDOUT)
+      iRet = pthread_cond_timedwait(&pState->cond, &pState->mutex,
+                                    &tsDeadline);
+   tReleased = pState->tReleased;
+   pthread_mutex_unlock(&pState->mutex);
+
+   return(tReleased);
+}
+
+
+
+
+/*
+ *  ReactorAdd
+ */
+
+int
+ReactorAdd(REACTOR *pReactor, int fd, int iFlag)
+{
+   struct epoll_event sEvent;
+
+
+   memset(&sEvent, 0, sizeof(sEvent));
+   sEvent.events = EPOLLIN;
+   sEvent.data.u32 = iFlag;
+
+   return(epoll_ctl(pReactor->fdEpoll, EPOLL_CTL_ADD, fd, &sEvent));
+}
+
+
+
+
+/*
+ *  ReactorDel
+ */
+
+void
+ReactorDel(REACTOR *pReactor, int fd)
+{
+   epoll_ctl(pReactor->fdEpoll, EPOLL_CTL_DEL, fd, NULL);
+}
+
+
+
+
+/*
+ *  ReactorOpen
+ *
+ *  Everything fsplayer waits on, in one epoll set: the X connection,
+ *  libvlc's events through an eventfd, the signals through a signalfd
+ *  and the next deadline through a timerfd.  The signals must already
+ *  be blocked in every thread.
+ */
+
+int
+ReactorOpen(REACTOR *pReactor, int iX11fd, const sigset_t *pSignals,
+            VLCSTATE *pState,                              char *szErr)
+{
+   int iErr = 0;
+
+
+   pReactor->iSignal = 0;
+   pReactor->fdEpoll = epoll_create1(EPOLL_CLOEXEC);
+   pReactor->fdEvent = eventfd(0, EFD_CLOEXEC|EFD_NONBLOCK);
+   pReactor->fdSignal = signalfd(-1, pSignals, SFD_CLOEXEC|SFD_NONBLOCK);
+   pReactor->fdTimer = timerfd_create(CLOCK_MONOTONIC,
+                                      TFD_CLOEXEC|TFD_NONBLOCK);
+   if (pReactor->fdEpoll < 0 || pReactor->fdEvent < 0
+       || pReactor->fdSignal < 0 || pReactor->fdTimer < 0)
+   {
+      iErr = ERROR_FSPLAYER_REACTOR;
+      strcat(szErr, "epoll_create1(), eventfd(), signalfd() or"
+                    " timerfd_create() failed!");
+   }
+   if (!iErr)
+      if (ReactorAdd(pReactor, iX11fd, FSPLAYER_R_X11)
+          || ReactorAdd(pReactor, pReactor->fdEvent, FSPLAYER_R_VLC)
+          || ReactorAdd(pReactor, pReactor->fdSignal, FSPLAYER_R_SIGNAL)
+          || ReactorAdd(pReactor, pReactor->fdTimer, FSPLAYER_R_TIMER))
+      {
+         iErr = ERROR_FSPLAYER_REACTOR;
+         strcat(szErr, "epoll_ctl() failed!");
+      }
+   if (!iErr)
+   {
+      pthread_mutex_lock(&pState->mutex);
+      pState->fdWakeup = pReactor->fdEvent;
+      pthread_mutex_unlock(&pState->mutex);
+   }
+
+   return(iErr);
+}
+
+
+
+
+/*
+ *  ReactorClose
+ */
+
+void
+ReactorClose(REACTOR *pReactor, VLCSTATE *pState)
+{
+   pthread_mutex_lock(&pState->mutex);
+   pState->fdWakeup = -1;
+   pthread_mutex_unlock(&pState->mutex);
+
+   if (pReactor->fdTimer >= 0)
+      close(pReactor->fdTimer);
+   if (pReactor->fdSignal >= 0)
+      close(pReactor->fdSignal);
+   if (pReactor->fdEvent >= 0)
+      close(pReactor->fdEvent);
+   if (pReactor->fdEpoll >= 0)
+      close(pReactor->fdEpoll);
+}
+
+
+
+
+/*
+ *  ReactorArmTimer
+ *
+ *  One shot in iMs, or none if iMs is negative.
+ */
+
+void
+ReactorArmTimer(REACTOR *pReactor, libvlc_time_t iMs)
+{
+   struct itimerspec sTimer;
+
+
+   memset(&sTimer, 0, sizeof(sTimer));
+   if (iMs >= 0)
+   {
+      sTimer.it_value.tv_sec = iMs / 1000;
+      sTimer.it_value.tv_nsec = (iMs % 1000) * 1000000L + 1;
+   }
+   timerfd_settime(pReactor->fdTimer, 0, &sTimer, NULL);
+}
+
+
+
+
+/*
+ *  ReactorWait
+ *
+ *  Sleeps until something happens, for as long as it takes.  Returns the
+ *  FSPLAYER_R_* flags of what did.  The eventfd, signalfd and timerfd
+ *  are read here, the X connection is left to XPending() and the other
+ *  file descriptors to the caller.
+ */
+
+int
+ReactorWait(REACTOR *pReactor)
+{
+   int                     i,
+                           iFlags = 0,
+                           nEvents;
+   uint64_t                iCount;
+   struct epoll_event      aEvents[FSPLAYER_MAXEVENTS];
+   struct signalfd_siginfo sSigInfo;
+
+
+   nEvents = epoll_wait(pReactor->fdEpoll, aEvents, FSPLAYER_MAXEVENTS, -1);
+   for (i = 0 ; i < nEvents ; i++)
+      iFlags |= aEvents[i].data.u32;
+
+   if (iFlags & FSPLAYER_R_VLC)
+      while (read(pReactor->fdEvent, &iCount, sizeof(iCount)) > 0)
+         ;
+   if (iFlags & FSPLAYER_R_TIMER)
+      while (read(pReactor->fdTimer, &iCount, sizeof(iCount)) > 0)
+         ;
+   if (iFlags & FSPLAYER_R_SIGNAL)
+   {
+      // Only the signals asking to stop are FSPLAYER_R_SIGNAL
+      iFlags &= ~FSPLAYER_R_SIGNAL;
+      while (read(pReactor->fdSignal, &sSigInfo, sizeof(sSigInfo))
+             == sizeof(sSigInfo))
+         if (sSigInfo.ssi_signo == SIGUSR1)
+            iFlags |= FSPLAYER_R_DUMP;
+         else
+         {
+            pReactor->iSignal = sSigInfo.ssi_signo;
+            iFlags |= FSPLAYER_R_SIGNAL;
+         }
+   }
+
+   return(iFlags);
+}
+
+
+
+
+/*
+ *  RingPush
+ *
+ *  Only called by the ring's producer.  Returns 0 when it's full.
+ */
+
+int
+RingPush(CONTROLRING *pRing, const CONTROLCMD *pCmd)
+{
+   int            iPushed = 0;
+   unsigned int   iHead,
+                  iTail;
+
+
+   iTail = atomic_load_explicit(&pRing->iTail, memory_order_relaxed);
+   iHead = atomic_load_explicit(&pRing->iHead, memory_order_acquire);
+   if (iTail - iHead < FSPLAYER_CTLRING)
+   {
+      pRing->aCmd[iTail & (FSPLAYER_CTLRING - 1)] = *pCmd;
+      atomic_store_explicit(&pRing->iTail, iTail + 1, memory_order_release);
+      iPushed = 1;
+   }
+
+   return(iPushed);
+}
+
+
+
+
+/*
+ *  RingPop
+ *
+ *  Only called by the ring's consumer.  Returns 0 when it's empty.
+ */
+
+int
+RingPop(CONTROLRING *pRing,     CONTROLCMD *pCmd)
+{
+   int            iPopped = 0;
+   unsigned int   iHead,
+                  iTail;
+
+
+   iHead = atomic_load_explicit(&pRing->iHead, memory_order_relaxed);
+   iTail = atomic_load_explicit(&pRing->iTail, memory_order_acquire);
+   if (iHead != iTail)
+   {
+      *pCmd = pRing->aCmd[iHead & (FSPLAYER_CTLRING - 1)];
+      atomic_store_explicit(&pRing->iHead, iHead + 1, memory_order_release);
+      iPopped = 1;
+   }
+
+   return(iPopped);
+}
+
+
+
+
+/*
+ *  ControlThread
+ *
+ *  Makes the libvlc calls the keys ask for.  Any of them may wait on
+ *  libvlc's locks while its input or video output threads are busy,
+ *  and the event loop mustn't wait with them.  Each outcome goes back
+ *  through the fromVlc ring, and the event loop's eventfd wakes it up.
+ *  The player and the eventfd are the thread's own, so one left behind
+ *  by ControlStop() can't outlive them.
+ */
+
+void *
+ControlThread(void *pData)
+{
+   int         iVolume;
+   uint64_t    iCount,
+               iOne = 1;
+   CONTROL     *pControl = (CONTROL *)pData;
+   CONTROLCMD  cmd;
+
+
+   while (!atomic_load(&pControl->iQuit))
+   {
+      if (!RingPop(&pControl->toVlc,     &cmd))
+      {
+         // Asleep until ControlSend() or ControlStop()
+         read(pControl->fdControl, &iCount, sizeof(iCount));
+         continue;
+      }
+
+      switch (cmd.iCmd)
+      {
+         case FSPLAYER_C_SEEK:
+            libvlc_media_player_set_time(pControl->pVlcPlayer, cmd.iArg);
+            pthread_mutex_lock(&pControl->pState->mutex);
+            pControl->pState->iSeekDone = cmd.iSeekGen;
+            pthread_mutex_unlock(&pControl->pState->mutex);
+            break;
+
+         case FSPLAYER_C_PAUSE:
+            libvlc_media_player_pause(pControl->pVlcPlayer);
+            break;
+
+         case FSPLAYER_C_VOLUME:
+            iVolume = libvlc_audio_get_volume(pControl->pVlcPlayer)
+                      + cmd.iArg;
+            if (iVolume < 0)
+               iVolume = 0;
+            else if (iVolume > 100)
+               iVolume = 100;
+            cmd.iResult = libvlc_audio_set_volume(pControl->pVlcPlayer,
+                                                  iVolume) ? -1 : iVolume;
+            break;
+
+         case FSPLAYER_C_AUDIOTRACK:
+            cmd.iResult = libvlc_audio_set_track(pControl->pVlcPlayer,
+                                                 cmd.iArg);
+            break;
+      }
+      cmd.tDone = MonotonicMs();
+
+      // The event loop empties the ring at every turn, an outcome that
+      // still doesn't fit is only a statistic lost
+      if (RingPush(&pControl->fromVlc, &cmd))
+         write(pControl->fdWakeup, &iOne, sizeof(iOne));
+   }
+
+   libvlc_media_player_release(pControl->pVlcPlayer);
+   close(pControl->fdWakeup);
+
+   pthread_mutex_lock(&pControl->pState->mutex);
+   pControl->iRunning = 0;
+   pthread_cond_broadcast(&pControl->pState->cond);
+   pthread_mutex_unlock(&pControl->pState->mutex);
+
+   return(NULL);
+}
+
+
+
+
+/*
+ *  ControlStart
+ *
+ *  A thread ControlStop() left behind, stuck in libvlc, is waited for
+ *  first since it still uses pControl.  Its player was stopped since,
+ *  so it's done by now.
+ */
+
+int
+ControlStart(CONTROL *pControl, VLCSTATE *pState,
+             libvlc_media_player_t *pVlcPlayer, int fdWakeup,
+                                                 char *szErr)
+{
+   int iErr = 0;
+
+
+   if (pControl->pState)
+   {
+      pthread_mutex_lock(&pControl->pState->mutex);
+      while (pControl->iRunning)
+         pthread_cond_wait(&pControl->pState->cond,
+                           &pControl->pState->mutex);
+      pthread_mutex_unlock(&pControl->pState->mutex);
+      if (pControl->fdControl >= 0)
+         close(pControl->fdControl);
+   }
+
+   atomic_store(&pControl->toVlc.iHead, 0);
+   atomic_store(&pControl->toVlc.iTail, 0);
+   atomic_store(&pControl->fromVlc.iHead, 0);
+   atomic_store(&pControl->fromVlc.iTail, 0);
+   atomic_store(&pControl->iQuit, 0);
+   pControl->pState = pState;
+   pControl->pVlcPlayer = pVlcPlayer;
+   pControl->iStarted = 0;
+   pControl->fdWakeup = fcntl(fdWakeup, F_DUPFD_CLOEXEC, 0);
+   pControl->fdControl = eventfd(0, EFD_CLOEXEC);
+   if (pControl->fdControl < 0 || pControl->fdWakeup < 0)
+   {
+      iErr = ERROR_FSPLAYER_REACTOR;
+      strcat(szErr, "eventfd() failed!");
+   }
+   if (!iErr)
+   {
+      libvlc_media_player_retain(pVlcPlayer);
+      pControl->iRunning = 1;
+      if (pthread_create(&pControl->thread, NULL, ControlThread, pControl))
+      {
+         pControl->iRunning = 0;
+         libvlc_media_player_release(pVlcPlayer);
+         iErr = ERROR_FSPLAYER_REACTOR;
+         strcat(szErr, "pthread_create() failed!");
+      }
+      else
+         pControl->iStarted = 1;
+   }
+   if (iErr)
+   {
+      if (pControl->fdControl >= 0)
+         close(pControl->fdControl);
+      if (pControl->fdWakeup >= 0)
+         close(pControl->fdWakeup);
+      pControl->fdControl = -1;
+      pControl->fdWakeup = -1;
+   }
+
+   return(iErr);
+}
+
+
+
+
+/*
+ *  ControlStop
+ *
+ *  Commands still queued are dropped, the player is about to stop.  A
+ *  thread stuck in a libvlc call is waited for FSPLAYER_EXITTIMEOUT at
+ *  most, then left behind with its eventfds and its own reference on
+ *  the player, see ControlLeftBehind().
+ */
+
+void
+ControlStop(CONTROL *pControl)
+{
+   int               iRet = 0,
+                     iRunning;
+   uint64_t          iOne = 1;
+   struct timespec   tsDeadline;
+
+
+   if (pControl->iStarted)
+   {
+      atomic_store(&pControl->iQuit, 1);
+      write(pControl->fdControl, &iOne, sizeof(iOne));
+
+      MonotonicDeadline(FSPLAYER_EXITTIMEOUT,     &tsDeadline);
+      pthread_mutex_lock(&pControl->pState->mutex);
+      while (pControl->iRunning && iRet != ETIMEDOUT)
+         iRet = pthread_cond_timedwait(&pControl->pState->cond,
+                                       &pControl->pState->mutex,
+                                       &tsDeadline);
+      iRunning = pControl->iRunning;
+      pthread_mutex_unlock(&pControl->pState->mutex);
+
+      if (iRunning)
+      {
+         printf("WARNING: A libvlc call is still busy after %d ms,"
+                " leaving it behind.\n", FSPLAYER_EXITTIMEOUT);
+         pthread_detach(pControl->thread);
+      }
+      else
+      {
+         pthread_join(pControl->thread, NULL);
+         close(pControl->fdControl);
+         pControl->fdControl = -1;
+      }
+      pControl->iStarted = 0;
+   }
+}
+
+
+
+
+/*
+ *  ControlLeftBehind
+ *
+ *  Whether ControlStop() left a thread behind that still runs.  It uses
+ *  the VLCSTATE, so that must not be freed, only _exit() will do.
+ */
+
+int
+ControlLeftBehind(CONTROL *pControl)
+{
+   int iRunning = 0;
+
+
+   if (pControl->pState)
+   {
+      pthread_mutex_lock(&pControl->pState->mutex);
+      iRunning = pControl->iRunning;
+      pthread_mutex_unlock(&pControl->pState->mutex);
+   }
+
+   return(iRunning);
+}
+
+
+
+
+/*
+ *  ControlSend
+ *
+ *  Queues a libvlc call for ControlThread(), without ever waiting.
+ */
+
+void
+ControlSend(FSPLAYER *pFsp, int iCmd, int64_t iArg)
+{
+   uint64_t    iOne = 1;
+   CONTROLCMD  cmd;
+
+
+   memset(&cmd, 0, sizeof(cmd));
+   cmd.iCmd = iCmd;
+   cmd.iArg = iArg;
+   cmd.iSeekGen = pFsp->vlcState.iSeekGen;     // Only this thread sets it
+   cmd.tQueued = MonotonicMs();
+   if (RingPush(&pFsp->control.toVlc, &cmd))
+      write(pFsp->control.fdControl, &iOne, sizeof(iOne));
+   else
+      pFsp->timings.nControlDropped++;
+}
+
+
+
+
+/*
+ *  ControlResults
+ *
+ *  Takes note of what ControlThread() did since the last turn of the
+ *  event loop.
+ */
+
+void
+ControlResults(FSPLAYER *pFsp)
+{
+   CONTROLCMD  cmd;
+
+
+   while (RingPop(&pFsp->control.fromVlc,     &cmd))
+   {
+      pFsp->timings.nControlCmds++;
+      if (cmd.tDone - cmd.tQueued > pFsp->timings.tControlMaxMs)
+         pFsp->timings.tControlMaxMs = cmd.tDone - cmd.tQueued;
+      if (cmd.iCmd == FSPLAYER_C_VOLUME)
+         LatencyEffect(&pFsp->timings, FSPLAYER_L_VOLUME, cmd.tQueued,
+                       cmd.iResult >= 0 ? cmd.tDone : 0);
+      else if (cmd.iCmd == FSPLAYER_C_AUDIOTRACK)
+         LatencyEffect(&pFsp->timings, FSPLAYER_L_AUDIOTRACK, cmd.tQueued,
+                       cmd.iResult ? 0 : cmd.tDone);
+#ifdef FSPLAYER_DEBUG
+      printf("Control %d(%ld)=%d in %.3f ms\n", cmd.iCmd, (long)cmd.iArg,
+             cmd.iResult, cmd.tDone - cmd.tQueued);
+#endif // FSPLAYER_DEBUG
+   }
+}
+
+
+
+
+/*
+ *  X11TimeMs
+ *
+ *  An X server timestamp in CLOCK_MONOTONIC milliseconds.  An event is
+ *  never seen before it happened, so the smallest difference between
+ *  its time and when it's seen is the closest to the clocks' offset.
+ *  One a minute beyond that means the server time wrapped around.
+ */
+
+double
+X11TimeMs(FSPLAYER *pFsp, Time tX11)
+{
+   double tOffset;
+
+
+   tOffset = MonotonicMs() - (double)tX11;
+   if (!pFsp->iX11TimeSynced || tOffset < pFsp->tX11TimeOffset
+       || tOffset > pFsp->tX11TimeOffset + FSPLAYER_1MIN)
+   {
+      pFsp->tX11TimeOffset = tOffset;
+      pFsp->iX11TimeSynced = 1;
+   }
+
+   return((double)tX11 + pFsp->tX11TimeOffset);
+}
+
+
+
+
+/*
+ *  MapState2sz
+ */
+
+void
+MapState2sz(long iState,     char *pState)
+{
+   if (iState == IsUnmapped)
+      strcpy(pState, "IsUnmapped");
+   else if (iState == IsUnviewable)
+      strcpy(pState, "IsUnviewable");
+   else if (iState == IsViewable)
+      strcpy(pState, "IsViewable");
+   else
+      sprintf(pState, "%ld", iState);
+}
+
+
+
+
+/*
+ *  X11WaitEvent
+ *
+ *  Waits at most iTimeoutMs for an event of type iType on w.  Other
+ *  events are left queued for the event loop.
+ */
+
+int
+X11WaitEvent(Display *pX11Display, Window w, int iType, int iTimeoutMs,
+                                                         XEvent *pEvent)
+{
+   int            iFound,
+                  iX11fd;
+   double         tEnd,
+                  tLeft;
+   fd_set         readfds;
+   struct timeval sTimeout;
+
+
+   iX11fd = ConnectionNumber(pX11Display);
+   tEnd = MonotonicMs() + iTimeoutMs;
+   while (!(iFound = XCheckTypedWindowEvent(pX11Display, w, iType, pEvent))
+          && (tLeft = tEnd - MonotonicMs()) > 0)
+   {
+      FD_ZERO(&readfds);
+      FD_SET(iX11fd, &readfds);
+      sTimeout.tv_sec = (long)tLeft / 1000;
+      sTimeout.tv_usec = ((long)tLeft % 1000) * 1000 + 1000;
+      select(iX11fd + 1, &readfds, 0, 0, &sTimeout);
+   }
+
+   return(iFound);
+}
+
+
+
+
+/*
+ *  X11EwmhSupported
+ *
+ *  Whether the window manager lists aFeature in _NET_SUPPORTED.
+ */
+
+int
+X11EwmhSupported(Display *pX11Display, Window wRoot, Atom aSupported,
+                 Atom aFeature)
+{
+   int            i,
+                  iFormat,
+                  iFound = 0;
+   unsigned long  iNumItems,
+                  iByteRemaining;
+   unsigned char  *pProperty = NULL;
+   Atom           aRet;
+
+
+   if (X11REPLY(XGetWindowProperty(pX11Display, wRoot, aSupported, 0,
+                                   1024, False, XA_ATOM,     &aRet,
+                                   &iFormat, &iNumItems, &iByteRemaining,
+                                   &pProperty)) == Success
+       && pProperty && aRet == XA_ATOM && iFormat == 32)
+      for (i = 0 ; i < iNumItems && !iFound ; i++)
+         iFound = (((Atom *)pProperty)[i] == aFeature);
+
+   if (pProperty)
+      XFree(pProperty);
+
+   return(iFound);
+}
+
+
+
+
+/*
+ *  FindMaster
+ */
+
+void
+FindMaster(Display *pX11Display, Window w,     Window *pMaster)
+{
+   int            iRet;
+   unsigned int   nChildren;
+   Window         wParent,
+                  wRoot,
+                  *pChildren;
+
+
+   *pMaster = w;
+
+   do
+   {
+      pChildren = NULL;
+      iRet = X11REPLY(XQueryTree(pX11Display, w,     &wRoot, &wParent,
+                                                     &pChildren, &nChildren));
+      if (pChildren)
+         XFree(pChildren);
+      if (iRet)
+      {
+         if (wParent == wRoot)
+            *pMaster = w;
+         else
+            w = wParent;
+      }
+   }
+   while (iRet && wParent != wRoot);
+}
+
+
+
+
+/*
+ *  FindX11Window
+ */
+
+int
+FindX11Window(Display *pX11Display, Window w, Atom aName, Atom aType,
+              char *szValue,     Window *pReturn, Window *pMaster)
+{
+   int            i,
+                  iFormat,
+                  iFound = 0,
+                  iRet;
+   unsigned int   nChildren;
+   unsigned long  iNumItems,
+                  iByteRemaining;
+   unsigned char  *pProperty = NULL;
+   Atom           aRet;
+   Window         wParent,
+                  wRoot,
+                  *pChildren = NULL;
+
+
+   iRet = X11REPLY(XGetWindowProperty(pX11Display, w, aName, 0, 4, 0,
+      aType,     &aRet, &iFormat, &iNumItems, &iByteRemaining, &pProperty));
+   if (iRet == Success && pProperty)
+   {
+      iFound = !strcmp((char *)pProperty, szValue);
+      if (iFound)
+         *pReturn = w;  // Note that pMaster was found earlier in the tree
+   }
+
+   // Check the window's children if needed
+   if (!iFound && X11REPLY(XQueryTree(pX11Display, w,     &wRoot, &wParent,
+                                                 &pChildren, &nChildren)))
+   {
+      if (pChildren && nChildren)
+         for (i = 0 ; i < nChildren && !iFound ; i++)
+            if (pChildren[i] != w && pChildren[i] != wRoot
+                && pChildren[i] != wParent)
+            {
+               if (w == wRoot)
+                  *pMaster = pChildren[i];
+               iFound = FindX11Window(pX11Display, pChildren[i], aName,
+                                      aType, szValue,
+                                                        pReturn, pMaster);
+            }
+   }
+
+   if (pChildren)
+      XFree(pChildren);
+
+   if (pProperty)
+      XFree(pProperty);
+
+   return(iFound);
+}
+
+
+
+
+/*
+ *  TaskbarFindAndUnmap
+ *
+ *  Very environment dependant.  This code currently looks for the xload
+ *  program.  Other toolbar programs could also be tested if needed.
+ */
+
+void
+TaskbarFindAndUnmap(Display *pX11Display, Window wRoot,
+                                                      Window *pTaskbar)
+{
+   Window   wMaster = 0,
+            wXload = 0;
+   XEvent   ev;
+   XWindowAttributes attrib;
+
+#ifdef FSPLAYER_DEBUG
+   char     szState[LNSZ];
+#endif // FSPLAYER_DEBUG
+
+
+   *pTaskbar = 0;
+   // WM_NAME(STRING) = "xload"
+   FindX11Window(pX11Display, wRoot, XA_WM_NAME, XA_STRING, "xload",
+                                                      &wXload, &wMaster);
+   if (wXload)
+      if (X11REPLY(XGetWindowAttributes(pX11Display, wMaster,     &attrib)))
+         if (attrib.override_redirect && attrib.map_state == IsViewable)
+         {
+            *pTaskbar = wMaster;
+
+            //
+            // Oldschool fullscreen, get rid of the taskbar
+            //
+            XSelectInput(pX11Display, wMaster, StructureNotifyMask);
+            XUnmapWindow(pX11Display, wMaster);
+#ifdef FSPLAYER_DEBUG
+            printf("XUnmapWindow(w=0x%lX)\n", wMaster);
+#endif // FSPLAYER_DEBUG
+
+            // Wait for the unmap to occur
+            if (!X11WaitEvent(pX11Display, wMaster, UnmapNotify,
+                              FSPLAYER_MAPTIMEOUT,     &ev))
+               printf("WARNING: The taskbar wasn't unmapped after %d ms.\n",
+                      FSPLAYER_MAPTIMEOUT);
+            XSelectInput(pX11Display, wMaster, NoEventMask);
+#ifdef FSPLAYER_DEBUG
+            MapState2sz(attrib.map_state,     szState);
+            printf("XGetWindowAttributes: w=0x%lX, x=%d, y=%d,"
+                   " width=%d, h=%d, state=%s, OvRedir=%d\n", wMaster,
+                   attrib.x, attrib.y, attrib.width, attrib.height,
+                   szState, attrib.override_redirect);
+#endif // FSPLAYER_DEBUG
+         }
+}
+
+
+
+
+/*
+ *  TaskbarRaise
+ *
+ *  Nothing depends on the taskbar being back, so there's no waiting
+ *  for it, fsplayer may be on its way out.
+ */
+
+void
+TaskbarRaise(Display *pX11Display, Window wTaskbar)
+{
+   //
+   // Oldschool fullscreen, restore the taskbar
+   //
+   if (wTaskbar)
+   {
+      XMapRaised(pX11Display, wTaskbar);
+#ifdef FSPLAYER_DEBUG
+      printf("XMapRaised(w=0x%lX)\n", wTaskbar);
+#endif // FSPLAYER_DEBUG
+   }
+}
+
+
+
+
+/*
+ *  SetWindowFullscreen
+ *
+ *  Called while w is still unmapped, so the window manager maps it
+ *  the right way from the start.  With EWMH fullscreen support, setting
+ *  _NET_WM_STATE is all it takes, otherwise MoveDecorationsAway() has
+ *  to follow once w is mapped.
+ */
+
+void
+SetWindowFullscreen(Display *pX11Display, Window w, const Atom *pAtoms,
+                    int iEwmhFullscreen, unsigned int scrx,
+                    unsigned int scry)
+{
+   //
+   // Remove the window decorations
+   //
+   struct
+   {
+      unsigned long flags;
+      unsigned long functions;
+      unsigned long decorations;
+      long input_mode;
+      unsigned long status;
+   } sMotifWmHints;
+
+   memset(&sMotifWmHints, 0, sizeof(sMotifWmHints));
+   sMotifWmHints.flags = 2;   // MWM_HINTS_DECORATIONS;
+   sMotifWmHints.decorations = 0;
+   XChangeProperty(pX11Display, w, pAtoms[FSPLAYER_A_MOTIFWMHINTS],
+                   pAtoms[FSPLAYER_A_MOTIFWMHINTS], 32, PropModeReplace,
+                   (unsigned char *)&sMotifWmHints,
+                   sizeof(sMotifWmHints) / sizeof(long));
+
+   XMoveResizeWindow(pX11Display, w, 0, 0, scrx, scry);
+
+#ifdef FSPLAYER_DEBUG
+   printf("XMoveResizeWindow(0x%lX)\n", w);
+#endif // FSPLAYER_DEBUG
+
+   //
+   // Ask the window manager to map the window fullscreen
+   //
+   if (iEwmhFullscreen)
+      XChangeProperty(pX11Display, w, pAtoms[FSPLAYER_A_NETWMSTATE],
+                      XA_ATOM, 32, PropModeReplace,
+                      (unsigned char *)&pAtoms[FSPLAYER_A_NETWMSTATEFS], 1);
+}
+
+
+
+
+/*
+ *  MoveDecorationsAway
+ *
+ *  Oldschool fullscreen, for window managers without EWMH fullscreen
+ *  support: just move the window decorations out of view.
+ */
+
+void
+MoveDecorationsAway(Display *pX11Display, Window w, Window wMaster,
+                    Window wRoot)
+{
+   int    x = 0,
+          y = 0;
+   Bool   iOverrideRedirect;
+   Window w2;
+   XEvent ev;
+   XSetWindowAttributes attribSet;
+   XWindowAttributes attribGet;
+
+
+   // Not on wRoot's screen, there's nothing to move
+   if (!X11REPLY(XTranslateCoordinates(pX11Display, w, wRoot, 0, 0,
+                                                            &x, &y, &w2)))
+      x = y = 0;
+#ifdef FSPLAYER_DEBUG
+   printf("XTranslateCoordinates(w=0x%lX,     x=%d, y=%d, w2=0x%lX)\n",
+          w, x, y, w2);
+#endif // FSPLAYER_DEBUG
+
+   if (x > 0 || y > 0)
+   {
+      if (X11REPLY(XGetWindowAttributes(pX11Display, wMaster,
+                                                         &attribGet)))
+      {
+         iOverrideRedirect = attribGet.override_redirect;
+         if (!iOverrideRedirect)
+         {
+            memset(&attribSet, 0, sizeof(attribSet));
+            attribSet.override_redirect = 1;
+            XChangeWindowAttributes(pX11Display, wMaster,
+                                    CWOverrideRedirect, &attribSet);
+
+#ifdef FSPLAYER_DEBUG
+            printf("XChangeWindowAttributes(w=0x%lX, OvRedir=1)\n",
+                   wMaster);
+#endif // FSPLAYER_DEBUG
+         }
+      }
+      else
+         iOverrideRedirect = 1;
+
+      // The frame belongs to the window manager, listen to it only long
+      // enough to see the move happen
+      if (wMaster != w)
+         XSelectInput(pX11Display, wMaster, StructureNotifyMask);
+
+      XMoveWindow(pX11Display, wMaster, -x, -y);
+
+#ifdef FSPLAYER_DEBUG
+      printf("XMoveWindow(w=0x%lX, x=%d, y=%d)\n", wMaster, -x, -y);
+#endif // FSPLAYER_DEBUG
+
+      if (!X11WaitEvent(pX11Display, wMaster, ConfigureNotify,
+                        FSPLAYER_MAPTIMEOUT,     &ev))
+         printf("WARNING: The window decorations weren't moved away"
+                " after %d ms.\n", FSPLAYER_MAPTIMEOUT);
+#ifdef FSPLAYER_DEBUG
+      else
+         printf("X11WaitEvent(ConfigureNotify, x=%d, y=%d)\n",
+                ev.xconfigure.x, ev.xconfigure.y);
+#endif // FSPLAYER_DEBUG
+
+      // Requests are done in order, so the move can't be redirected to
+      // the window manager anymore once this one goes through
+      if (!iOverrideRedirect)
+      {
+         attribSet.override_redirect = 0;
+         XChangeWindowAttributes(pX11Display, wMaster,
+                                 CWOverrideRedirect, &attribSet);
+
+#ifdef FSPLAYER_DEBUG
+         printf("XChangeWindowAttributes(w=0x%lX, OvRedir=0)\n",
+                wMaster);
+#endif // FSPLAYER_DEBUG
+      }
+      if (wMaster != w)
+         XSelectInput(pX11Display, wMaster, NoEventMask);
+   }
+}
+
+
+
+
+/*
+ *  BackgroundShow
+ *
+ *  Maps the black background and makes it fullscreen, which doesn't
+ *  depend on the video, so it's all done before there's a frame to show.
+ *  The video window stays unmapped until VideoLayout() places it.
+ */
+
+void
+BackgroundShow(FSPLAYER *pFsp)
+{
+   Display  *pX11Display = pFsp->pX11Display;
+   XEvent   ev;
+
+
+   XUnmapWindow(pX11Display, pFsp->wVideo);
+   SetWindowFullscreen(pX11Display, pFsp->wInput, pFsp->aAtoms,
+                       pFsp->iEwmhFullscreen, pFsp->scrx, pFsp->scry);
+   XMapRaised(pX11Display, pFsp->wInput);
+#ifdef FSPLAYER_DEBUG
+   printf("XMapRaised(w=0x%lX)\n", pFsp->wInput);
+#endif // FSPLAYER_DEBUG
+
+   // The WM reparents the window before mapping it, so once mapped its
+   // frame can be found, and moved out of view if need be
+   if (!X11WaitEvent(pX11Display, pFsp->wInput, MapNotify,
+                     FSPLAYER_MAPTIMEOUT,     &ev))
+      printf("WARNING: The window manager didn't map the window"
+             " after %d ms.\n", FSPLAYER_MAPTIMEOUT);
+
+   FindMaster(pX11Display, pFsp->wInput,     &pFsp->wInputMaster);
+   if (!pFsp->iEwmhFullscreen)
+      MoveDecorationsAway(pX11Display, pFsp->wInput, pFsp->wInputMaster,
+                          pFsp->wRoot);
+   pFsp->wTaskbar = 0;
+   TaskbarFindAndUnmap(pX11Display, pFsp->wRoot,     &pFsp->wTaskbar);
+   X11REPLY(XSync(pX11Display, False));
+   TimingMark(&pFsp->timings, FSPLAYER_T_BACKGROUND);
+}
+
+
+
+
+/*
+ *  BackgroundHide
+ */
+
+void
+BackgroundHide(FSPLAYER *pFsp)
+{
+   TaskbarRaise(pFsp->pX11Display, pFsp->wTaskbar);
+   pFsp->wTaskbar = 0;
+   XUnmapWindow(pFsp->pX11Display, pFsp->wInput);
+   XFlush(pFsp->pX11Display);
+}
+
+
+
+
+/*
+ *  VideoLayout
+ *
+ *  libvlc shrinks the video to fit wVideo, so a big video gets the whole
+ *  screen while a small one is sized as is and centered.  wVideo is
+ *  mapped only once in place, so no frame is ever seen elsewhere.
+ */
+
+void
+VideoLayout(FSPLAYER *pFsp, unsigned int vidx, unsigned int vidy)
+{
+   unsigned int scrx = pFsp->scrx,
+                scry = pFsp->scry;
+
+
+   if (vidx && vidy && vidx < scrx && vidy < scry)
+   {
+      pFsp->vidw = vidx;
+      pFsp->vidh = vidy;
+   }
+   else
+   {
+      pFsp->vidw = scrx;
+      pFsp->vidh = scry;
+   }
+   XMoveResizeWindow(pFsp->pX11Display, pFsp->wVideo,
+                     (scrx - pFsp->vidw) / 2, (scry - pFsp->vidh) / 2,
+                     pFsp->vidw, pFsp->vidh);
+   pFsp->iVideoPos = 5;
+   XMapWindow(pFsp->pX11Display, pFsp->wVideo);
+   X11REPLY(XSync(pFsp->pX11Display, False));
+   TimingMark(&pFsp->timings, FSPLAYER_T_LAYOUT);
+}
+
+
+
+
+/*
+ *  PositionWindow
+ *
+ *  Moves a smaller video to the keypad's area of the screen.  Its size
+ *  is known since VideoLayout(), so there's no need to ask the server.
+ *  Returns 1 when the video moved.
+ */
+
+int
+PositionWindow(FSPLAYER *pFsp, int iKeypadPos)
+{
+   int            iMoved = 0,
+                  x,
+                  y;
+   unsigned int   iHeight = pFsp->vidh,
+                  iWidth = pFsp->vidw,
+                  scrx = pFsp->scrx,
+                  scry = pFsp->scry;
+
+
+   if (iWidth < scrx && iHeight < scry && iKeypadPos != pFsp->iVideoPos)
+   {
+      if (iKeypadPos == 1 || iKeypadPos == 4 || iKeypadPos == 7)
+         x = 0;
+      else if (iKeypadPos == 3 || iKeypadPos == 6 || iKeypadPos == 9)
+         x = scrx - iWidth;
+      else
+         x = (scrx - iWidth) / 2;
+
+      if (iKeypadPos == 7 || iKeypadPos == 8 || iKeypadPos == 9)
+         y = 0;
+      else if (iKeypadPos == 1 || iKeypadPos == 2 || iKeypadPos == 3)
+         y = scry - iHeight;
+      else
+         y = (scry - iHeight) / 2;
+
+      XMoveWindow(pFsp->pX11Display, pFsp->wVideo, x, y);
+      pFsp->iVideoPos = iKeypadPos;
+      iMoved = 1;
+   }
+
+   return(iMoved);
+}
+
+
+
+
+/*
+ *  SeekBase
+ *
+ *  Where the next navigation key starts from: the seek still waiting to
+ *  be sent, else the local clock, which already knows about the seek
+ *  in flight.  libvlc isn't asked, see VlcClockNow().
+ */
+
+libvlc_time_t
+SeekBase(FSPLAYER *pFsp, const SEEKQUEUE *pSeek)
+{
+   libvlc_time_t iTimeMs = pSeek->iTargetMs;
+
+
+   if (iTimeMs < 0)
+   {
+      pthread_mutex_lock(&pFsp->vlcState.mutex);
+      iTimeMs = VlcClockNow(&pFsp->vlcState);
+      pthread_mutex_unlock(&pFsp->vlcState.mutex);
+   }
+
+   return(iTimeMs);
+}
+
+
+
+
+/*
+ *  SeekStep
+ *
+ *  How far a jump key goes.  Held down, its step doubles for every
+ *  FSPLAYER_HOLDDOUBLE, up to FSPLAYER_HOLDMAXSHIFT times, so a distant
+ *  position is a few seeks away rather than dozens.  The keyboard's
+ *  autorepeat tells that a key is held: its presses come less than
+ *  FSPLAYER_HOLDGAP apart, in the X server's time.
+ */
+
+libvlc_time_t
+SeekStep(SEEKQUEUE *pSeek, int iAction, Time tKey)
+{
+   int   iShift;
+
+
+   if (iAction != pSeek->iHeldAction
+       || tKey - pSeek->tLastKey > FSPLAYER_HOLDGAP)
+   {
+      pSeek->iHeldAction = iAction;
+      pSeek->tHeld = tKey;
+   }
+   pSeek->tLastKey = tKey;
+
+   iShift = (tKey - pSeek->tHeld) / FSPLAYER_HOLDDOUBLE;
+   if (iShift > FSPLAYER_HOLDMAXSHIFT)
+      iShift = FSPLAYER_HOLDMAXSHIFT;
+
+   return(giKeySeekMs[iAction] * (1 << iShift));
+}
+
+
+
+
+/*
+ *  SeekArmTimer
+ *
+ *  The reactor's timer is the seek queue's alone, iTimer tells why it
+ *  goes off.  iMs of -1 disarms it.
+ */
+
+void
+SeekArmTimer(FSPLAYER *pFsp, SEEKQUEUE *pSeek, int iTimer,
+             libvlc_time_t iMs)
+{
+   pSeek->iTimer = (iMs >= 0) ? iTimer : FSPLAYER_S_NONE;
+   ReactorArmTimer(&pFsp->reactor, iMs);
+}
+
+
+
+
+/*
+ *  SeekQueue
+ *
+ *  A held key repeats quickly, and libvlc would go through every seek
+ *  without showing any of them.  A key on its own is sent right away.
+ *  Those following it within FSPLAYER_SEEKDEBOUNCE are a burst: only
+ *  the last target is kept, sent once the keys stop for
+ *  FSPLAYER_SEEKDEBOUNCE, or after FSPLAYER_SEEKMAXWAIT so a held key
+ *  still moves along.
+ */
+
+void
+SeekQueue(FSPLAYER *pFsp, SEEKQUEUE *pSeek, libvlc_time_t iTargetMs)
+{
+   int    iAlone;
+   double t,
+          tDeadline;
+
+
+   t = MonotonicMs();
+   iAlone = (pSeek->iTargetMs < 0
+             && t - pSeek->tQueued >= FSPLAYER_SEEKDEBOUNCE);
+   if (!pSeek->tBurst)
+      pSeek->tBurst = t;
+   if (pSeek->iTargetMs < 0)
+      pSeek->tFirstKey = t;
+   pSeek->iTargetMs = iTargetMs;
+   pSeek->tQueued = t;
+   pSeek->nKeys++;
+
+   if (iAlone)
+      pSeek->iDue = 1;     // SeekIssue() is next
+   else
+   {
+      pSeek->iDue = 0;
+      tDeadline = t + FSPLAYER_SEEKDEBOUNCE;
+      if (tDeadline > pSeek->tFirstKey + FSPLAYER_SEEKMAXWAIT)
+         tDeadline = pSeek->tFirstKey + FSPLAYER_SEEKMAXWAIT;
+      SeekArmTimer(pFsp, pSeek, FSPLAYER_S_DEBOUNCE, tDeadline - t);
+   }
+}
+
+
+
+
+/*
+ *  SeekIssue
+ *
+ *  Sends the queued seek when it's due and the previous one settled,
+ *  see VlcEventCallback().  Targets superseded in the meantime were
+ *  never sent.  Called at every turn of the event loop.
+ */
+
+void
+SeekIssue(FSPLAYER *pFsp, SEEKQUEUE *pSeek)
+{
+   int      iInFlight;
+   double   t,
+            tIssued,
+            tSettled;
+
+
+   t = MonotonicMs();
+   pthread_mutex_lock(&pFsp->vlcState.mutex);
+   if (pFsp->vlcState.iSeekTarget >= 0
+       && t - pFsp->vlcState.tSeekIssued >= FSPLAYER_SEEKTIMEOUT)
+      pFsp->vlcState.iSeekTarget = -1;    // Given up on
+   iInFlight = (pFsp->vlcState.iSeekTarget >= 0);
+   tIssued = pFsp->vlcState.tSeekIssued;
+   tSettled = pFsp->vlcState.tSeekSettled;
+   pthread_mutex_unlock(&pFsp->vlcState.mutex);
+
+   if (pSeek->tInFlight && !iInFlight)
+   {
+      // The keys that led to it are done, unless it was given up on
+      LatencyEffect(&pFsp->timings, FSPLAYER_L_SEEK, pSeek->tInFlight,
+                    tSettled >= pSeek->tInFlight ? tSettled : 0);
+      pSeek->tInFlight = 0;
+   }
+
+   if (pSeek->iTargetMs >= 0 && pSeek->iDue)
+   {
+      if (!iInFlight)
+      {
+         pthread_mutex_lock(&pFsp->vlcState.mutex);
+         pFsp->vlcState.iSeekTarget = pSeek->iTargetMs;
+         pFsp->vlcState.iSeekGen++;
+         pFsp->vlcState.tSeekIssued = t;
+         VlcClockSet(&pFsp->vlcState, pSeek->iTargetMs);
+         pthread_mutex_unlock(&pFsp->vlcState.mutex);
+         ControlSend(pFsp, FSPLAYER_C_SEEK, pSeek->iTargetMs);
+         pSeek->tInFlight = t;
+         pSeek->iTargetMs = -1;
+         pSeek->iDue = 0;
+         pSeek->nSeeks++;
+
+         // In case it never settles
+         SeekArmTimer(pFsp, pSeek, FSPLAYER_S_INFLIGHT,
+                      FSPLAYER_SEEKTIMEOUT);
+      }
+      else
+      {
+         // Wait for the seek in flight, its end wakes the loop up
+         SeekArmTimer(pFsp, pSeek, FSPLAYER_S_INFLIGHT,
+                      tIssued + FSPLAYER_SEEKTIMEOUT - t);
+      }
+   }
+   else if (pSeek->tBurst && pSeek->iTargetMs < 0 && !iInFlight)
+   {
+      // The burst is over, from its first key to the frame it led to
+      if (tSettled >= pSeek->tBurst)
+         pFsp->timings.tSeekSettleMs = tSettled - pSeek->tBurst;
+      pSeek->tBurst = 0;
+      SeekArmTimer(pFsp, pSeek, FSPLAYER_S_NONE, -1);
+   }
+}
+
+
+
+
+/*
+ *  PlayMedia
+ *
+ *  Plays the media prepared in pStartup until it ends, ESC is pressed
+ *  or the client goes away.  iClientFd is -1 when there's no client.
+ *  With pTeardown, the player is left there to be released in the
+ *  background instead of being stopped here.
+ */
+
+int
+PlayMedia(FSPLAYER *pFsp, VLCSTARTUP *pStartup, int iClientFd,
+          VLCTEARDOWN *pTeardown,                         char *szErr)
+{
+   int                        iAction,
+                              iErr = 0,
+                              iPaused,
+                              iNumVlcAudioTracks = 0,
+                              iPlay = 0,
+                              iProbed = 0,
+                              iRet,
+                              iRoundTrips,
+                              iRunning = 1,
+                              iVlcAudioTrack = 0,
+                              iWoken,
+                              *pVlcAudioTrackId = NULL;
+   long                       nPausedSwitches = 0;
+   double                     tBusy,
+                              tKey,
+                              tLoop,
+                              tPauseChanged,
+                              tPaused = 0;
+   unsigned int               vidx,
+                              vidy;
+   char                       szBuf[LNSZ];
+   Display                    *pX11Display = pFsp->pX11Display;
+   libvlc_time_t              iEndTimeMs = 0,
+                              iStepMs,
+                              iTimeMs;
+   libvlc_media_player_t      *pVlcPlayer = NULL;
+   libvlc_track_description_t *pVlcAudioTrackDesc,
+                              *pVlcATD;
+   MEDIAINFO                  mediaInfo;
+   SEEKQUEUE                  seek;
+   Window                     wInput = pFsp->wInput,
+                              wInputMaster = pFsp->wInputMaster,
+                              wVideo = pFsp->wVideo;
+   XEvent                     loopEvent;
+
+
+   memset(&mediaInfo, 0, sizeof(mediaInfo));
+   memset(&seek, 0, sizeof(seek));
+   seek.iTargetMs = -1;
+   VlcStateReset(&pFsp->vlcState);
+
+   // The black background is already up, see BackgroundShow()
+   if (!iErr)
+   {
+      /* Create a media player playing environement */
+      pVlcPlayer = libvlc_media_player_new_from_media(pStartup->pVlcMedia);
+      if (!pVlcPlayer)
+      {
+         iErr = ERROR_FSPLAYER_VLC;
+         strcat(szErr, "libvlc_media_player_new_from_media() failed!");
+      }
+      else if (VlcAttachEvents(pVlcPlayer, &pFsp->vlcState))
+      {
+         iErr = ERROR_FSPLAYER_VLC;
+         strcat(szErr, "libvlc_event_attach() failed!");
+      }
+      else
+      {
+         if (pFsp->pShm)
+            FsShmAttach(pFsp->pShm, pVlcPlayer);
+         else
+            libvlc_media_player_set_xwindow(pVlcPlayer, wVideo);
+         libvlc_video_set_key_input(pVlcPlayer, 0);
+         libvlc_video_set_mouse_input(pVlcPlayer, 0);
+      }
+   }
+   if (pStartup->pVlcMedia)
+   {
+      /* No need to keep the media now */
+      libvlc_media_release(pStartup->pVlcMedia);
+      pStartup->pVlcMedia = NULL;
+   }
+   if (!iErr)
+   {
+      // When the cache or the parsing knows everything, there's no need
+      // to play the video to learn about it
+      iProbed = pStartup->iProbed;
+      if (iProbed)
+      {
+         mediaInfo = pStartup->info;
+         vidx = mediaInfo.vidx;
+         vidy = mediaInfo.vidy;
+         iEndTimeMs = mediaInfo.iLengthMs;
+         iNumVlcAudioTracks = mediaInfo.iNumAudioTracks;
+         if (iNumVlcAudioTracks > 1)
+         {
+            pVlcAudioTrackId = malloc(iNumVlcAudioTracks * sizeof(int));
+            if (pVlcAudioTrackId)
+            {
+               for (iRet = 0 ; iRet < iNumVlcAudioTracks ; iRet++)
+               {
+                  printf("Audio track found: %s\n\n",
+                         mediaInfo.szAudioTrackName[iRet]);
+                  pVlcAudioTrackId[iRet] = mediaInfo.iAudioTrackId[iRet];
+               }
+            }
+            else
+               iErr = ERROR_FSPLAYER_MEM;
+         }
+      }
+   }
+   if (!iErr && !iProbed)
+   {
+      iPlay = 1;
+      iErr = libvlc_media_player_play(pVlcPlayer);
+      TimingMark(&pFsp->timings, FSPLAYER_T_FIRSTPLAY);
+      if (iErr)
+         printf("Warning: VLC Play Failed!\n");
+
+      // Wait until the tracks are created.  The video has to be decoded
+      // to learn about it, and its first frames are then kept paused in
+      // the unmapped wVideo until it's laid out.  libvlc's start-paused
+      // would pause before decoding anything, with no video output.
+      VlcWaitReady(&pFsp->vlcState, FSPLAYER_READYTIMEOUT);
+      libvlc_media_player_set_pause(pVlcPlayer, 1);
+
+#ifdef FSPLAYER_DEBUG
+      printf("0x%X=libvlc_media_player_get_xwindow()\n",
+             libvlc_media_player_get_xwindow(pVlcPlayer));
 #endif // FSPLAYER_DEBUG
+
+      iErr = libvlc_video_get_size(pVlcPlayer, 0,     &vidx, &vidy);
+      if (iErr)
+      {
+         iErr = ERROR_FSPLAYER_VLC;
+         strcat(szErr, "libvlc_video_get_size() didn't find the video!");
+      }
+   }
+   if (!iErr && !iProbed)
+   {
+      // A stream may not have a length, the keys then jump without
+      // an end to stop at
+      iEndTimeMs = libvlc_media_player_get_length(pVlcPlayer);
+      if (iEndTimeMs < 0)
+         iEndTimeMs = 0;
+   }
+   if (!iErr && !iProbed)
+   {
+      iNumVlcAudioTracks = libvlc_audio_get_track_count(pVlcPlayer);
+      if (iNumVlcAudioTracks > 1)
+      {
+         pVlcAudioTrackId = malloc(iNumVlcAudioTracks * sizeof(int));
+         if (pVlcAudioTrackId)
+         {
+            memset(pVlcAudioTrackId, 0,
+                   sizeof(iNumVlcAudioTracks * sizeof(int)));
+            pVlcAudioTrackDesc = pVlcATD
+               = libvlc_audio_get_track_description(pVlcPlayer);
+            if (pVlcAudioTrackDesc)
+            {
+               for (iRet = 0 ; pVlcATD && iRet < iNumVlcAudioTracks
+                             ; iRet++)
+               {
+                  printf("Audio track found: %s\n\n", pVlcATD->psz_name);
+                  pVlcAudioTrackId[iRet] = pVlcATD->i_id;
+                  if (iRet < FSCACHE_MAXTRACKS)
+                  {
+                     mediaInfo.iAudioTrackId[iRet] = pVlcATD->i_id;
+                     snprintf(mediaInfo.szAudioTrackName[iRet],
+                              FSCACHE_NAMESZ, "%s", pVlcATD->psz_name);
+                  }
+                  pVlcATD = pVlcATD->p_next;
+               }
+               libvlc_track_description_list_release(pVlcAudioTrackDesc);
+            }
+         }
+         else
+            iErr = ERROR_FSPLAYER_MEM;
       }
+   }
+   if (!iErr)
+   {      
+      printf("Video %dx%d, length: %li sec., %d audio tracks.\n",
+             vidx, vidy, iEndTimeMs/1000, iNumVlcAudioTracks);
 
-      if (!iOverrideRedirect)
+      TimingMark(&pFsp->timings, FSPLAYER_T_VIDEOSIZE);
+
+      if (!pStartup->iCacheHit && iEndTimeMs > 0
+          && iNumVlcAudioTracks <= FSCACHE_MAXTRACKS)
       {
-         attribSet.override_redirect = 0;
-         iRet = XChangeWindowAttributes(pX11Display, wMaster,
-                                        CWOverrideRedirect, &attribSet);
+         mediaInfo.vidx = vidx;
+         mediaInfo.vidy = vidy;
+         mediaInfo.iLengthMs = iEndTimeMs;
+         mediaInfo.iNumAudioTracks = iNumVlcAudioTracks;
+         FsCacheStore(pFsp->pCache, pStartup->szFilename,     &mediaInfo);
+      }
+
+      VideoLayout(pFsp, vidx, vidy);
+
+      // Play the media_player, from where it's paused if it was needed
+      // to learn about the video
+      if (iPlay)
+         libvlc_media_player_set_pause(pVlcPlayer, 0);
+      else
+      {
+         iPlay = 1;
+         iErr = libvlc_media_player_play(pVlcPlayer);
+         TimingMark(&pFsp->timings, FSPLAYER_T_FIRSTPLAY);
+         if (iErr)
+         {
+            iErr = ERROR_FSPLAYER_VLC;
+            strcat(szErr, "libvlc_media_player_play() failed!");
+         }
+      }
+
+      // fsplayer never changes the rate, one look is enough
+      pthread_mutex_lock(&pFsp->vlcState.mutex);
+      pFsp->vlcState.fRate = libvlc_media_player_get_rate(pVlcPlayer);
+      if (pFsp->vlcState.fRate <= 0)
+         pFsp->vlcState.fRate = 1;
+      pthread_mutex_unlock(&pFsp->vlcState.mutex);
+   }
+
+   //
+   // Event Loop, asleep until there's something to do.  Nothing in it
+   // waits on the X server, the X events tell what's going on, nor on
+   // libvlc, ControlThread() makes the calls.
+   //
+   if (!iErr)
+      iErr = ControlStart(&pFsp->control, &pFsp->vlcState, pVlcPlayer,
+                          pFsp->reactor.fdEvent,     szErr);
+   iRoundTrips = giX11RoundTrips;
+   tLoop = MonotonicMs();
+   if (iClientFd >= 0)
+      ReactorAdd(&pFsp->reactor, iClientFd, FSPLAYER_R_CLIENT);
+   while (iRunning && !iErr)
+   {
+      tBusy = MonotonicMs();
 
+      // Xlib may have queued events while waiting for a reply, so the
+      // queue is checked before going to sleep and not only when the
+      // connection is readable
+      while (XPending(pX11Display))
+      {
+         if (QLength(pX11Display) > pFsp->timings.iX11QueueMax)
+            pFsp->timings.iX11QueueMax = QLength(pX11Display);
+         loopEvent.type = 0;
+         XNextEvent(pX11Display,     &loopEvent);
+         if (loopEvent.type == KeyPress)
+         {
+            iAction = pFsp->aKeyAction[loopEvent.xkey.keycode & 0xFF];
+            tKey = X11TimeMs(pFsp, loopEvent.xkey.time);
+            switch (iAction)
+            {
+               case FSPLAYER_K_QUIT:
+                  LatencyKey(&pFsp->timings, FSPLAYER_L_QUIT, tKey);
+                  iRunning = 0;
+#ifdef FSPLAYER_DEBUG
+                  printf("Final time: %ld, IsPlaying:%d, State:%d\n",
+                         libvlc_media_player_get_time(pVlcPlayer),
+                         libvlc_media_player_is_playing(pVlcPlayer),
+                         libvlc_media_player_get_state(pVlcPlayer));
+#endif // FSPLAYER_DEBUG
+                  break;
+
+               case FSPLAYER_K_PAUSE:
+                  LatencyKey(&pFsp->timings, FSPLAYER_L_PAUSE, tKey);
+                  ControlSend(pFsp, FSPLAYER_C_PAUSE, 0);
+                  break;
+
+               case FSPLAYER_K_START:
+                  LatencyKey(&pFsp->timings, FSPLAYER_L_SEEK, tKey);
+                  SeekQueue(pFsp, &seek, 0);
+                  break;
+
+               case FSPLAYER_K_END:
+                  if (iEndTimeMs > 0)
+                  {
+                     LatencyKey(&pFsp->timings, FSPLAYER_L_SEEK, tKey);
+                     iTimeMs = iEndTimeMs - FSPLAYER_10SEC;
+                     if (iTimeMs < 0)
+                        iTimeMs = 0;
+                     SeekQueue(pFsp, &seek, iTimeMs);
+                  }
+                  break;
+
+               case FSPLAYER_K_VOLUP:
+                  LatencyKey(&pFsp->timings, FSPLAYER_L_VOLUME, tKey);
+                  ControlSend(pFsp, FSPLAYER_C_VOLUME, 10);
+                  break;
+
+               case FSPLAYER_K_VOLDOWN:
+                  LatencyKey(&pFsp->timings, FSPLAYER_L_VOLUME, tKey);
+                  ControlSend(pFsp, FSPLAYER_C_VOLUME, -10);
+                  break;
+
+               case FSPLAYER_K_AUDIOTRACK:
+                  if (iNumVlcAudioTracks > 1)
+                  {
+                     LatencyKey(&pFsp->timings, FSPLAYER_L_AUDIOTRACK, tKey);
+                     iVlcAudioTrack++;
+                     if (iVlcAudioTrack == iNumVlcAudioTracks)
+                        iVlcAudioTrack = 0;
+                     ControlSend(pFsp, FSPLAYER_C_AUDIOTRACK,
+                                 pVlcAudioTrackId[iVlcAudioTrack]);
+                  }
+                  break;
+
+               default:
+                  if (giKeySeekMs[iAction])
+                  {
+                     // Backward stops at the beginning.  Right goes on
+                     // until the end itself, the longer jumps no further
+                     // than the END key would go.  Without a length,
+                     // forward has no end.
+                     iStepMs = SeekStep(&seek, iAction,
+                                        loopEvent.xkey.time);
+                     iTimeMs = SeekBase(pFsp, &seek);
+                     if (iStepMs < 0)
+                     {
+                        iTimeMs += iStepMs;
+                        if (iTimeMs < 0)
+                           iTimeMs = 0;
+                        LatencyKey(&pFsp->timings, FSPLAYER_L_SEEK, tKey);
+                        SeekQueue(pFsp, &seek, iTimeMs);
+                     }
+                     else if (!iEndTimeMs)
+                     {
+                        LatencyKey(&pFsp->timings, FSPLAYER_L_SEEK, tKey);
+                        SeekQueue(pFsp, &seek, iTimeMs + iStepMs);
+                     }
+                     else if (iAction == FSPLAYER_K_FWD10SEC)
+                     {
+                        iTimeMs += iStepMs;
+                        if (iTimeMs < iEndTimeMs)
+                        {
+                           LatencyKey(&pFsp->timings, FSPLAYER_L_SEEK, tKey);
+                           SeekQueue(pFsp, &seek, iTimeMs);
+                        }
+                     }
+                     else if (iTimeMs < iEndTimeMs - FSPLAYER_10SEC)
+                     {
+                        iTimeMs += iStepMs;
+                        if (iTimeMs > iEndTimeMs - FSPLAYER_10SEC)
+                           iTimeMs = iEndTimeMs - FSPLAYER_10SEC;
+                        LatencyKey(&pFsp->timings, FSPLAYER_L_SEEK, tKey);
+                        SeekQueue(pFsp, &seek, iTimeMs);
+                     }
+                  }
+                  else if (iAction >= FSPLAYER_K_VIEW1)
+                  {
+                     if (PositionWindow(pFsp, iAction - FSPLAYER_K_VIEW1 + 1))
+                        LatencyKey(&pFsp->timings, FSPLAYER_L_VIEW, tKey);
+                  }
 #ifdef FSPLAYER_DEBUG
-         printf("%d=XChangeWindowAttributes(w=0x%lX, OvRedir=0)\n",
-                                            iRet, wMaster);
+                  else
+                     printf("KeySym=0x%lX\n",
+                            XKeycodeToKeysym(pX11Display,
+                                             loopEvent.xkey.keycode, 0));
 #endif // FSPLAYER_DEBUG
+                  break;
+            }
+         }
+         else if (loopEvent.type == ButtonRelease
+                  || (loopEvent.type == FocusIn
+                      && loopEvent.xfocus.window == wVideo
+                      && loopEvent.xfocus.detail != NotifyPointer))
+         {
+            // A click, or the focus went to the video window or to
+            // libvlc's own window inside it
+            XRaiseWindow(pX11Display, wInputMaster);
+            XSetInputFocus(pX11Display, wInput, RevertToNone, 0);
+         }
+         else if (loopEvent.type == VisibilityNotify
+                  && loopEvent.xvisibility.state == VisibilityFullyObscured)
+            XRaiseWindow(pX11Display, wInputMaster);
+         else if (loopEvent.type == ConfigureNotify
+                  && loopEvent.xconfigure.window == wVideo)
+         {
+            // PositionWindow()'s move is done
+            tKey = MonotonicMs();
+            LatencyEffect(&pFsp->timings, FSPLAYER_L_VIEW, tKey, tKey);
+         }
+      }
+
+      if (iRunning)
+      {
+         // libvlc tells when it's over, see VlcEventCallback()
+         pthread_mutex_lock(&pFsp->vlcState.mutex);
+         if (pFsp->vlcState.iError)
+         {
+            iErr = ERROR_FSPLAYER_VLC;
+            strcat(szErr, "libvlc couldn't play the video!");
+         }
+         else if (pFsp->vlcState.iEnded)
+            iRunning = 0;
+         tPauseChanged = pFsp->vlcState.tPauseChanged;
+         iPaused = pFsp->vlcState.iPaused;
+         pthread_mutex_unlock(&pFsp->vlcState.mutex);
+         LatencyEffect(&pFsp->timings, FSPLAYER_L_PAUSE, tPauseChanged,
+                       tPauseChanged);
+
+         // Nothing but a key, an X event or libvlc wakes the loop up
+         // while paused, see TimingsPaused()
+         if (iPaused && !tPaused)
+         {
+            tPaused = MonotonicMs();
+            nPausedSwitches = ContextSwitches();
+         }
+         else if (!iPaused && tPaused)
+         {
+            TimingsPaused(&pFsp->timings, tPaused, nPausedSwitches);
+            tPaused = 0;
+         }
+      }
+      ControlResults(pFsp);
+      if (iRunning && !iErr)
+         SeekIssue(pFsp, &seek);
+      TimingsBusy(&pFsp->timings, MonotonicMs() - tBusy);
+
+      if (iRunning && !iErr && !XPending(pX11Display))
+      {
+         iWoken = ReactorWait(&pFsp->reactor);
+         pFsp->timings.nLoopWakeups++;
+         if (tPaused)
+            pFsp->timings.nPausedWakeups++;
+         if (iWoken & FSPLAYER_R_SIGNAL)
+         {
+            printf("Signal %d received, stopping.\n",
+                   pFsp->reactor.iSignal);
+            iRunning = 0;
+         }
+         if ((iWoken & FSPLAYER_R_TIMER)
+             && seek.iTimer == FSPLAYER_S_DEBOUNCE)
+            seek.iDue = 1;
+         if (iWoken & FSPLAYER_R_DUMP)
+            LatencyDump(&pFsp->timings);
+
+         // The client has nothing more to say, so if it's readable it's
+         // gone and there's nobody left to play for
+         if (iWoken & FSPLAYER_R_CLIENT)
+            if (read(iClientFd, szBuf, sizeof(szBuf)) <= 0)
+               iRunning = 0;
       }
+   }
+   if (iClientFd >= 0)
+      ReactorDel(&pFsp->reactor, iClientFd);
+   pFsp->timings.iLoopRoundTrips = giX11RoundTrips - iRoundTrips;
+   pFsp->timings.tLoopMs = MonotonicMs() - tLoop;
+   if (tPaused)
+      TimingsPaused(&pFsp->timings, tPaused, nPausedSwitches);
+   pFsp->timings.nSeekKeys = seek.nKeys;
+   pFsp->timings.nSeeks = seek.nSeeks;
+   if (pFsp->pShm)
+   {
+      pFsp->timings.iShm = 1;
+      FsShmStats(pFsp->pShm,     &pFsp->timings.shm);
+   }
+   ReactorArmTimer(&pFsp->reactor, -1);
+#ifdef FSPLAYER_DEBUG
+   printf("%d X11 round trips while playing\n",
+          pFsp->timings.iLoopRoundTrips);
+#endif // FSPLAYER_DEBUG
+
+   // Before stopping the player, which would look like an end too
+   pthread_mutex_lock(&pFsp->vlcState.mutex);
+   if (!pFsp->timings.t[FSPLAYER_T_ENDREACHED])
+      pFsp->timings.t[FSPLAYER_T_ENDREACHED] = pFsp->vlcState.tEnded;
+   pthread_mutex_unlock(&pFsp->vlcState.mutex);
+
+   // Get out of sight at once, whatever libvlc takes to stop
+   TimingMark(&pFsp->timings, FSPLAYER_T_EXIT);
+   BackgroundHide(pFsp);
+   TimingMark(&pFsp->timings, FSPLAYER_T_HIDDEN);
+   LatencyEffect(&pFsp->timings, FSPLAYER_L_QUIT,
+                 pFsp->timings.t[FSPLAYER_T_HIDDEN],
+                 pFsp->timings.t[FSPLAYER_T_HIDDEN]);
+
+   // Done with the player before it's stopped, a call stuck in it is
+   // left behind after FSPLAYER_EXITTIMEOUT
+   ControlStop(&pFsp->control);
+   ControlResults(pFsp);
+
+   if (pTeardown)
+      pTeardown->pVlcPlayer = pVlcPlayer;
+   else
+   {
+      /* Stop playing */
+      if (iPlay)
+         libvlc_media_player_stop(pVlcPlayer);
 
-      // Wait for the attribute to return to normal (so it seems)
-      if (XGetWindowAttributes(pX11Display, wMaster,     &attribGet))
+      if (pVlcPlayer)
       {
 #ifdef FSPLAYER_DEBUG
-         printf("XGetWindowAttributes: w=0x%lX, x=%d, y=%d, width=%d,"
-                " h=%d, OvRedir=%d\n", wMaster, attribGet.x, attribGet.y,
-                attribGet.width, attribGet.height,
-                attribGet.override_redirect);
+         printf("libvlc_media_player_release()\n");
 #endif // FSPLAYER_DEBUG
+         libvlc_media_player_release(pVlcPlayer);
       }
+      TimingMark(&pFsp->timings, FSPLAYER_T_RELEASED);
    }
+
+   if (!pFsp->timings.t[FSPLAYER_T_FIRSTFRAME])
+      pFsp->timings.t[FSPLAYER_T_FIRSTFRAME] = pFsp->vlcState.tFirstFrame;
+
+   if (pVlcAudioTrackId)
+      free(pVlcAudioTrackId);
+
+   return(iErr);
 }
 
 
 
 
 /*
- *  main
+ *  X11Open
+ *
+ *  Opens the display and creates fsplayer's windows, left unmapped until
+ *  there's something to play.
  */
 
 int
-main(int argc, char* argv[])
+X11Open(FSPLAYER *pFsp,     char *szErr)
 {
-   int                        iDotClock,
-                              iErr = 0,
-                              iNumVlcAudioTracks,
-                              iPlay = 0,
-                              iRet,
-                              iRunning = 1,
-                              iVlcAudioTrack,
-                              iX11DefaultScreen,
-                              iX11fd,
-                              *pVlcAudioTrackId = NULL,
-                              x,                y;
-   unsigned int               scrx,             scry,
-                              vidx,             vidy;
-   unsigned long              iX11Black;
-   char                       szErr[LNSZ];
-   struct timeval             sEventLoopTimeout;
-   Atom                       aString,
-                              aWmName;
-   Display                    *pX11Display = NULL;
-   fd_set                     readfds;
-   KeyCode                    kcDown,           kcEnd,
-                              kcEsc,            kcHome,
-                              kcKpBegin,        kcKpDown,
-                              kcKpEnd,          kcKpHome,
-                              kcKpLeft,         kcKpMinus,
-                              kcKpMult,         kcKpPlus,
-                              kcKpPageDown,     kcKpPageUp,
-                              kcKpUp,           kcKpRight,
-                              kcLeft,           kcPgDown,
-                              kcPgUp,           kcRight,
-                              kcSpace,          kcUp;
-   libvlc_time_t              iEndTimeMs,
-                              iTimeMs;
-   libvlc_instance_t          *pVlcInst = NULL;
-   libvlc_media_t             *pVlcMedia;
-   libvlc_media_player_t      *pVlcPlayer = NULL;
-   libvlc_track_description_t *pVlcAudioTrackDesc,
-                              *pVlcATD;
-   Status                     iStatus;
-   Window                     w,
-                              wInput,
-                              wInputMaster,
-                              wMaster,
-                              wRoot,
-                              wTaskbar = 0,
-                              wVlc;
-   XEvent                     loopEvent;
-   XF86VidModeModeLine        modeLine;
-   XSetWindowAttributes       attribSet;
+   int                  iDotClock,
+                        iErr = 0;
+   unsigned long        iX11Black;
+   Display              *pX11Display;
+   XF86VidModeModeLine  modeLine;
+   XSetWindowAttributes attribSet;
+
 
- 
-   *szErr = 0;
    memset(&modeLine, 0, sizeof(modeLine));
 
-   if (argc != 2)
-      iErr = ERROR_FSPLAYER_USAGE;
+   pX11Display = pFsp->pX11Display = X11REPLY(XOpenDisplay(NULL));
+   TimingMark(&pFsp->timings, FSPLAYER_T_XOPENDISPLAY);
+   if (!pX11Display)
+   {
+      iErr = ERROR_FSPLAYER_X11;
+      strcat(szErr, "XOpenDisplay() failed!");
+   }
    if (!iErr)
    {
-      if (!FilenameExist(argv[1]))
-         iErr = ERROR_FSPLAYER_USAGE;
+      pFsp->iX11DefaultScreen = XDefaultScreen(pX11Display);
+      pFsp->wRoot = XDefaultRootWindow(pX11Display);
+      iX11Black = XBlackPixel(pX11Display, pFsp->iX11DefaultScreen);
+      giX11RoundTrips++;   // The extension query, the first time
+      X11REPLY(XF86VidModeGetModeLine(pX11Display, pFsp->iX11DefaultScreen,
+                                                 &iDotClock, &modeLine));
+      TimingMark(&pFsp->timings, FSPLAYER_T_MODELINE);
+      pFsp->scrx=modeLine.hdisplay;
+      pFsp->scry=modeLine.vdisplay;
+      if (modeLine.private)
+      {
+         XFree(modeLine.private);
+         modeLine.privsize = 0;
+         modeLine.private = NULL;
+      }
+      printf("X11 Screen Size: %dx%d.\n", pFsp->scrx, pFsp->scry);
+
+      XF86VidModeSetViewPort(pX11Display, pFsp->iX11DefaultScreen, 0, 0);
+   }
+   if (!iErr)
+   {
+      // Create the keyboard input/background window
+      memset(&attribSet, 0, sizeof(attribSet));
+      attribSet.background_pixel = iX11Black;
+      attribSet.event_mask = KeyPressMask|ButtonReleaseMask
+                             |StructureNotifyMask|VisibilityChangeMask;
+      pFsp->wInput = XCreateWindow(pX11Display, pFsp->wRoot, 0, 0,
+                                   pFsp->scrx, pFsp->scry,
+                                   0, 0, InputOutput, CopyFromParent,
+                                   CWBackPixel|CWEventMask,     &attribSet);
+      if (!pFsp->wInput)
+      {
+         iErr = ERROR_FSPLAYER_X11;
+         strcat(szErr, "XCreateWindow(wInput) failed!");
+      }
+   }
+   if (!iErr)
+   {
+      // Create the video window, libvlc will draw into it.  Keyboard
+      // events aren't selected so they propagate to wInput, only the
+      // focus is watched to give it back to wInput, and its moves.
+      memset(&attribSet, 0, sizeof(attribSet));
+      attribSet.background_pixel = iX11Black;
+      attribSet.event_mask = FocusChangeMask|StructureNotifyMask;
+      pFsp->wVideo = XCreateWindow(pX11Display, pFsp->wInput, 0, 0,
+                                   pFsp->scrx, pFsp->scry,
+                                   0, 0, InputOutput, CopyFromParent,
+                                   CWBackPixel|CWEventMask,     &attribSet);
+      if (!pFsp->wVideo)
+      {
+         iErr = ERROR_FSPLAYER_X11;
+         strcat(szErr, "XCreateWindow(wVideo) failed!");
+      }
+   }
+   if (!iErr)
+   {
+      // All the atoms in a single round trip
+      if (!X11REPLY(XInternAtoms(pX11Display, gszAtomName, FSPLAYER_A_COUNT,
+                                 False,     pFsp->aAtoms)))
+      {
+         iErr = ERROR_FSPLAYER_X11;
+         strcat(szErr, "XInternAtoms() failed!");
+      }
    }
    if (!iErr)
    {
+      XChangeProperty(pX11Display, pFsp->wInput, XA_WM_NAME, XA_STRING, 8,
+                      PropModeReplace, (unsigned char *)FSPLAYER_WMNAME, 8);
+      pFsp->iEwmhFullscreen = X11EwmhSupported(pX11Display, pFsp->wRoot,
+                                 pFsp->aAtoms[FSPLAYER_A_NETSUPPORTED],
+                                 pFsp->aAtoms[FSPLAYER_A_NETWMSTATEFS]);
+#ifdef FSPLAYER_DEBUG
+      printf("%d=X11EwmhSupported(_NET_WM_STATE_FULLSCREEN)\n",
+             pFsp->iEwmhFullscreen);
+#endif // FSPLAYER_DEBUG
+
+      KeyBindingsLoad(pFsp);
+      TimingMark(&pFsp->timings, FSPLAYER_T_WINDOWS);
+   }
+
+   return(iErr);
+}
+
+
+
+
+/*
+ *  X11Close
+ */
 
-      iStatus = XInitThreads();
+void
+X11Close(FSPLAYER *pFsp)
+{
+   if (pFsp->wInput)
+   {
 #ifdef FSPLAYER_DEBUG
-      if (iStatus)
-         printf("X11 Thread Support Active!\n");
-      else
-         printf("X11 Thread Support Unavailable!\n");
+      printf("XDestroyWindow(0x%lX)\n", pFsp->wInput);
+#endif // FSPLAYER_DEBUG
+      XDestroyWindow(pFsp->pX11Display, pFsp->wInput);
+   }
+
+   if (pFsp->pX11Display)
+   {
+#ifdef FSPLAYER_DEBUG
+      printf("XCloseDisplay()\n");
 #endif // FSPLAYER_DEBUG
+      XCloseDisplay(pFsp->pX11Display);
+   }
+}
+
+
+
+
+/*
+ *  PrintError
+ */
+
+void
+PrintError(int iErr, const char *szErr)
+{
+   switch (iErr)
+   {
+      case ERROR_FSPLAYER_USAGE:
+         printf("USAGE: fsplayer [--profile=default|tuned]"
+                " [--render=vout|shm] [--hugepages=no|thp|hugetlb]"
+                " [--timings] <filename>\n"
+                "       fsplayer [--profile=default|tuned]"
+                " [--render=vout|shm] [--hugepages=no|thp|hugetlb]"
+                " [--timings] --server\n"
+                "       fsplayer --bench-startup\n");
+         break;
+
+      case ERROR_FSPLAYER_X11:
+         printf("X11 ERROR: %s\n", szErr);
+         break;
+
+      case ERROR_FSPLAYER_VLC:
+         printf("VLC ERROR: %s\n", szErr);
+         break;
+
+      case ERROR_FSPLAYER_MEM:
+         printf("ERROR: Out Of Memory!\n");
+         break;
+
+      case ERROR_FSPLAYER_SOCKET:
+         printf("SOCKET ERROR: %s\n", szErr);
+         break;
+
+      case ERROR_FSPLAYER_REACTOR:
+         printf("EVENT LOOP ERROR: %s\n", szErr);
+         break;
+   }
+}
+
+
+
+
+/*
+ *  ServerSocketName
+ */
+
+int
+ServerSocketName(char *szName, size_t iSize)
+{
+   int         iLen;
+   const char  *sz;
+
+
+   sz = getenv("FSPLAYER_SOCKET");
+   if (sz && *sz)
+      iLen = snprintf(szName, iSize, "%s", sz);
+   else
+   {
+      sz = getenv("XDG_RUNTIME_DIR");
+      if (sz && *sz)
+         iLen = snprintf(szName, iSize, "%s/fsplayer.sock", sz);
+      else
+         iLen = snprintf(szName, iSize, "/tmp/fsplayer-%u.sock",
+                         (unsigned int)getuid());
+   }
+
+   return(iLen > 0 && iLen < iSize);
+}
+
+
+
+
+/*
+ *  ServerConnect
+ *
+ *  Returns the connected socket, or -1 when no server is running.
+ */
+
+int
+ServerConnect(void)
+{
+   int                  fd = -1;
+   struct sockaddr_un   sAddr;
 
-      pX11Display = XOpenDisplay(NULL);
-      if (!pX11Display)
+
+   memset(&sAddr, 0, sizeof(sAddr));
+   sAddr.sun_family = AF_UNIX;
+   if (ServerSocketName(sAddr.sun_path, sizeof(sAddr.sun_path)))
+      fd = socket(AF_UNIX, SOCK_STREAM, 0);
+   if (fd >= 0)
+      if (connect(fd, (struct sockaddr *)&sAddr, sizeof(sAddr)))
       {
-         iErr = ERROR_FSPLAYER_X11;
-         strcat(szErr, "XOpenDisplay() failed!");
+         close(fd);
+         fd = -1;
       }
-   }
-   if (!iErr)
+
+   return(fd);
+}
+
+
+
+
+/*
+ *  ServerPeerIsUs
+ *
+ *  Whether the client runs as our own user.  Another one could have
+ *  any file it can't read itself opened by the server.
+ */
+
+int
+ServerPeerIsUs(int fdClient)
+{
+   uid_t          uid = (uid_t)-1;
+#ifdef __FreeBSD__
+   gid_t          gid;
+
+
+   if (getpeereid(fdClient,     &uid, &gid))
+      uid = (uid_t)-1;
+#else
+   socklen_t      iLen = sizeof(struct ucred);
+   struct ucred   cred;
+
+
+   if (!getsockopt(fdClient, SOL_SOCKET, SO_PEERCRED,     &cred, &iLen))
+      uid = cred.uid;
+#endif // __FreeBSD__
+
+   return(uid == getuid());
+}
+
+
+
+
+/*
+ *  ClientPlay
+ *
+ *  Hands the video over to a running "fsplayer --server" and waits for
+ *  the end of the playback.  Returns 0 when it's been played that way,
+ *  with the server's error code in *piPlayErr, or -1 when there's no
+ *  server, in which case it's up to us to play it.
+ */
+
+int
+ClientPlay(const char *szFilename,     int *piPlayErr)
+{
+   int   fd,
+         i = 0,
+         iErr = -1,
+         iRet;
+   char  szPath[PATH_MAX + 1],
+         szReply[LNSZ + 16];
+
+
+   fd = ServerConnect();
+   if (fd >= 0)
    {
-      iX11DefaultScreen = XDefaultScreen(pX11Display);
-      wRoot = XDefaultRootWindow(pX11Display);
-      iX11Black = XBlackPixel(pX11Display, iX11DefaultScreen);
-      XF86VidModeGetModeLine(pX11Display, iX11DefaultScreen,
-                                  &iDotClock, &modeLine);
-      scrx=modeLine.hdisplay;
-      scry=modeLine.vdisplay;
-      if (modeLine.private)
+      // The server has its own working directory
+      if (realpath(szFilename, szPath)
+          && write(fd, szPath, strlen(szPath)) > 0 && write(fd, "\n", 1) > 0)
       {
-         XFree(modeLine.private);
-         modeLine.privsize = 0;
-         modeLine.private = NULL;
+         // The reply is "<error code> <error text>\n", sent at the end
+         do
+         {
+            iRet = read(fd, szReply + i, sizeof(szReply) - 1 - i);
+            if (iRet > 0)
+               i += iRet;
+         }
+         while ((iRet > 0 || (iRet < 0 && errno == EINTR))
+                && i < sizeof(szReply) - 1 && !memchr(szReply, '\n', i));
+         szReply[i] = 0;
+
+         if (sscanf(szReply, "%d", &iErr) == 1)
+         {
+            strtok(szReply, "\n");
+            PrintError(iErr, strchr(szReply, ' ') ? strchr(szReply, ' ') + 1
+                                                  : "");
+            *piPlayErr = iErr;
+            iErr = 0;
+         }
       }
-      printf("X11 Screen Size: %dx%d.\n", scrx, scry);
+      close(fd);
+   }
 
-      XF86VidModeSetViewPort(pX11Display, iX11DefaultScreen, 0, 0);
+   return(iErr);
+}
 
-      // Check if VLC is already running, and if so, stop!
-      //
-      // This check is required because libvlc doesn't provide us
-      // the window-id that it creates.
-      iErr = FindVlcWindow(pX11Display, wRoot,     &wVlc, &wMaster);
-      if (iErr)
-         iErr = 0;   // All good, not supposed to run yet
-      else
-         iErr = ERROR_FSPLAYER_VLCRUN;
 
-#ifdef FSPLAYER_DEBUG
-      printf("TESTRUN FindVlcWindow: root=0x%lX, vlc=0x%lX, master=0x%lX\n",
-             wRoot, wVlc, wMaster);
-#endif // FSPLAYER_DEBUG
+
+
+/*
+ *  ServerRun
+ *
+ *  Keeps the X11 connection, windows and VLC engine warm, and plays the
+ *  videos sent by the clients, one at a time.
+ */
+
+int
+ServerRun(FSPLAYER *pFsp, const FSOPTIONS *pOptions,     char *szErr)
+{
+   int                  fd,
+                        fdClient,
+                        i,
+                        iErr = 0,
+                        iPlayErr,
+                        iRet,
+                        iWoken;
+   char                 szFilename[PATH_MAX + 1],
+                        szPlayErr[LNSZ];
+   struct sockaddr_un   sAddr;
+   struct timeval       tvTimeout;
+   VLCSTARTUP           vlcStartup;
+   XEvent               ev;
+
+
+   // A client whose video gets stopped may not stay to hear about it
+   signal(SIGPIPE, SIG_IGN);
+
+   memset(&sAddr, 0, sizeof(sAddr));
+   sAddr.sun_family = AF_UNIX;
+   fd = -1;
+   if (ServerSocketName(sAddr.sun_path, sizeof(sAddr.sun_path)))
+      fd = socket(AF_UNIX, SOCK_STREAM, 0);
+   if (fd < 0)
+   {
+      iErr = ERROR_FSPLAYER_SOCKET;
+      strcat(szErr, "socket() failed!");
    }
    if (!iErr)
    {
-      // Create the keyboard input/background window
-      memset(&attribSet, 0, sizeof(attribSet));
-      attribSet.background_pixel = iX11Black;
-      attribSet.event_mask = KeyPressMask|ButtonReleaseMask;
-      wInput = XCreateWindow(pX11Display, wRoot, 0, 0, scrx, scry,
-                             0, 0, InputOutput, CopyFromParent,
-                             CWBackPixel|CWEventMask,     &attribSet);
-      if (!wInput)
+      // Only a left over socket file can be removed, not a live server
+      i = ServerConnect();
+      if (i >= 0)
       {
-         iErr = ERROR_FSPLAYER_X11;
-         strcat(szErr, "XCreateWindow(wInput) failed!");
+         close(i);
+         iErr = ERROR_FSPLAYER_SOCKET;
+         strcat(szErr, "An fsplayer server is already running!");
       }
+      else
+         unlink(sAddr.sun_path);
    }
    if (!iErr)
    {
-      aString = XInternAtom(pX11Display, "STRING", False);
-      aWmName = XInternAtom(pX11Display, "WM_NAME", False);
-      if (aString == None || aWmName == None)
+      // /tmp is everyone's, only our user may connect.  Nobody can
+      // before listen().
+      if (bind(fd, (struct sockaddr *)&sAddr, sizeof(sAddr))
+          || chmod(sAddr.sun_path, S_IRUSR|S_IWUSR)
+          || listen(fd, 4))
       {
-         iErr = ERROR_FSPLAYER_X11;
-         strcat(szErr, "XInternAtom() failed!");
+         iErr = ERROR_FSPLAYER_SOCKET;
+         strcat(szErr, "bind() failed!");
       }
+      else
+         printf("fsplayer server listening on %s\n", sAddr.sun_path);
    }
-   if (!iErr)
-   {
-      XChangeProperty(pX11Display, wInput, aWmName, aString, 8,
-                      PropModeReplace, (unsigned char *)FSPLAYER_WMNAME, 8);
 
-      iRet = XMapWindow(pX11Display, wInput);
-#ifdef FSPLAYER_DEBUG
-      printf("%d=XMapWindow(w=0x%lX)\n", iRet, wInput);
-#endif // FSPLAYER_DEBUG
-
-      // Initialize the relevant keycodes
-      kcDown =       XKeysymToKeycode(pX11Display, XK_Down);
-      kcEnd =        XKeysymToKeycode(pX11Display, XK_End);
-      kcEsc =        XKeysymToKeycode(pX11Display, XK_Escape);
-      kcHome =       XKeysymToKeycode(pX11Display, XK_Home);
-      kcKpBegin =    XKeysymToKeycode(pX11Display, XK_KP_Begin);
-      kcKpDown =     XKeysymToKeycode(pX11Display, XK_KP_Down);
-      kcKpEnd =      XKeysymToKeycode(pX11Display, XK_KP_End);
-      kcKpHome =     XKeysymToKeycode(pX11Display, XK_KP_Home);
-      kcKpLeft =     XKeysymToKeycode(pX11Display, XK_KP_Left);
-      kcKpMinus =    XKeysymToKeycode(pX11Display, XK_KP_Subtract);
-      kcKpMult =     XKeysymToKeycode(pX11Display, XK_KP_Multiply);
-      kcKpPageDown = XKeysymToKeycode(pX11Display, XK_KP_Page_Down);
-      kcKpPageUp =   XKeysymToKeycode(pX11Display, XK_KP_Page_Up);
-      kcKpPlus =     XKeysymToKeycode(pX11Display, XK_KP_Add);
-      kcKpRight =    XKeysymToKeycode(pX11Display, XK_KP_Right);
-      kcKpUp =       XKeysymToKeycode(pX11Display, XK_KP_Up);
-      kcLeft =       XKeysymToKeycode(pX11Display, XK_Left);
-      kcPgDown =     XKeysymToKeycode(pX11Display, XK_Page_Down);
-      kcPgUp =       XKeysymToKeycode(pX11Display, XK_Page_Up);
-      kcRight =      XKeysymToKeycode(pX11Display, XK_Right);
-      kcSpace =      XKeysymToKeycode(pX11Display, XK_space);
-      kcUp =         XKeysymToKeycode(pX11Display, XK_Up);
-      if (!(kcDown && kcEnd && kcEsc && kcHome && kcKpBegin && kcKpDown
-            && kcKpEnd && kcKpHome && kcKpLeft && kcKpMinus && kcKpMult
-            && kcKpPageDown && kcKpPageUp && kcKpPlus && kcKpRight
-            && kcKpUp && kcLeft && kcPgDown && kcPgUp && kcRight
-            && kcSpace && kcUp))
-         printf("WARNING: X11 keycodes weren't all found so some video"
-                " browsing features may be missing at this time.\n");
-                                 
-      //Load the VLC engine
-      printf("LibVLC Version %s, %s\n",
-             libvlc_get_version(), libvlc_get_compiler());
-      pVlcInst = libvlc_new(0, NULL);
-      if (!pVlcInst)
+   while (!iErr && !pFsp->reactor.iSignal)
+   {
+      // Nothing to show in between videos, only a signal or a client
+      // are of interest.  The socket is left out while playing, so a
+      // waiting client doesn't keep waking PlayMedia() up.
+      while (XPending(pFsp->pX11Display))
+         XNextEvent(pFsp->pX11Display,     &ev);
+      if (ReactorAdd(&pFsp->reactor, fd, FSPLAYER_R_CLIENT))
       {
-         iErr = ERROR_FSPLAYER_VLC;
-         strcat(szErr, "libvlc_new() failed!");
+         iErr = ERROR_FSPLAYER_REACTOR;
+         strcat(szErr, "epoll_ctl() failed!");
+         continue;
       }
-   }
-   if (!iErr)
-   {
-      /* Create a new item */
-      pVlcMedia = libvlc_media_new_path(pVlcInst, argv[1]);
-      if (pVlcMedia)
+      iWoken = ReactorWait(&pFsp->reactor);
+      ReactorDel(&pFsp->reactor, fd);
+      if (!(iWoken & FSPLAYER_R_CLIENT) || pFsp->reactor.iSignal)
+         continue;
+
+      fdClient = accept(fd, NULL, NULL);
+      if (fdClient < 0)
       {
-         /* Create a media player playing environement */
-         pVlcPlayer = libvlc_media_player_new_from_media(pVlcMedia);
-         if (!pVlcPlayer)
+         if (errno != EINTR && errno != ECONNABORTED && errno != EAGAIN)
          {
-            iErr = ERROR_FSPLAYER_VLC;
-            strcat(szErr, "libvlc_media_player_new_from_media() failed!");
+            iErr = ERROR_FSPLAYER_SOCKET;
+            strcat(szErr, "accept() failed!");
          }
-
-         /* No need to keep the media now */
-         libvlc_media_release(pVlcMedia);
+         continue;
       }
-      else
+
+      if (!ServerPeerIsUs(fdClient))
       {
-         iErr = ERROR_FSPLAYER_VLC;
-         strcat(szErr, "libvlc_media_new_path() failed!");
+         printf("WARNING: A client of another user was turned away.\n");
+         close(fdClient);
+         continue;
       }
-   }
-   if (!iErr)
-   {
-      iPlay = 1;
-      iErr = libvlc_media_player_play(pVlcPlayer);
-      if (iErr)
-         printf("Warning: VLC Play Failed!\n");
-      libvlc_media_player_pause(pVlcPlayer);
-      sleep(1); /* wait until the tracks are created */
-
-#ifdef FSPLAYER_DEBUG
-      printf("0x%X=libvlc_media_player_get_xwindow()\n",
-             libvlc_media_player_get_xwindow(pVlcPlayer));
-#endif // FSPLAYER_DEBUG
 
-      iErr = libvlc_video_get_size(pVlcPlayer, 0,     &vidx, &vidy);
-      if (iErr)
+      // The request is the full path of the video, on one line.  A
+      // client that connects and says nothing mustn't hold the server
+      // and its signals up.
+      tvTimeout.tv_sec = FSPLAYER_CLIENTTIMEOUT / 1000;
+      tvTimeout.tv_usec = (FSPLAYER_CLIENTTIMEOUT % 1000) * 1000;
+      setsockopt(fdClient, SOL_SOCKET, SO_RCVTIMEO, &tvTimeout,
+                 sizeof(tvTimeout));
+      i = 0;
+      do
       {
-         iErr = ERROR_FSPLAYER_VLC;
-         strcat(szErr, "libvlc_video_get_size() didn't find the video!");
+         iRet = read(fdClient, szFilename + i, sizeof(szFilename) - 1 - i);
+         if (iRet > 0)
+            i += iRet;
       }
-   }
-   if (!iErr)
-   {
-      iEndTimeMs = libvlc_media_player_get_length(pVlcPlayer);
-      if (iEndTimeMs <= 0)
+      while ((iRet > 0 || (iRet < 0 && errno == EINTR))
+             && i < sizeof(szFilename) - 1 && !memchr(szFilename, '\n', i));
+      szFilename[i] = 0;
+      strtok(szFilename, "\n");
+
+      *szPlayErr = 0;
+      iPlayErr = 0;
+      if (!FilenameExist(szFilename))
+         iPlayErr = ERROR_FSPLAYER_USAGE;
+      if (!iPlayErr)
       {
-         iErr = ERROR_FSPLAYER_VLC;
-         strcat(szErr, "libvlc_media_player_get_length() failed!");
+         printf("Playing %s\n", szFilename);
+         TimingsReset(&pFsp->timings);
+         memset(&vlcStartup, 0, sizeof(vlcStartup));
+         vlcStartup.szFilename = szFilename;
+         vlcStartup.pState = &pFsp->vlcState;
+         vlcStartup.pTimings = &pFsp->timings;
+         vlcStartup.pVlcInst = pFsp->pVlcInst;
+         vlcStartup.iCacheHit = FsCacheLookup(pFsp->pCache, szFilename,
+                                                     &vlcStartup.info);
+         vlcStartup.iProbed = vlcStartup.iCacheHit;
+         BackgroundShow(pFsp);
+         VlcOpenMedia(&vlcStartup);
+         iPlayErr = vlcStartup.iErr;
+         strcat(szPlayErr, vlcStartup.szErr);
+         if (!iPlayErr)
+            iPlayErr = PlayMedia(pFsp, &vlcStartup, fdClient, NULL,
+                                 szPlayErr);
+         BackgroundHide(pFsp);
+         if (vlcStartup.pVlcMedia)
+            libvlc_media_release(vlcStartup.pVlcMedia);
+         if (pOptions->iTimings)
+            TimingsPrint(&pFsp->timings, "server", vlcStartup.iCacheHit);
       }
+      PrintError(iPlayErr, szPlayErr);
+
+      dprintf(fdClient, "%d %s\n", iPlayErr, szPlayErr);
+      close(fdClient);
    }
-   if (!iErr)
+
+   if (pFsp->reactor.iSignal)
+      printf("Signal %d received, stopping the server.\n",
+             pFsp->reactor.iSignal);
+
+   if (fd >= 0)
    {
-      iNumVlcAudioTracks = libvlc_audio_get_track_count(pVlcPlayer);
-      if (iNumVlcAudioTracks > 1)
-      {
-         pVlcAudioTrackId = malloc(iNumVlcAudioTracks * sizeof(int));
-         if (pVlcAudioTrackId)
-         {
-            memset(pVlcAudioTrackId, 0,
-                   sizeof(iNumVlcAudioTracks * sizeof(int)));
-            pVlcAudioTrackDesc = pVlcATD
-               = libvlc_audio_get_track_description(pVlcPlayer);
-            if (pVlcAudioTrackDesc)
-            {
-               for (iRet = 0 ; pVlcATD && iRet < iNumVlcAudioTracks
-                             ; iRet++)
-               {
-                  printf("Audio track found: %s\n\n", pVlcATD->psz_name);
-                  pVlcAudioTrackId[iRet] = pVlcATD->i_id;
-                  pVlcATD = pVlcATD->p_next;
-               }
-               libvlc_track_description_list_release(pVlcAudioTrackDesc);
-            }
-         }
-         else
-            iErr = ERROR_FSPLAYER_MEM;
-      }
+      close(fd);
+      if (iErr != ERROR_FSPLAYER_SOCKET)
+         unlink(sAddr.sun_path);
    }
-   if (!iErr)
-   {      
-      printf("Video %dx%d, length: %li sec., %d audio tracks.\n",
-             vidx, vidy, iEndTimeMs/1000, iNumVlcAudioTracks);
-      iErr = FindVlcWindow(pX11Display, wRoot,     &wVlc, &wMaster);
-#ifdef FSPLAYER_DEBUG
-      printf("FindVlcWindow: root=0x%lX, vlc=0x%lX, master=0x%lX\n",
-             wRoot, wVlc, wMaster);
 
-      // A stop here in Debian to check what libvlc has launched
-      //gets(szErr);
-#endif // FSPLAYER_DEBUG
-   }
-   if (!iErr)
-   {
-      FindMaster(pX11Display, wInput,     &wInputMaster);
-      
-      if (vidx >= scrx || vidy >= scry)
-         SetWindowFullscreen(pX11Display, wVlc, wMaster, wRoot, scrx, scry);
-      else
-      {
-         SetWindowFullscreen(pX11Display, wInput, wInputMaster, wRoot,
-                             scrx, scry);
+   return(iErr);
+}
 
-         // Test for VLC's fullscreen feature.  It dosen't work on all
-         // X11 window managers (i.e. old ones) for libvlc v3.0.6.
-         //
-         //libvlc_set_fullscreen(pVlcPlayer, 1);
 
-         PositionWindow(pX11Display, wMaster, 5 /* center */, scrx, scry);
-      }
-      TaskbarFindAndUnmap(pX11Display, wRoot,     &wTaskbar);
 
-      // Play the media_player
-      libvlc_media_player_set_time(pVlcPlayer, 0);
-      iErr = libvlc_media_player_play(pVlcPlayer);
-      if (iErr)
+
+/*
+ *  main
+ */
+
+int
+main(int argc, char* argv[])
+{
+   int                        i,
+                              iErr = 0,
+                              iPlayed = 0,
+                              iPlayErr = 0,
+                              iStartupThread = 0;
+   char                       szErr[LNSZ];
+   pthread_t                  startupThread,
+                              teardownThread;
+   sigset_t                   signals;
+   FSOPTIONS                  options;
+   FSPLAYER                   fsp;
+   VLCSTARTUP                 vlcStartup;
+   VLCTEARDOWN                vlcTeardown;
+
+ 
+   *szErr = 0;
+   memset(&fsp, 0, sizeof(fsp));
+   TimingsReset(&fsp.timings);
+   VlcStateInit(&fsp.vlcState);
+   memset(&vlcStartup, 0, sizeof(vlcStartup));
+   vlcStartup.pState = &fsp.vlcState;
+   vlcStartup.pTimings = &fsp.timings;
+   memset(&vlcTeardown, 0, sizeof(vlcTeardown));
+   vlcTeardown.pState = &fsp.vlcState;
+   fsp.reactor.fdEpoll = fsp.reactor.fdEvent = -1;
+   fsp.reactor.fdSignal = fsp.reactor.fdTimer = -1;
+   memset(&options, 0, sizeof(options));
+   ConfigRead(&options);
+
+   for (i = 1 ; i < argc && !iErr ; i++)
+   {
+      if (!strcmp(argv[i], "--server"))
+         options.iServer = 1;
+      else if (!strcmp(argv[i], "--bench-startup"))
+         options.iBenchStartup = 1;
+      else if (!strcmp(argv[i], "--timings"))
+         options.iTimings = 1;
+      else if (!strcmp(argv[i], "--profile=default"))
+         options.iProfile = FSPLAYER_PROFILE_DEFAULT;
+      else if (!strcmp(argv[i], "--profile=tuned"))
+         options.iProfile = FSPLAYER_PROFILE_TUNED;
+      else if (!strcmp(argv[i], "--render=vout"))
+         options.iRender = FSPLAYER_RENDER_VOUT;
+      else if (!strcmp(argv[i], "--render=shm"))
+         options.iRender = FSPLAYER_RENDER_SHM;
+      else if (!strcmp(argv[i], "--hugepages=no"))
+         options.iPages = FSFRAME_PAGES_SMALL;
+      else if (!strcmp(argv[i], "--hugepages=thp"))
+         options.iPages = FSFRAME_PAGES_THP;
+      else if (!strcmp(argv[i], "--hugepages=hugetlb"))
+         options.iPages = FSFRAME_PAGES_HUGETLB;
+      else if (*argv[i] != '-' && !options.szFilename)
+         options.szFilename = argv[i];
+      else
+         iErr = ERROR_FSPLAYER_USAGE;
+   }
+   if (!iErr)
+   {
+      if (options.iBenchStartup)
       {
-         iErr = ERROR_FSPLAYER_VLC;
-         strcat(szErr, "libvlc_media_player_play() failed!");
+         BenchStartup(&options);
+         iPlayed = 1;
       }
+      else if (options.iServer == !!options.szFilename)
+         iErr = ERROR_FSPLAYER_USAGE;
+      else if (!options.iServer && !FilenameExist(options.szFilename))
+         iErr = ERROR_FSPLAYER_USAGE;
    }
-
-   //
-   // X11 Event Loop
-   //
-   iX11fd = ConnectionNumber(pX11Display);
-   FD_ZERO(&readfds);
-   FD_SET(iX11fd, &readfds);
-   while (iRunning && !iErr)
+   TimingMark(&fsp.timings, FSPLAYER_T_ARGS);
+   if (!iErr && !iPlayed && !options.iServer)
    {
-      sEventLoopTimeout.tv_usec = 400000; // maximum sleep of 0.4 second
-      sEventLoopTimeout.tv_sec = 1;
-      select(iX11fd + 1, &readfds, 0, 0, &sEventLoopTimeout);
-
-      while (XPending(pX11Display))
+      // With a server already warmed up, there's nothing left to do
+      iPlayed = !ClientPlay(options.szFilename,     &iPlayErr);
+   }
+   if (!iErr && !iPlayed)
+   {
+      // The signals are handled by the event loop through a signalfd,
+      // blocked before any thread is created so libvlc's inherit it
+      sigemptyset(&signals);
+      sigaddset(&signals, SIGHUP);
+      sigaddset(&signals, SIGINT);
+      sigaddset(&signals, SIGTERM);
+      sigaddset(&signals, SIGUSR1);
+      pthread_sigmask(SIG_BLOCK, &signals, NULL);
+
+      // libvlc's video outputs and --render=shm's use Xlib from their
+      // own threads
+      if (!XInitThreads())
+         printf("WARNING: Xlib has no thread support, the video output"
+                " may misbehave.\n");
+
+      // A video played before doesn't need to be probed again
+      fsp.pCache = FsCacheOpen();
+      if (!options.iServer)
       {
-         loopEvent.type = 0;
-         XNextEvent(pX11Display,     &loopEvent);
-         if (loopEvent.type == KeyPress)
-         {
-            if (kcDown && loopEvent.xkey.keycode == kcDown)
-            {
-               iTimeMs = libvlc_media_player_get_time(pVlcPlayer);
-               if (iTimeMs <= FSPLAYER_1MIN)
-                  iTimeMs = 0;
-               else
-                  iTimeMs -= FSPLAYER_1MIN;
-               libvlc_media_player_set_time(pVlcPlayer, iTimeMs);
-            }
-            else if (kcEnd && loopEvent.xkey.keycode == kcEnd)
-            {
-               iTimeMs = iEndTimeMs - FSPLAYER_10SEC;
-               libvlc_media_player_set_time(pVlcPlayer, iTimeMs);
-            }
-            else if (kcEsc && loopEvent.xkey.keycode == kcEsc)
-            {
-               iRunning = 0;
-#ifdef FSPLAYER_DEBUG
-               printf("Final time: %ld, IsPlaying:%d, State:%d\n",
-                      libvlc_media_player_get_time(pVlcPlayer),
-                      libvlc_media_player_is_playing(pVlcPlayer),
-                      libvlc_media_player_get_state(pVlcPlayer));
-#endif // FSPLAYER_DEBUG
-            }
-            else if (kcHome && loopEvent.xkey.keycode == kcHome)
-            {
-               iTimeMs = 0;
-               libvlc_media_player_set_time(pVlcPlayer, iTimeMs);
-            }
-            else if (kcKpBegin && loopEvent.xkey.keycode == kcKpBegin)
-               PositionWindow(pX11Display, wMaster, 5, scrx, scry);
-            else if (kcKpDown && loopEvent.xkey.keycode == kcKpDown)
-               PositionWindow(pX11Display, wMaster, 2, scrx, scry);
-            else if (kcKpEnd && loopEvent.xkey.keycode == kcKpEnd)
-               PositionWindow(pX11Display, wMaster, 1, scrx, scry);
-            else if (kcKpHome && loopEvent.xkey.keycode == kcKpHome)
-               PositionWindow(pX11Display, wMaster, 7, scrx, scry);
-            else if (kcKpLeft && loopEvent.xkey.keycode == kcKpLeft)
-               PositionWindow(pX11Display, wMaster, 4, scrx, scry);
-            else if (kcKpMinus && loopEvent.xkey.keycode == kcKpMinus)
-            {
-               iRet = libvlc_audio_get_volume(pVlcPlayer) - 10;
-               if (iRet < 0)
-                  iRet = 0;
-               libvlc_audio_set_volume(pVlcPlayer, iRet);
-            }
-            else if (kcKpMult && loopEvent.xkey.keycode == kcKpMult
-                     && iNumVlcAudioTracks > 1)
-            {
-               iVlcAudioTrack++;
-               if (iVlcAudioTrack == iNumVlcAudioTracks)
-                  iVlcAudioTrack = 0;
-               libvlc_audio_set_track(pVlcPlayer,
-                                      pVlcAudioTrackId[iVlcAudioTrack]);
-            }
-            else if (kcKpPageDown && loopEvent.xkey.keycode == kcKpPageDown)
-               PositionWindow(pX11Display, wMaster, 3, scrx, scry);
-            else if (kcKpPageUp && loopEvent.xkey.keycode == kcKpPageUp)
-               PositionWindow(pX11Display, wMaster, 9, scrx, scry);
-            else if (kcKpPlus && loopEvent.xkey.keycode == kcKpPlus)
-            {
-               iRet = libvlc_audio_get_volume(pVlcPlayer) + 10;
-               if (iRet > 100)
-                  iRet = 100;
-               libvlc_audio_set_volume(pVlcPlayer, iRet);
-            }
-            else if (kcKpRight && loopEvent.xkey.keycode == kcKpRight)
-               PositionWindow(pX11Display, wMaster, 6, scrx, scry);
-            else if (kcKpUp && loopEvent.xkey.keycode == kcKpUp)
-               PositionWindow(pX11Display, wMaster, 8, scrx, scry);
-            else if (kcLeft && loopEvent.xkey.keycode == kcLeft)
-            {
-               iTimeMs = libvlc_media_player_get_time(pVlcPlayer);
-               if (iTimeMs <= FSPLAYER_10SEC)
-                  iTimeMs = 0;
-               else
-                  iTimeMs -= FSPLAYER_10SEC;
-               libvlc_media_player_set_time(pVlcPlayer, iTimeMs);
-            }
-            else if (kcPgDown && loopEvent.xkey.keycode == kcPgDown)
-            {
-               iTimeMs = libvlc_media_player_get_time(pVlcPlayer);
-               if (iTimeMs <= FSPLAYER_10MIN)
-                  iTimeMs = 0;
-               else
-                  iTimeMs -= FSPLAYER_10MIN;
-               libvlc_media_player_set_time(pVlcPlayer, iTimeMs);
-            }
-            else if (kcPgUp && loopEvent.xkey.keycode == kcPgUp)
-            {
-               iTimeMs = libvlc_media_player_get_time(pVlcPlayer);
-               if (iTimeMs < iEndTimeMs - FSPLAYER_10SEC)
-               {
-                  if (iTimeMs < iEndTimeMs - FSPLAYER_10MIN)
-                     iTimeMs += FSPLAYER_10MIN;
-                  else
-                     iTimeMs = iEndTimeMs - FSPLAYER_10SEC;
-                  libvlc_media_player_set_time(pVlcPlayer, iTimeMs);
-               }
-            }
-            else if (kcRight && loopEvent.xkey.keycode == kcRight)
-            {
-               iTimeMs = libvlc_media_player_get_time(pVlcPlayer)
-                         + FSPLAYER_10SEC;
-               if (iTimeMs < iEndTimeMs)
-                  libvlc_media_player_set_time(pVlcPlayer, iTimeMs);
-            }
-            else if (kcSpace && loopEvent.xkey.keycode == kcSpace)
-               libvlc_media_player_pause(pVlcPlayer);
-            else if (kcUp && loopEvent.xkey.keycode == kcUp)
-            {
-               iTimeMs = libvlc_media_player_get_time(pVlcPlayer);
-               if (iTimeMs < iEndTimeMs - FSPLAYER_10SEC)
-               {
-                  if (iTimeMs < iEndTimeMs - FSPLAYER_1MIN)
-                     iTimeMs += FSPLAYER_1MIN;
-                  else
-                     iTimeMs = iEndTimeMs - FSPLAYER_10SEC;
-                  libvlc_media_player_set_time(pVlcPlayer, iTimeMs);
-               }
-            }
-
+         vlcStartup.szFilename = options.szFilename;
+         vlcStartup.iCacheHit = FsCacheLookup(fsp.pCache,
+                                              options.szFilename,
+                                                     &vlcStartup.info);
+         vlcStartup.iProbed = vlcStartup.iCacheHit;
 #ifdef FSPLAYER_DEBUG
-            else
-               printf("KeySym=0x%lX\n", XKeycodeToKeysym(pX11Display,
-                                          loopEvent.xkey.keycode, 0));
+         printf("%d=FsCacheLookup()\n", vlcStartup.iCacheHit);
 #endif // FSPLAYER_DEBUG
-         }
-         else if (loopEvent.type == ButtonRelease)
-         {
-            XRaiseWindow(pX11Display, wMaster);
-            XSetInputFocus(pX11Display, wInput, RevertToNone, 0);
-         }
       }
 
-      if (iRunning)
-      {
-         if (libvlc_media_player_get_state(pVlcPlayer) >= libvlc_Stopped)
-            iRunning = 0;
-      }
-      if (iRunning)
-      {
-         iTimeMs = libvlc_media_player_get_time(pVlcPlayer);
-         if (iTimeMs < 0)
-         {
-            iErr = ERROR_FSPLAYER_VLC;
-            strcat(szErr, "libvlc_media_player_get_time() failed!");
-         }
-         if (!iErr)
-         {
-            if (iTimeMs >= iEndTimeMs)
-               iRunning = 0;
-         }
-      }      
-      if (iRunning)
+      // Load the VLC engine in the background, running it here
+      // instead if the thread can't be created
+      VlcArgsBuild(options.iProfile, &options,     &vlcStartup.vlcArgs);
+      iStartupThread = !pthread_create(&startupThread, NULL,
+                                       VlcStartupThread, &vlcStartup);
+      if (!iStartupThread)
+         VlcStartupThread(&vlcStartup);
+
+      iErr = X11Open(&fsp,     szErr);
+      if (!iErr && options.iRender == FSPLAYER_RENDER_SHM)
       {
-         XGetInputFocus(pX11Display,     &w, &iRet);
-         if (w == wVlc || w == wMaster)
-         {
-            XRaiseWindow(pX11Display, wInputMaster);
-            XRaiseWindow(pX11Display, wMaster);
-            XSetInputFocus(pX11Display, wInput, RevertToNone, 0);
-         }
+         fsp.pShm = FsShmOpen(fsp.pX11Display, fsp.wVideo, fsp.scrx,
+                              fsp.scry, options.iPages);
+         if (!fsp.pShm)
+            printf("WARNING: No MIT-SHM rendering on this display,"
+                   " libvlc draws the video instead.\n");
       }
-   }
-
-   /* Stop playing */
-   if (iPlay)
-      libvlc_media_player_stop(pVlcPlayer);
+      if (!iErr)
+         iErr = ReactorOpen(&fsp.reactor, ConnectionNumber(fsp.pX11Display),
+                            &signals, &fsp.vlcState,     szErr);
 
-   TaskbarRaise(pX11Display, wTaskbar);
-
-   switch (iErr)
-   {
-      case ERROR_FSPLAYER_USAGE:
-         printf("USAGE: fsplayer <filename>\n");
-         break;
+      // The black background goes fullscreen while the VLC engine loads
+      if (!iErr && !options.iServer)
+         BackgroundShow(&fsp);
 
-      case ERROR_FSPLAYER_X11:
-         printf("X11 ERROR: %s\n", szErr);
-         break;
+      printf("LibVLC Version %s, %s\n",
+             libvlc_get_version(), libvlc_get_compiler());
 
-      case ERROR_FSPLAYER_VLC:
-         printf("VLC ERROR: %s\n", szErr);
-         break;
-   
-      case ERROR_FSPLAYER_FAIL:
-         printf("ERROR: LibVLC's Video Window Not Found!\n");
-         break;
-   
-      case ERROR_FSPLAYER_MEM:
-         printf("ERROR: Out Of Memory!\n");
-         break;
-   
-      case ERROR_FSPLAYER_VLCRUN:
-         printf("ERROR: VLC Already Running!\n");
-         break;
+      // The VLC engine is needed from now on, wait for it
+      if (iStartupThread)
+         pthread_join(startupThread, NULL);
+      fsp.pVlcInst = vlcStartup.pVlcInst;
+      if (!iErr && vlcStartup.iErr)
+      {
+         iErr = vlcStartup.iErr;
+         strcat(szErr, vlcStartup.szErr);
+      }
    }
- 
-   if (pVlcPlayer)
+   if (!iErr && !iPlayed)
    {
-#ifdef FSPLAYER_DEBUG
-      printf("libvlc_media_player_release()\n");
-#endif // FSPLAYER_DEBUG
-      libvlc_media_player_release(pVlcPlayer);
+      if (options.iServer)
+         iErr = ServerRun(&fsp, &options,     szErr);
+      else
+         iErr = PlayMedia(&fsp, &vlcStartup, -1, &vlcTeardown, szErr);
    }
+   if (fsp.wInput)
+      BackgroundHide(&fsp);
 
-   if (pVlcInst)
+   PrintError(iErr, szErr);
+
+   // libvlc is released in the background, with a bounded wait since
+   // fsplayer is already gone from the screen
+   vlcTeardown.pVlcInst = fsp.pVlcInst;
+   vlcTeardown.pVlcMedia = vlcStartup.pVlcMedia;
+   if (vlcTeardown.pVlcInst || vlcTeardown.pVlcMedia
+       || vlcTeardown.pVlcPlayer)
    {
-#ifdef FSPLAYER_DEBUG
-      printf("libvlc_release()\n");
-#endif // FSPLAYER_DEBUG
-      libvlc_release(pVlcInst);
+      if (!pthread_create(&teardownThread, NULL, VlcTeardownThread,
+                          &vlcTeardown))
+      {
+         pthread_detach(teardownThread);
+         fsp.timings.t[FSPLAYER_T_RELEASED]
+            = VlcWaitReleased(&fsp.vlcState, FSPLAYER_EXITTIMEOUT);
+      }
+      else
+      {
+         VlcTeardownThread(&vlcTeardown);
+         fsp.timings.t[FSPLAYER_T_RELEASED] = fsp.vlcState.tReleased;
+      }
    }
 
-   if (pVlcAudioTrackId)
-      free(pVlcAudioTrackId);
+   if (options.iTimings && !iPlayed && !options.iServer)
+      TimingsPrint(&fsp.timings, "standalone", vlcStartup.iCacheHit);
 
-   if (wInput)
+   if ((fsp.pVlcInst && !fsp.timings.t[FSPLAYER_T_RELEASED])
+       || ControlLeftBehind(&fsp.control))
    {
-#ifdef FSPLAYER_DEBUG
-      printf("XDestroyWindow(0x%lX)\n", wInput);
-#endif // FSPLAYER_DEBUG
-      XDestroyWindow(pX11Display, wInput);
+      // Nothing worth waiting for is left, the cache is already on disk
+      // and the X server cleans up after a closed connection
+      printf("WARNING: libvlc still busy after %d ms, leaving it behind.\n",
+             FSPLAYER_EXITTIMEOUT);
+      fflush(NULL);
+      _exit(iErr);
    }
 
-   if (pX11Display)
-   {
-#ifdef FSPLAYER_DEBUG
-      printf("XCloseDisplay()\n");
-#endif // FSPLAYER_DEBUG
-      XCloseDisplay(pX11Display);
-   }
+   FsCacheClose(fsp.pCache);
+   ReactorClose(&fsp.reactor, &fsp.vlcState);
+   FsShmClose(fsp.pShm);
+   X11Close(&fsp);
+   VlcStateFree(&fsp.vlcState);
 
-   return(0);
+   // The exit status is the error code, the server's one for a client
+   return(iErr ? iErr : iPlayErr);
 }
@@ -0,0 +1,284 @@
+/*
+ * File:        fspool.c
+ *
+ * Author:      fossette
+ *
+ * Description: Persistent worker threads for slices of a frame.  The
+ *              threads are created once, each pinned to its own core,
+ *              and then sleep on a barrier until FsPoolRun() has work
+ *              for them.  The calling thread does the first slice
+ *              itself and a second barrier tells it when every slice
+ *              is done, so running a frame creates no thread and takes
+ *              no lock besides the two barriers.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS''
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef __FreeBSD__
+#define _GNU_SOURCE
+#endif // __FreeBSD__
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <unistd.h>
+#ifdef __FreeBSD__
+#include <pthread_np.h>
+#include <sys/cpuset.h>
+#else
+#include <sched.h>
+#endif // __FreeBSD__
+#include "fspool.h"
+
+
+
+
+/*
+ *  Types
+ */
+
+typedef struct
+{
+   FSPOOL            *pPool;
+   unsigned int      iSlice;
+   pthread_t         thread;
+} FSPOOLWORKER;
+
+struct FsPool
+{
+   int               nThreads,      // The caller's included
+                     nStarted,
+                     iReady,        // Every worker was created
+                     iQuit;
+   pthread_mutex_t   mutex;         // Only for iReady
+   pthread_cond_t    ready;
+   pthread_barrier_t start,
+                     done;
+   FSPOOLJOB         pfnJob;
+   void              *pArg;
+   FSPOOLWORKER      aWorkers[FSPOOL_MAXTHREADS];
+};
+
+#ifdef __FreeBSD__
+typedef cpuset_t     cpu_set_t;
+#endif // __FreeBSD__
+
+
+
+
+/*
+ *  FsPoolPin
+ *
+ *  Keeps a worker on one core, so its slice's cache lines stay there.
+ *  Not being able to is harmless.
+ */
+
+void
+FsPoolPin(pthread_t thread, int iCpu)
+{
+   cpu_set_t   cpus;
+
+
+   CPU_ZERO(&cpus);
+   CPU_SET(iCpu, &cpus);
+   pthread_setaffinity_np(thread, sizeof(cpus), &cpus);
+}
+
+
+
+
+/*
+ *  FsPoolWorker
+ *
+ *  iQuit is only read past the start barrier, FsPoolClose() sets it
+ *  right before waiting there, and every worker must get there too.
+ */
+
+void *
+FsPoolWorker(void *pArg)
+{
+   int            iQuit;
+   FSPOOLWORKER   *pWorker = (FSPOOLWORKER *)pArg;
+   FSPOOL         *pPool = pWorker->pPool;
+
+
+   // Until then, the barriers may never be complete
+   pthread_mutex_lock(&pPool->mutex);
+   while (!pPool->iReady)
+      pthread_cond_wait(&pPool->ready, &pPool->mutex);
+   iQuit = pPool->iQuit;
+   pthread_mutex_unlock(&pPool->mutex);
+
+   while (!iQuit)
+   {
+      pthread_barrier_wait(&pPool->start);
+      iQuit = pPool->iQuit;
+      if (!iQuit)
+      {
+         pPool->pfnJob(pPool->pArg, pWorker->iSlice, pPool->nThreads);
+         pthread_barrier_wait(&pPool->done);
+      }
+   }
+
+   return(NULL);
+}
+
+
+
+
+/*
+ *  FsPoolOpen
+ *
+ *  nThreads counts the caller, 0 for as many as there are cores.
+ *  Returns NULL when one thread is all there is, FsPoolRun() then
+ *  runs the whole frame in the caller.
+ */
+
+FSPOOL *
+FsPoolOpen(int nThreads)
+{
+   int      i,
+            iErr = 0,
+            nCpus;
+   FSPOOL   *pPool = NULL;
+
+
+   nCpus = sysconf(_SC_NPROCESSORS_ONLN);
+   if (nCpus < 1)
+      nCpus = 1;
+   if (nThreads <= 0)
+      nThreads = nCpus;
+   if (nThreads > FSPOOL_MAXTHREADS)
+      nThreads = FSPOOL_MAXTHREADS;
+
+   if (nThreads > 1)
+      pPool = calloc(1, sizeof(FSPOOL));
+   if (pPool)
+   {
+      pPool->nThreads = nThreads;
+      pthread_mutex_init(&pPool->mutex, NULL);
+      pthread_cond_init(&pPool->ready, NULL);
+      if (pthread_barrier_init(&pPool->start, NULL, nThreads))
+         iErr = 1;
+      else if (pthread_barrier_init(&pPool->done, NULL, nThreads))
+      {
+         pthread_barrier_destroy(&pPool->start);
+         iErr = 1;
+      }
+      if (iErr)
+      {
+         pthread_cond_destroy(&pPool->ready);
+         pthread_mutex_destroy(&pPool->mutex);
+         free(pPool);
+         pPool = NULL;
+      }
+   }
+   if (pPool)
+   {
+      // Slice 0 is the caller's, on whatever core it's on
+      for (i = 1 ; i < nThreads && !iErr ; i++)
+      {
+         pPool->aWorkers[i].pPool = pPool;
+         pPool->aWorkers[i].iSlice = i;
+         if (pthread_create(&pPool->aWorkers[i].thread, NULL, FsPoolWorker,
+                            pPool->aWorkers + i))
+            iErr = 1;
+         else
+         {
+            pPool->nStarted++;
+            FsPoolPin(pPool->aWorkers[i].thread, i % nCpus);
+         }
+      }
+
+      // Short of threads, the ones started leave at once
+      pthread_mutex_lock(&pPool->mutex);
+      pPool->iQuit = iErr;
+      pPool->iReady = 1;
+      pthread_cond_broadcast(&pPool->ready);
+      pthread_mutex_unlock(&pPool->mutex);
+      if (iErr)
+      {
+         FsPoolClose(pPool);
+         pPool = NULL;
+      }
+   }
+
+   return(pPool);
+}
+
+
+
+
+/*
+ *  FsPoolClose
+ */
+
+void
+FsPoolClose(FSPOOL *pPool)
+{
+   int   i;
+
+
+   if (pPool)
+   {
+      if (!pPool->iQuit)
+      {
+         pPool->iQuit = 1;
+         pthread_barrier_wait(&pPool->start);
+      }
+      for (i = 1 ; i <= pPool->nStarted ; i++)
+         pthread_join(pPool->aWorkers[i].thread, NULL);
+      pthread_barrier_destroy(&pPool->start);
+      pthread_barrier_destroy(&pPool->done);
+      pthread_cond_destroy(&pPool->ready);
+      pthread_mutex_destroy(&pPool->mutex);
+      free(pPool);
+   }
+}
+
+
+
+
+/*
+ *  FsPoolThreads
+ */
+
+int
+FsPoolThreads(const FSPOOL *pPool)
+{
+   return(pPool ? pPool->nThreads : 1);
+}
+
+
+
+
+/*
+ *  FsPoolRun
+ *
+ *  Runs pfnJob on every slice and returns once they're all done.
+ */
+
+void
+FsPoolRun(FSPOOL *pPool, FSPOOLJOB pfnJob, void *pArg)
+{
+   if (!pPool)
+      pfnJob(pArg, 0, 1);
+   else
+   {
+      pPool->pfnJob = pfnJob;
+      pPool->pArg = pArg;
+      pthread_barrier_wait(&pPool->start);
+      pfnJob(pArg, 0, pPool->nThreads);
+      pthread_barrier_wait(&pPool->done);
+   }
+}
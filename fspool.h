@@ -0,0 +1,48 @@
+/*
+ * File:        fspool.h
+ *
+ * Author:      fossette
+ *
+ * Description: Persistent worker threads for slices of a frame, see
+ *              fspool.c.
+ *
+ */
+
+#ifndef FSPOOL_H
+#define FSPOOL_H
+
+
+
+
+/*
+ *  Constants
+ */
+
+#define FSPOOL_MAXTHREADS        64
+
+
+
+
+/*
+ *  Types
+ */
+
+// Does slice iSlice out of nSlices of a frame's work
+typedef void (*FSPOOLJOB)(void *pArg, unsigned int iSlice,
+                          unsigned int nSlices);
+
+typedef struct FsPool FSPOOL;
+
+
+
+
+/*
+ *  Prototypes
+ */
+
+FSPOOL *FsPoolOpen(int nThreads);
+void    FsPoolClose(FSPOOL *pPool);
+int     FsPoolThreads(const FSPOOL *pPool);
+void    FsPoolRun(FSPOOL *pPool, FSPOOLJOB pfnJob, void *pArg);
+
+#endif // FSPOOL_H
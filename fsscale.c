@@ -0,0 +1,223 @@
+/*
+ * File:        fsscale.c
+ *
+ * Author:      fossette
+ *
+ * Description: Halves 8 bits planes with a 2x2 average, for fsshm.c to
+ *              shrink a video exactly twice the size that fits the
+ *              screen, 4K on a 1080p screen, before it's converted to
+ *              BGRA and sent to the X server.  That costs less than
+ *              converting the whole frame, bench/yuvbench shows.  libvlc
+ *              scales to any other size.
+ *              The SSE2 and AVX2 kernels compute the same integer sums
+ *              as the scalar one, so their output is bit exact, which
+ *              bench/yuvbench checks.  The kernels are picked as in
+ *              fsyuv.c.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS''
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include "fsscale.h"
+#include "fsyuv.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define FSSCALE_X86              1
+#include <immintrin.h>
+#endif // __x86_64__ || __i386__
+
+
+
+
+/*
+ *  FsScaleHalfRow
+ *
+ *  The reference 2x2 average, from output x to dstw.
+ */
+
+void
+FsScaleHalfRow(const uint8_t *pSrc0, const uint8_t *pSrc1, uint8_t *pDst,
+               unsigned int x, unsigned int dstw)
+{
+   for ( ; x < dstw ; x++)
+      pDst[x] = (pSrc0[x * 2] + pSrc0[x * 2 + 1] + pSrc1[x * 2]
+                 + pSrc1[x * 2 + 1] + 2) >> 2;
+}
+
+
+
+
+#ifdef FSSCALE_X86
+/*
+ *  FsScaleHalfRowSse2
+ */
+
+__attribute__((target("sse2")))
+void
+FsScaleHalfRowSse2(const uint8_t *pSrc0, const uint8_t *pSrc1,
+                   uint8_t *pDst, unsigned int dstw)
+{
+   unsigned int   i,
+                  x;
+   __m128i        a,
+                  b,
+                  lo = _mm_set1_epi16(0xFF),
+                  sum[2],
+                  two = _mm_set1_epi16(2);
+
+
+   for (x = 0 ; x + 16 <= dstw ; x += 16)
+   {
+      for (i = 0 ; i < 2 ; i++)
+      {
+         a = _mm_loadu_si128((const __m128i *)(pSrc0 + x * 2 + i * 16));
+         b = _mm_loadu_si128((const __m128i *)(pSrc1 + x * 2 + i * 16));
+         sum[i] = _mm_add_epi16(_mm_add_epi16(_mm_and_si128(a, lo),
+                                              _mm_srli_epi16(a, 8)),
+                                _mm_add_epi16(_mm_and_si128(b, lo),
+                                              _mm_srli_epi16(b, 8)));
+         sum[i] = _mm_srli_epi16(_mm_add_epi16(sum[i], two), 2);
+      }
+      _mm_storeu_si128((__m128i *)(pDst + x),
+                       _mm_packus_epi16(sum[0], sum[1]));
+   }
+   FsScaleHalfRow(pSrc0, pSrc1, pDst, x, dstw);
+}
+
+
+
+
+/*
+ *  FsScaleHalfRowAvx2
+ *
+ *  The packs work within each 128 bits lane, the final permute puts
+ *  the outputs back in order.
+ */
+
+__attribute__((target("avx2")))
+void
+FsScaleHalfRowAvx2(const uint8_t *pSrc0, const uint8_t *pSrc1,
+                   uint8_t *pDst, unsigned int dstw)
+{
+   unsigned int   i,
+                  x;
+   __m256i        a,
+                  b,
+                  lo = _mm256_set1_epi16(0xFF),
+                  sum[2],
+                  two = _mm256_set1_epi16(2);
+
+
+   for (x = 0 ; x + 32 <= dstw ; x += 32)
+   {
+      for (i = 0 ; i < 2 ; i++)
+      {
+         a = _mm256_loadu_si256((const __m256i *)(pSrc0 + x * 2 + i * 32));
+         b = _mm256_loadu_si256((const __m256i *)(pSrc1 + x * 2 + i * 32));
+         sum[i] = _mm256_add_epi16(
+                     _mm256_add_epi16(_mm256_and_si256(a, lo),
+                                      _mm256_srli_epi16(a, 8)),
+                     _mm256_add_epi16(_mm256_and_si256(b, lo),
+                                      _mm256_srli_epi16(b, 8)));
+         sum[i] = _mm256_srli_epi16(_mm256_add_epi16(sum[i], two), 2);
+      }
+      _mm256_storeu_si256((__m256i *)(pDst + x), _mm256_permute4x64_epi64(
+                             _mm256_packus_epi16(sum[0], sum[1]), 0xD8));
+   }
+   FsScaleHalfRow(pSrc0, pSrc1, pDst, x, dstw);
+}
+#endif // FSSCALE_X86
+
+
+
+
+/*
+ *  FsScaleInit
+ *
+ *  Halves srcw by srch, an odd last column or row is left out.  iKernel
+ *  is one of fsyuv.h's, the SSSE3 one being the SSE2 one here.  Returns
+ *  1 when unable to.
+ */
+
+int
+FsScaleInit(unsigned int srcw, unsigned int srch, int iKernel,
+                                                  FSSCALE *pScale)
+{
+   int   iErr = 0;
+
+
+   memset(pScale, 0, sizeof(FSSCALE));
+   if (srcw < 2 || srch < 2 || iKernel > FsYuvBestKernel())
+      iErr = 1;
+   else
+   {
+      pScale->dstw = srcw / 2;
+      pScale->dsth = srch / 2;
+      pScale->iKernel = iKernel;
+   }
+
+   return(iErr);
+}
+
+
+
+
+/*
+ *  FsScaleSlice
+ *
+ *  Halves into output rows dsth * iSlice / nSlices up to the next
+ *  slice's.
+ */
+
+void
+FsScaleSlice(const FSSCALE *pScale, const uint8_t *pSrc,
+             unsigned int iSrcPitch, uint8_t *pDst, unsigned int iDstPitch,
+             unsigned int iSlice, unsigned int nSlices)
+{
+   unsigned int   y,
+                  yEnd;
+   const uint8_t  *pIn;
+
+
+   y = pScale->dsth * iSlice / nSlices;
+   yEnd = pScale->dsth * (iSlice + 1) / nSlices;
+   pDst += y * iDstPitch;
+   for ( ; y < yEnd ; y++, pDst += iDstPitch)
+   {
+      pIn = pSrc + y * 2 * iSrcPitch;
+#ifdef FSSCALE_X86
+      if (pScale->iKernel >= FSYUV_AVX2)
+         FsScaleHalfRowAvx2(pIn, pIn + iSrcPitch, pDst, pScale->dstw);
+      else if (pScale->iKernel >= FSYUV_SSE2)
+         FsScaleHalfRowSse2(pIn, pIn + iSrcPitch, pDst, pScale->dstw);
+      else
+#endif // FSSCALE_X86
+         FsScaleHalfRow(pIn, pIn + iSrcPitch, pDst, 0, pScale->dstw);
+   }
+}
+
+
+
+
+/*
+ *  FsScalePlane
+ */
+
+void
+FsScalePlane(const FSSCALE *pScale, const uint8_t *pSrc,
+             unsigned int iSrcPitch, uint8_t *pDst, unsigned int iDstPitch)
+{
+   FsScaleSlice(pScale, pSrc, iSrcPitch, pDst, iDstPitch, 0, 1);
+}
@@ -0,0 +1,47 @@
+/*
+ * File:        fsscale.h
+ *
+ * Author:      fossette
+ *
+ * Description: Halving of 8 bits planes, see fsscale.c.
+ *
+ */
+
+#ifndef FSSCALE_H
+#define FSSCALE_H
+
+#include <stdint.h>
+
+
+
+
+/*
+ *  Types
+ */
+
+// A plane's halving, see FsScaleInit()
+typedef struct
+{
+   unsigned int   dstw,
+                  dsth;
+   int            iKernel;          // FSYUV_SCALAR to FSYUV_AVX2
+} FSSCALE;
+
+
+
+
+/*
+ *  Prototypes
+ */
+
+int  FsScaleInit(unsigned int srcw, unsigned int srch, int iKernel,
+                                                      FSSCALE *pScale);
+void FsScalePlane(const FSSCALE *pScale, const uint8_t *pSrc,
+                  unsigned int iSrcPitch, uint8_t *pDst,
+                  unsigned int iDstPitch);
+void FsScaleSlice(const FSSCALE *pScale, const uint8_t *pSrc,
+                  unsigned int iSrcPitch, uint8_t *pDst,
+                  unsigned int iDstPitch, unsigned int iSlice,
+                  unsigned int nSlices);
+
+#endif // FSSCALE_H
@@ -0,0 +1,760 @@
+/*
+ * File:        fsshm.c
+ *
+ * Author:      fossette
+ *
+ * Description: libvlc's decoded frames presented through MIT-SHM.  With
+ *              the libvlc_video_set_callbacks() video output, libvlc
+ *              decodes into fsplayer's own I420 pictures, which are
+ *              converted to BGRA by fsyuv.c into X shared memory images
+ *              that fsplayer puts in wVideo with XShmPutImage(), so
+ *              fsplayer decides where frames go and when.  No VLC
+ *              window is ever created.
+ *
+ *              The pictures are fsframe.c's, recycled from one frame
+ *              to the next, so playing allocates nothing.
+ *
+ *              There are two images.  One is being read by the X server
+ *              until its ShmCompletion event comes back, while the next
+ *              frame is converted into the other.  The callbacks run on
+ *              libvlc's video output thread, which has its own X
+ *              connection so it never waits on fsplayer's event loop,
+ *              nor the other way around.
+ *
+ *              A video exactly twice the size that fits the screen,
+ *              4K on a 1080p screen, is decoded at its own size and
+ *              shrunk by half by fsscale.c before the conversion, which
+ *              costs less than converting it all.  Any other ratio is
+ *              left to libvlc's converter, asked for the size that fits.
+ *              Both are split in horizontal slices, run by fspool.c's
+ *              threads on every core.
+ *              Only 24 bits TrueColor displays with BGRA pixels are
+ *              handled, which covers Xvfb and the usual PC graphics.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS''
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <time.h>
+#include <X11/Xlib.h>
+#include <X11/Xutil.h>
+#include <X11/extensions/XShm.h>
+#include "fsframe.h"
+#include "fspool.h"
+#include "fsscale.h"
+#include "fsshm.h"
+#include "fsyuv.h"
+
+
+
+
+/*
+ *  Constants
+ */
+
+#define FSSHM_BUFFERS            2        // MIT-SHM images
+#define FSSHM_PICTURES           3        // libvlc's I420 pictures
+
+
+
+
+/*
+ *  Types
+ */
+
+typedef struct
+{
+   int               iAttached,
+                     iBusy;         // Until the X server's ShmCompletion
+   XImage            *pImage;
+   XShmSegmentInfo   shmInfo;
+} FSSHMBUFFER;
+
+struct FsShm
+{
+   Display           *pX11Display;  // The video output thread's own
+   Window            wVideo;
+   libvlc_media_t    *pVlcMedia;    // Its tracks, see FsShmSar()
+   GC                gc;
+   Visual            *pVisual;
+   int               iCompletionType,
+                     iDepth;
+   unsigned int      scrx,
+                     scry,
+                     vidw,          // As decoded, see FsShmFormat()
+                     vidh,
+                     x,             // Where the frames go in wVideo
+                     y,
+                     width,         // Their size, see FsShmFit()
+                     height;
+   int               iScaled,       // vidw by vidh isn't width by height
+                     iPages;        // FSFRAME_PAGES_*, for the frames
+   FSSHMBUFFER       aBuffers[FSSHM_BUFFERS];
+   FSFRAMES          *pFrames;      // libvlc's pictures
+   FSFRAME           *pScaled;
+   FSSCALE           aScale[2];     // Luma and chroma
+   FSYUV             yuv;
+   FSPOOL            *pPool;
+   FSFRAME           *pJobFrame;    // FsShmDisplay()'s, for the slices
+   FSSHMBUFFER       *pJobBuffer;
+   atomic_uint       nFrames,
+                     nWaits;
+   atomic_ulong      iConvertUs,
+                     iScaleUs,
+                     iWaitUs;
+   atomic_ullong     iSavedPixels;  // Shrunk away, never converted
+};
+
+
+
+
+/*
+ *  FsShmMonotonicMs
+ */
+
+double
+FsShmMonotonicMs(void)
+{
+   struct timespec ts;
+
+
+   clock_gettime(CLOCK_MONOTONIC,     &ts);
+
+   return(ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0);
+}
+
+
+
+
+/*
+ *  FsShmFit
+ *
+ *  Where a video of vidx by vidy, with sarx:sary pixels, goes in wVideo.
+ *  wVideo is sized by fsplayer's VideoLayout(): the video's own size
+ *  when smaller than the screen, else the screen.  The video is shown
+ *  as is when it fits, else shrunk to fit, and centered.  Sizes are
+ *  kept even for the chroma planes.
+ */
+
+void
+FsShmFit(FSSHM *pShm, unsigned int vidx, unsigned int vidy,
+         unsigned int sarx, unsigned int sary)
+{
+   unsigned int areax = pShm->scrx,
+                areay = pShm->scry,
+                dispx = vidx;
+
+
+   if (vidx < areax && vidy < areay)
+   {
+      areax = vidx;
+      areay = vidy;
+   }
+   if (sarx && sary)
+      dispx = ((uint64_t)vidx * sarx + sary / 2) / sary;
+
+   if (dispx <= areax && vidy <= areay)
+   {
+      pShm->width = dispx;
+      pShm->height = vidy;
+   }
+   else if ((uint64_t)dispx * areay > (uint64_t)vidy * areax)
+   {
+      pShm->width = areax;
+      pShm->height = (uint64_t)vidy * areax / dispx;
+   }
+   else
+   {
+      pShm->width = (uint64_t)dispx * areay / vidy;
+      pShm->height = areay;
+   }
+   pShm->width &= ~1u;
+   pShm->height &= ~1u;
+   pShm->x = (areax - pShm->width) / 2;
+   pShm->y = (areay - pShm->height) / 2;
+}
+
+
+
+
+/*
+ *  FsShmSar
+ *
+ *  The video's sample aspect ratio, which libvlc's format callback
+ *  doesn't give, from the media's first video track.  1:1 when the
+ *  demuxer didn't tell.
+ */
+
+void
+FsShmSar(FSSHM *pShm,     unsigned int *pSarx, unsigned int *pSary)
+{
+   unsigned int            i,
+                           nTracks = 0;
+   libvlc_media_track_t    **pTracks;
+
+
+   *pSarx = *pSary = 1;
+   if (pShm->pVlcMedia)
+      nTracks = libvlc_media_tracks_get(pShm->pVlcMedia,     &pTracks);
+   for (i = 0 ; i < nTracks ; i++)
+   {
+      if (pTracks[i]->i_type == libvlc_track_video)
+      {
+         if (pTracks[i]->video->i_sar_num && pTracks[i]->video->i_sar_den)
+         {
+            *pSarx = pTracks[i]->video->i_sar_num;
+            *pSary = pTracks[i]->video->i_sar_den;
+         }
+         break;
+      }
+   }
+   if (nTracks)
+      libvlc_media_tracks_release(pTracks, nTracks);
+}
+
+
+
+
+/*
+ *  FsShmBufferFree
+ */
+
+void
+FsShmBufferFree(FSSHM *pShm, FSSHMBUFFER *pBuffer)
+{
+   if (pBuffer->iAttached)
+   {
+      XShmDetach(pShm->pX11Display,     &pBuffer->shmInfo);
+      XSync(pShm->pX11Display, False);
+   }
+   if (pBuffer->pImage)
+   {
+      pBuffer->pImage->data = NULL;
+      XDestroyImage(pBuffer->pImage);
+   }
+   if (pBuffer->shmInfo.shmaddr && pBuffer->shmInfo.shmaddr != (char *)-1)
+      shmdt(pBuffer->shmInfo.shmaddr);
+   memset(pBuffer, 0, sizeof(FSSHMBUFFER));
+}
+
+
+
+
+/*
+ *  FsShmBufferNew
+ */
+
+int
+FsShmBufferNew(FSSHM *pShm,     FSSHMBUFFER *pBuffer)
+{
+   int      iErr = 0;
+   XImage   *pImage;
+
+
+   memset(pBuffer, 0, sizeof(FSSHMBUFFER));
+   pBuffer->shmInfo.shmid = -1;
+   pImage = pBuffer->pImage
+          = XShmCreateImage(pShm->pX11Display, pShm->pVisual, pShm->iDepth,
+                            ZPixmap, NULL,     &pBuffer->shmInfo,
+                            pShm->width, pShm->height);
+   if (!pImage || pImage->bits_per_pixel != 32)
+      iErr = 1;
+   if (!iErr)
+   {
+      pBuffer->shmInfo.shmid = shmget(IPC_PRIVATE,
+                                      pImage->bytes_per_line * pImage->height,
+                                      IPC_CREAT|0600);
+      if (pBuffer->shmInfo.shmid < 0)
+         iErr = 1;
+   }
+   if (!iErr)
+   {
+      pBuffer->shmInfo.shmaddr = shmat(pBuffer->shmInfo.shmid, NULL, 0);
+      if (pBuffer->shmInfo.shmaddr == (char *)-1)
+         iErr = 1;
+   }
+   if (!iErr)
+   {
+      pImage->data = pBuffer->shmInfo.shmaddr;
+      pBuffer->shmInfo.readOnly = False;
+      pBuffer->iAttached = XShmAttach(pShm->pX11Display, &pBuffer->shmInfo);
+      if (pBuffer->iAttached)
+         XSync(pShm->pX11Display, False);
+      else
+         iErr = 1;
+   }
+
+   // Gone at the last detach, even if fsplayer crashes
+   if (pBuffer->shmInfo.shmid >= 0)
+      shmctl(pBuffer->shmInfo.shmid, IPC_RMID, NULL);
+
+   if (iErr)
+      FsShmBufferFree(pShm, pBuffer);
+
+   return(iErr);
+}
+
+
+
+
+/*
+ *  FsShmCompleted
+ *
+ *  Takes note of the images the X server is done with.  With iWait,
+ *  sleeps until there's at least one.
+ */
+
+void
+FsShmCompleted(FSSHM *pShm, int iWait)
+{
+   int                  i,
+                        iCompleted = 0;
+   double               t = 0;
+   XEvent               event;
+   XShmCompletionEvent  *pCompletion;
+
+
+   if (iWait)
+   {
+      t = FsShmMonotonicMs();
+      atomic_fetch_add(&pShm->nWaits, 1);
+   }
+   while (XCheckTypedEvent(pShm->pX11Display, pShm->iCompletionType,
+                               &event)
+          || (iWait && !iCompleted
+              && !XNextEvent(pShm->pX11Display,     &event)))
+   {
+      if (event.type != pShm->iCompletionType)
+         continue;
+      pCompletion = (XShmCompletionEvent *)&event;
+      for (i = 0 ; i < FSSHM_BUFFERS ; i++)
+         if (pShm->aBuffers[i].shmInfo.shmseg == pCompletion->shmseg)
+            pShm->aBuffers[i].iBusy = 0;
+      iCompleted = 1;
+   }
+   if (iWait)
+      atomic_fetch_add(&pShm->iWaitUs,
+                       (unsigned long)((FsShmMonotonicMs() - t) * 1000));
+}
+
+
+
+
+/*
+ *  FsShmCleanup
+ *
+ *  libvlc's format cleanup callback, the video output is closing.  The
+ *  frames are kept for the next video, see FsFramesFormat().
+ */
+
+void
+FsShmCleanup(void *pOpaque)
+{
+   int   i;
+   FSSHM *pShm = (FSSHM *)pOpaque;
+
+
+   for (i = 0 ; i < FSSHM_BUFFERS ; i++)
+      FsShmBufferFree(pShm, pShm->aBuffers + i);
+   FsFrameFree(pShm->pScaled);
+   pShm->pScaled = NULL;
+}
+
+
+
+
+/*
+ *  FsShmFormat
+ *
+ *  libvlc's format callback.  Asks for I420 frames with square pixels
+ *  at the size that fits the screen, and readies fsframe.c's frames and
+ *  the images.  A video of exactly twice that size is asked for as is
+ *  and shrunk by fsscale.c, once and before anything else.  Either way,
+ *  the conversion and the X server only ever see as many pixels as
+ *  there are on the screen.  Without a color space from libvlc, HD is
+ *  taken as BT.709 and SD as BT.601, limited range.
+ */
+
+unsigned int
+FsShmFormat(void **ppOpaque, char *szChroma, unsigned int *pWidth,
+            unsigned int *pHeight, unsigned int *pPitches,
+            unsigned int *pLines)
+{
+   int            i,
+                  iErr = 0,
+                  iKernel;
+   unsigned int   sarx,
+                  sary;
+   FSSHM          *pShm = (FSSHM *)*ppOpaque;
+
+
+   pShm->vidw = *pWidth;
+   pShm->vidh = *pHeight;
+   FsShmSar(pShm,     &sarx, &sary);
+   FsShmFit(pShm, pShm->vidw, pShm->vidh, sarx, sary);
+   pShm->iScaled = pShm->vidw != pShm->width || pShm->vidh != pShm->height;
+   iKernel = FsYuvBestKernel();
+   iErr = FsYuvInit(FSYUV_I420, iKernel,
+                    pShm->vidh > 576 ? FSYUV_BT709 : FSYUV_BT601, 0,
+                                                         &pShm->yuv);
+
+   // Only halving pays for itself, libvlc scales to any other size
+   if (pShm->iScaled
+       && (pShm->vidw != pShm->width * 2 || pShm->vidh != pShm->height * 2))
+   {
+      pShm->vidw = *pWidth = pShm->width;
+      pShm->vidh = *pHeight = pShm->height;
+      pShm->iScaled = 0;
+   }
+   if (!iErr)
+      iErr = FsFramesFormat(pShm->pFrames, pShm->vidw, pShm->vidh,
+                            FSSHM_PICTURES,     pPitches);
+   if (!iErr && pShm->iScaled)
+   {
+      pShm->pScaled = FsFrameNew(pShm->width, pShm->height, pShm->iPages);
+      iErr = !pShm->pScaled
+             || FsScaleInit(pShm->vidw, pShm->vidh, iKernel,     pShm->aScale)
+             || FsScaleInit(pShm->vidw / 2, pShm->vidh / 2, iKernel,
+                                                       pShm->aScale + 1);
+   }
+   for (i = 0 ; i < FSSHM_BUFFERS && !iErr ; i++)
+      iErr = FsShmBufferNew(pShm,     pShm->aBuffers + i);
+   if (iErr)
+   {
+      printf("WARNING: MIT-SHM images of %ux%u couldn't be allocated.\n",
+             pShm->width, pShm->height);
+      FsShmCleanup(pShm);
+   }
+   else
+   {
+      memcpy(szChroma, "I420", 4);
+      for (i = 0 ; i < 3 ; i++)
+         pLines[i] = i ? (pShm->vidh + 1) / 2 : pShm->vidh;
+   }
+
+   return(iErr ? 0 : FSSHM_PICTURES);
+}
+
+
+
+
+/*
+ *  FsShmLock
+ *
+ *  libvlc's lock callback, hands a frame over for the next picture.
+ *  The picture id is the frame.
+ */
+
+void *
+FsShmLock(void *pOpaque, void **ppPlanes)
+{
+   int      i;
+   FSSHM    *pShm = (FSSHM *)pOpaque;
+   FSFRAME  *pFrame;
+
+
+   pFrame = FsFramesLock(pShm->pFrames);
+   for (i = 0 ; i < 3 ; i++)
+      ppPlanes[i] = (void *)pFrame->image.apPlanes[i];
+
+   return(pFrame);
+}
+
+
+
+
+/*
+ *  FsShmUnlock
+ *
+ *  libvlc's unlock callback.  libvlc 3 calls it once done with the
+ *  picture, displayed or not, so the frame is free again.
+ */
+
+void
+FsShmUnlock(void *pOpaque, void *pId, void *const *ppPlanes)
+{
+   FSSHM    *pShm = (FSSHM *)pOpaque;
+
+
+   FsFramesUnlock(pShm->pFrames, (FSFRAME *)pId);
+}
+
+
+
+
+/*
+ *  FsShmScaleJob
+ *
+ *  Shrinks a slice of each plane of pJobFrame into pScaled.
+ */
+
+void
+FsShmScaleJob(void *pArg, unsigned int iSlice, unsigned int nSlices)
+{
+   int            i;
+   FSSHM          *pShm = (FSSHM *)pArg;
+   FSFRAME        *pFrame = pShm->pJobFrame;
+
+
+   for (i = 0 ; i < 3 ; i++)
+      FsScaleSlice(pShm->aScale + !!i, pFrame->image.apPlanes[i],
+                   pFrame->image.aPitches[i],
+                   (uint8_t *)pShm->pScaled->image.apPlanes[i],
+                   pShm->pScaled->image.aPitches[i], iSlice, nSlices);
+}
+
+
+
+
+/*
+ *  FsShmConvertJob
+ *
+ *  Converts a slice of pJobFrame into pJobBuffer's image.
+ */
+
+void
+FsShmConvertJob(void *pArg, unsigned int iSlice, unsigned int nSlices)
+{
+   FSSHM          *pShm = (FSSHM *)pArg;
+   XImage         *pImage = pShm->pJobBuffer->pImage;
+
+
+   FsYuvConvertSlice(&pShm->yuv, &pShm->pJobFrame->image,
+                     (uint8_t *)pImage->data, pImage->bytes_per_line,
+                     pShm->width, pShm->height, iSlice, nSlices);
+}
+
+
+
+
+/*
+ *  FsShmDisplay
+ *
+ *  libvlc's display callback, the frame is due now.  It's converted
+ *  into an image the X server is done with, waiting for one if need be.
+ *  The pool's threads do the work, FsPoolRun() returning once every
+ *  slice is, so the shrunk picture is whole before it's converted.
+ *  The frame is only read, libvlc may display it again and unlocks it
+ *  when it's done with it.
+ */
+
+void
+FsShmDisplay(void *pOpaque, void *pId)
+{
+   int            i,
+                  iFree = -1;
+   double         t;
+   FSSHM          *pShm = (FSSHM *)pOpaque;
+   FSSHMBUFFER    *pBuffer;
+   FSFRAME        *pFrame = (FSFRAME *)pId;
+
+
+   FsFramesDisplayed(pShm->pFrames, pFrame);
+   if (pShm->iScaled)
+   {
+      t = FsShmMonotonicMs();
+      pShm->pJobFrame = pFrame;
+      FsPoolRun(pShm->pPool, FsShmScaleJob, pShm);
+      atomic_fetch_add(&pShm->iScaleUs,
+                       (unsigned long)((FsShmMonotonicMs() - t) * 1000));
+      atomic_fetch_add(&pShm->iSavedPixels,
+                       (uint64_t)pShm->vidw * pShm->vidh
+                       - (uint64_t)pShm->width * pShm->height);
+      pFrame = pShm->pScaled;
+   }
+
+   FsShmCompleted(pShm, 0);
+   while (iFree < 0)
+   {
+      for (i = 0 ; i < FSSHM_BUFFERS && iFree < 0 ; i++)
+         if (!pShm->aBuffers[i].iBusy)
+            iFree = i;
+      if (iFree < 0)
+         FsShmCompleted(pShm, 1);
+   }
+   pBuffer = pShm->aBuffers + iFree;
+
+   t = FsShmMonotonicMs();
+   pShm->pJobFrame = pFrame;
+   pShm->pJobBuffer = pBuffer;
+   FsPoolRun(pShm->pPool, FsShmConvertJob, pShm);
+   atomic_fetch_add(&pShm->iConvertUs,
+                    (unsigned long)((FsShmMonotonicMs() - t) * 1000));
+
+   XShmPutImage(pShm->pX11Display, pShm->wVideo, pShm->gc, pBuffer->pImage,
+                0, 0, pShm->x, pShm->y, pShm->width, pShm->height, True);
+   XFlush(pShm->pX11Display);
+   pBuffer->iBusy = 1;
+   atomic_fetch_add(&pShm->nFrames, 1);
+}
+
+
+
+
+/*
+ *  FsShmOpen
+ *
+ *  iPages is what should back the frames, see fsframe.c.  Returns NULL
+ *  when MIT-SHM can't be used, libvlc then has to draw the video itself.
+ */
+
+FSSHM *
+FsShmOpen(Display *pX11Display, Window wVideo, unsigned int scrx,
+          unsigned int scry, int iPages)
+{
+   int      iErr = 0,
+            iScreen;
+   FSSHM    *pShm;
+
+
+   pShm = calloc(1, sizeof(FSSHM));
+   if (!pShm)
+      iErr = 1;
+   if (!iErr)
+   {
+      pShm->pX11Display = XOpenDisplay(DisplayString(pX11Display));
+      if (!pShm->pX11Display || !XShmQueryExtension(pShm->pX11Display))
+         iErr = 1;
+   }
+   if (!iErr)
+   {
+      // fsyuv.c writes BGRA, which the X server must read as such
+      iScreen = DefaultScreen(pShm->pX11Display);
+      pShm->pVisual = DefaultVisual(pShm->pX11Display, iScreen);
+      pShm->iDepth = DefaultDepth(pShm->pX11Display, iScreen);
+      if (pShm->pVisual->class != TrueColor || pShm->iDepth != 24
+          || pShm->pVisual->red_mask != 0xFF0000
+          || pShm->pVisual->green_mask != 0xFF00
+          || pShm->pVisual->blue_mask != 0xFF
+          || ImageByteOrder(pShm->pX11Display) != LSBFirst)
+         iErr = 1;
+   }
+   if (!iErr)
+   {
+      pShm->wVideo = wVideo;
+      pShm->scrx = scrx;
+      pShm->scry = scry;
+      pShm->iCompletionType = XShmGetEventBase(pShm->pX11Display)
+                              + ShmCompletion;
+      pShm->gc = XCreateGC(pShm->pX11Display, wVideo, 0, NULL);
+      if (!pShm->gc)
+         iErr = 1;
+   }
+   if (!iErr)
+   {
+      pShm->iPages = iPages;
+      pShm->pFrames = FsFramesOpen(iPages);
+      if (!pShm->pFrames)
+         iErr = 1;
+   }
+   if (!iErr)
+   {
+      // Without it, the frames are just done by libvlc's thread alone
+      pShm->pPool = FsPoolOpen(0);
+   }
+
+   if (iErr && pShm)
+   {
+      if (pShm->gc)
+         XFreeGC(pShm->pX11Display, pShm->gc);
+      if (pShm->pX11Display)
+         XCloseDisplay(pShm->pX11Display);
+      free(pShm);
+      pShm = NULL;
+   }
+
+   return(pShm);
+}
+
+
+
+
+/*
+ *  FsShmClose
+ *
+ *  libvlc must be done with the video, see FsShmCleanup().
+ */
+
+void
+FsShmClose(FSSHM *pShm)
+{
+   if (pShm)
+   {
+      if (pShm->pVlcMedia)
+         libvlc_media_release(pShm->pVlcMedia);
+      FsPoolClose(pShm->pPool);
+      FsFramesClose(pShm->pFrames);
+      XFreeGC(pShm->pX11Display, pShm->gc);
+      XCloseDisplay(pShm->pX11Display);
+      free(pShm);
+   }
+}
+
+
+
+
+/*
+ *  FsShmAttach
+ *
+ *  Has the player's video go through fsplayer's images.
+ */
+
+void
+FsShmAttach(FSSHM *pShm, libvlc_media_player_t *pVlcPlayer)
+{
+   atomic_store(&pShm->nFrames, 0);
+   atomic_store(&pShm->nWaits, 0);
+   atomic_store(&pShm->iWaitUs, 0);
+   atomic_store(&pShm->iConvertUs, 0);
+   atomic_store(&pShm->iScaleUs, 0);
+   atomic_store(&pShm->iSavedPixels, 0);
+   FsFramesResetStats(pShm->pFrames);
+   if (pShm->pVlcMedia)
+      libvlc_media_release(pShm->pVlcMedia);
+   pShm->pVlcMedia = libvlc_media_player_get_media(pVlcPlayer);
+   libvlc_video_set_format_callbacks(pVlcPlayer, FsShmFormat, FsShmCleanup);
+   libvlc_video_set_callbacks(pVlcPlayer, FsShmLock, FsShmUnlock,
+                              FsShmDisplay, pShm);
+}
+
+
+
+
+/*
+ *  FsShmStats
+ */
+
+void
+FsShmStats(FSSHM *pShm,     FSSHMSTATS *pStats)
+{
+   memset(pStats, 0, sizeof(FSSHMSTATS));
+   if (pShm)
+   {
+      pStats->nFrames = atomic_load(&pShm->nFrames);
+      pStats->nWaits = atomic_load(&pShm->nWaits);
+      pStats->tWaitMs = atomic_load(&pShm->iWaitUs) / 1000.0;
+      pStats->tConvertMs = atomic_load(&pShm->iConvertUs) / 1000.0;
+      pStats->tScaleMs = atomic_load(&pShm->iScaleUs) / 1000.0;
+      pStats->iSavedPixels = atomic_load(&pShm->iSavedPixels);
+      pStats->szKernel = FsYuvKernelName(FsYuvBestKernel());
+      pStats->nThreads = FsPoolThreads(pShm->pPool);
+      FsFramesStats(pShm->pFrames,     &pStats->frames);
+   }
+}
@@ -0,0 +1,55 @@
+/*
+ * File:        fsshm.h
+ *
+ * Author:      fossette
+ *
+ * Description: libvlc's decoded frames presented through MIT-SHM, see
+ *              fsshm.c.
+ *
+ */
+
+#ifndef FSSHM_H
+#define FSSHM_H
+
+#include <stdint.h>
+#include <vlc/vlc.h>
+#include <X11/Xlib.h>
+#include "fsframe.h"
+
+
+
+
+/*
+ *  Types
+ */
+
+// What the video output did since FsShmAttach()
+typedef struct
+{
+   unsigned int   nFrames,
+                  nWaits;        // Display waited for the X server
+   double         tConvertMs,
+                  tScaleMs,
+                  tWaitMs;
+   uint64_t       iSavedPixels;  // Shrunk away before the conversion
+   const char     *szKernel;     // fsyuv.c's
+   int            nThreads;      // Sharing each frame's slices
+   FSFRAMESTATS   frames;        // libvlc's pictures
+} FSSHMSTATS;
+
+typedef struct FsShm FSSHM;
+
+
+
+
+/*
+ *  Prototypes
+ */
+
+FSSHM *FsShmOpen(Display *pX11Display, Window wVideo, unsigned int scrx,
+                 unsigned int scry, int iPages);
+void   FsShmClose(FSSHM *pShm);
+void   FsShmAttach(FSSHM *pShm, libvlc_media_player_t *pVlcPlayer);
+void   FsShmStats(FSSHM *pShm,     FSSHMSTATS *pStats);
+
+#endif // FSSHM_H
@@ -0,0 +1,981 @@
+/*
+ * File:        fsyuv.c
+ *
+ * Author:      fossette
+ *
+ * Description: YUV to BGRA pixel conversion, for the MIT-SHM images of
+ *              fsshm.c.  I420, NV12 and YUY2 are converted with the
+ *              BT.601 or BT.709 matrix, from limited or full range.
+ *
+ *              Every kernel computes exactly the same fixed point sum,
+ *              13 fractional bits in 32 bits integers, so the SSE2,
+ *              SSSE3 and AVX2 kernels are bit exact with the scalar one,
+ *              which bench/yuvbench checks.  The SIMD kernels are built
+ *              with function target attributes, without special
+ *              compiler flags, and FsYuvBestKernel() asks cpuid which
+ *              ones the CPU can run.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS''
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include "fsyuv.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define FSYUV_X86                1
+#include <cpuid.h>
+#include <immintrin.h>
+#endif // __x86_64__ || __i386__
+
+
+
+
+/*
+ *  Constants
+ */
+
+#define FSYUV_BITS               13
+#define FSYUV_ROUND              (1 << (FSYUV_BITS - 1))
+
+// Two 16 bits coefficients for _mm_madd_epi16(), lo for Y
+#define FSYUV_PAIR(lo, hi)       ((int)((uint32_t)(uint16_t)(hi) << 16 \
+                                        | (uint16_t)(lo)))
+
+
+
+
+/*
+ *  Types
+ */
+
+#ifdef FSYUV_X86
+// FSYUVCOEFS for the SSE2 and SSSE3 kernels
+typedef struct
+{
+   __m128i           yoff,
+                     c128,
+                     round,
+                     cyCrv,
+                     cyCgu,
+                     zeroCgv,
+                     cyCbu,
+                     max,
+                     alpha;
+} FSYUVSSE;
+
+// ... and the AVX2 kernels
+typedef struct
+{
+   __m256i           yoff,
+                     c128,
+                     round,
+                     cyCrv,
+                     cyCgu,
+                     zeroCgv,
+                     cyCbu,
+                     max,
+                     alpha;
+} FSYUVAVX;
+#endif // FSYUV_X86
+
+
+
+
+/*
+ *  Global variables
+ */
+
+const char *gszFsYuvKernelName[FSYUV_KERNELS] =
+{
+   "scalar", "sse2", "ssse3", "avx2"
+};
+
+
+
+
+/*
+ *  FsYuvClamp
+ */
+
+static inline uint8_t
+FsYuvClamp(int i)
+{
+   return(i < 0 ? 0 : (i > 255 ? 255 : i));
+}
+
+
+
+
+/*
+ *  FsYuvRowTail
+ *
+ *  The reference conversion, from pixel x to width.  Pixel x's Y is
+ *  pY[x * iYStep], and its chroma pU and pV[x / 2 * iUVStep].
+ */
+
+void
+FsYuvRowTail(const FSYUVCOEFS *pCoefs, const uint8_t *pY, int iYStep,
+             const uint8_t *pU, const uint8_t *pV, int iUVStep,
+             uint8_t *pDst, unsigned int x, unsigned int width)
+{
+   int   u,
+         v,
+         y;
+
+
+   for ( ; x < width ; x++)
+   {
+      y = (pY[x * iYStep] - pCoefs->iYOffset) * pCoefs->iCy + FSYUV_ROUND;
+      u = pU[x / 2 * iUVStep] - 128;
+      v = pV[x / 2 * iUVStep] - 128;
+      pDst[x * 4] = FsYuvClamp((y + pCoefs->iCbu * u) >> FSYUV_BITS);
+      pDst[x * 4 + 1] = FsYuvClamp((y + pCoefs->iCgu * u + pCoefs->iCgv * v)
+                                   >> FSYUV_BITS);
+      pDst[x * 4 + 2] = FsYuvClamp((y + pCoefs->iCrv * v) >> FSYUV_BITS);
+      pDst[x * 4 + 3] = 255;
+   }
+}
+
+
+
+
+/*
+ *  FsYuvRowI420Scalar
+ */
+
+void
+FsYuvRowI420Scalar(const FSYUVCOEFS *pCoefs, const uint8_t *pY,
+                   const uint8_t *pU, const uint8_t *pV, uint8_t *pDst,
+                   unsigned int width)
+{
+   FsYuvRowTail(pCoefs, pY, 1, pU, pV, 1, pDst, 0, width);
+}
+
+
+
+
+/*
+ *  FsYuvRowNV12Scalar
+ */
+
+void
+FsYuvRowNV12Scalar(const FSYUVCOEFS *pCoefs, const uint8_t *pY,
+                   const uint8_t *pU, const uint8_t *pV, uint8_t *pDst,
+                   unsigned int width)
+{
+   FsYuvRowTail(pCoefs, pY, 1, pU, pU + 1, 2, pDst, 0, width);
+}
+
+
+
+
+/*
+ *  FsYuvRowYUY2Scalar
+ */
+
+void
+FsYuvRowYUY2Scalar(const FSYUVCOEFS *pCoefs, const uint8_t *pY,
+                   const uint8_t *pU, const uint8_t *pV, uint8_t *pDst,
+                   unsigned int width)
+{
+   FsYuvRowTail(pCoefs, pY, 2, pY + 1, pY + 3, 4, pDst, 0, width);
+}
+
+
+
+
+#ifdef FSYUV_X86
+/*
+ *  FsYuvSseInit
+ */
+
+__attribute__((target("sse2")))
+static inline void
+FsYuvSseInit(const FSYUVCOEFS *pCoefs,     FSYUVSSE *pSse)
+{
+   pSse->yoff = _mm_set1_epi16(pCoefs->iYOffset);
+   pSse->c128 = _mm_set1_epi16(128);
+   pSse->round = _mm_set1_epi32(FSYUV_ROUND);
+   pSse->cyCrv = _mm_set1_epi32(FSYUV_PAIR(pCoefs->iCy, pCoefs->iCrv));
+   pSse->cyCgu = _mm_set1_epi32(FSYUV_PAIR(pCoefs->iCy, pCoefs->iCgu));
+   pSse->zeroCgv = _mm_set1_epi32(FSYUV_PAIR(0, pCoefs->iCgv));
+   pSse->cyCbu = _mm_set1_epi32(FSYUV_PAIR(pCoefs->iCy, pCoefs->iCbu));
+   pSse->max = _mm_set1_epi16(255);
+   pSse->alpha = _mm_set1_epi16((short)0xFF00);
+}
+
+
+
+
+/*
+ *  FsYuvStore8Sse2
+ *
+ *  Converts 8 pixels, their Y, U and V as 16 bits words, the same way
+ *  as FsYuvRowTail().
+ */
+
+__attribute__((target("sse2")))
+static inline void
+FsYuvStore8Sse2(const FSYUVSSE *pSse, __m128i y, __m128i u, __m128i v,
+                uint8_t *pDst)
+{
+   __m128i  b,
+            bg,
+            g,
+            r,
+            ra,
+            yuHi,
+            yuLo,
+            yvHi,
+            yvLo,
+            zero = _mm_setzero_si128();
+
+
+   y = _mm_sub_epi16(y, pSse->yoff);
+   u = _mm_sub_epi16(u, pSse->c128);
+   v = _mm_sub_epi16(v, pSse->c128);
+   yuLo = _mm_unpacklo_epi16(y, u);
+   yuHi = _mm_unpackhi_epi16(y, u);
+   yvLo = _mm_unpacklo_epi16(y, v);
+   yvHi = _mm_unpackhi_epi16(y, v);
+
+   b = _mm_packs_epi32(
+          _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(yuLo, pSse->cyCbu),
+                                       pSse->round), FSYUV_BITS),
+          _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(yuHi, pSse->cyCbu),
+                                       pSse->round), FSYUV_BITS));
+   g = _mm_packs_epi32(
+          _mm_srai_epi32(_mm_add_epi32(
+             _mm_add_epi32(_mm_madd_epi16(yuLo, pSse->cyCgu),
+                           _mm_madd_epi16(yvLo, pSse->zeroCgv)),
+             pSse->round), FSYUV_BITS),
+          _mm_srai_epi32(_mm_add_epi32(
+             _mm_add_epi32(_mm_madd_epi16(yuHi, pSse->cyCgu),
+                           _mm_madd_epi16(yvHi, pSse->zeroCgv)),
+             pSse->round), FSYUV_BITS));
+   r = _mm_packs_epi32(
+          _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(yvLo, pSse->cyCrv),
+                                       pSse->round), FSYUV_BITS),
+          _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(yvHi, pSse->cyCrv),
+                                       pSse->round), FSYUV_BITS));
+
+   b = _mm_min_epi16(_mm_max_epi16(b, zero), pSse->max);
+   g = _mm_min_epi16(_mm_max_epi16(g, zero), pSse->max);
+   r = _mm_min_epi16(_mm_max_epi16(r, zero), pSse->max);
+   bg = _mm_or_si128(b, _mm_slli_epi16(g, 8));
+   ra = _mm_or_si128(r, pSse->alpha);
+   _mm_storeu_si128((__m128i *)pDst, _mm_unpacklo_epi16(bg, ra));
+   _mm_storeu_si128((__m128i *)(pDst + 16), _mm_unpackhi_epi16(bg, ra));
+}
+
+
+
+
+/*
+ *  FsYuvDupSse2
+ *
+ *  U and V each twice from 16 bits words interleaved as UVUV.
+ */
+
+__attribute__((target("sse2")))
+static inline void
+FsYuvDupSse2(__m128i uv,     __m128i *pU, __m128i *pV)
+{
+   __m128i  u,
+            v;
+
+
+   u = _mm_and_si128(uv, _mm_set1_epi32(0xFFFF));
+   v = _mm_srli_epi32(uv, 16);
+   *pU = _mm_or_si128(u, _mm_slli_epi32(u, 16));
+   *pV = _mm_or_si128(v, _mm_slli_epi32(v, 16));
+}
+
+
+
+
+/*
+ *  FsYuvRowI420Sse2
+ */
+
+__attribute__((target("sse2")))
+void
+FsYuvRowI420Sse2(const FSYUVCOEFS *pCoefs, const uint8_t *pY,
+                 const uint8_t *pU, const uint8_t *pV, uint8_t *pDst,
+                 unsigned int width)
+{
+   int32_t        iU,
+                  iV;
+   unsigned int   x;
+   __m128i        u,
+                  v,
+                  y,
+                  zero = _mm_setzero_si128();
+   FSYUVSSE       sse;
+
+
+   FsYuvSseInit(pCoefs,     &sse);
+   for (x = 0 ; x + 8 <= width ; x += 8)
+   {
+      memcpy(&iU, pU + x / 2, 4);
+      memcpy(&iV, pV + x / 2, 4);
+      y = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(pY + x)),
+                            zero);
+      u = _mm_cvtsi32_si128(iU);
+      v = _mm_cvtsi32_si128(iV);
+      u = _mm_unpacklo_epi8(_mm_unpacklo_epi8(u, u), zero);
+      v = _mm_unpacklo_epi8(_mm_unpacklo_epi8(v, v), zero);
+      FsYuvStore8Sse2(&sse, y, u, v, pDst + x * 4);
+   }
+   FsYuvRowTail(pCoefs, pY, 1, pU, pV, 1, pDst, x, width);
+}
+
+
+
+
+/*
+ *  FsYuvRowNV12Sse2
+ */
+
+__attribute__((target("sse2")))
+void
+FsYuvRowNV12Sse2(const FSYUVCOEFS *pCoefs, const uint8_t *pY,
+                 const uint8_t *pU, const uint8_t *pV, uint8_t *pDst,
+                 unsigned int width)
+{
+   unsigned int   x;
+   __m128i        u,
+                  v,
+                  y,
+                  zero = _mm_setzero_si128();
+   FSYUVSSE       sse;
+
+
+   FsYuvSseInit(pCoefs,     &sse);
+   for (x = 0 ; x + 8 <= width ; x += 8)
+   {
+      y = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(pY + x)),
+                            zero);
+      FsYuvDupSse2(_mm_unpacklo_epi8(
+                      _mm_loadl_epi64((const __m128i *)(pU + x)), zero),
+                          &u, &v);
+      FsYuvStore8Sse2(&sse, y, u, v, pDst + x * 4);
+   }
+   FsYuvRowTail(pCoefs, pY, 1, pU, pU + 1, 2, pDst, x, width);
+}
+
+
+
+
+/*
+ *  FsYuvRowYUY2Sse2
+ */
+
+__attribute__((target("sse2")))
+void
+FsYuvRowYUY2Sse2(const FSYUVCOEFS *pCoefs, const uint8_t *pY,
+                 const uint8_t *pU, const uint8_t *pV, uint8_t *pDst,
+                 unsigned int width)
+{
+   unsigned int   x;
+   __m128i        u,
+                  v,
+                  y,
+                  yuyv;
+   FSYUVSSE       sse;
+
+
+   FsYuvSseInit(pCoefs,     &sse);
+   for (x = 0 ; x + 8 <= width ; x += 8)
+   {
+      yuyv = _mm_loadu_si128((const __m128i *)(pY + x * 2));
+      y = _mm_and_si128(yuyv, _mm_set1_epi16(0xFF));
+      FsYuvDupSse2(_mm_srli_epi16(yuyv, 8),     &u, &v);
+      FsYuvStore8Sse2(&sse, y, u, v, pDst + x * 4);
+   }
+   FsYuvRowTail(pCoefs, pY, 2, pY + 1, pY + 3, 4, pDst, x, width);
+}
+
+
+
+
+/*
+ *  FsYuvRowI420Ssse3
+ *
+ *  The SSSE3 kernels spread the chroma bytes with a single pshufb.
+ */
+
+__attribute__((target("ssse3")))
+void
+FsYuvRowI420Ssse3(const FSYUVCOEFS *pCoefs, const uint8_t *pY,
+                  const uint8_t *pU, const uint8_t *pV, uint8_t *pDst,
+                  unsigned int width)
+{
+   int32_t        iU,
+                  iV;
+   unsigned int   x;
+   __m128i        dup,
+                  u,
+                  v,
+                  y,
+                  zero = _mm_setzero_si128();
+   FSYUVSSE       sse;
+
+
+   FsYuvSseInit(pCoefs,     &sse);
+   dup = _mm_setr_epi8(0, -1, 0, -1, 1, -1, 1, -1,
+                       2, -1, 2, -1, 3, -1, 3, -1);
+   for (x = 0 ; x + 8 <= width ; x += 8)
+   {
+      memcpy(&iU, pU + x / 2, 4);
+      memcpy(&iV, pV + x / 2, 4);
+      y = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(pY + x)),
+                            zero);
+      u = _mm_shuffle_epi8(_mm_cvtsi32_si128(iU), dup);
+      v = _mm_shuffle_epi8(_mm_cvtsi32_si128(iV), dup);
+      FsYuvStore8Sse2(&sse, y, u, v, pDst + x * 4);
+   }
+   FsYuvRowTail(pCoefs, pY, 1, pU, pV, 1, pDst, x, width);
+}
+
+
+
+
+/*
+ *  FsYuvRowNV12Ssse3
+ */
+
+__attribute__((target("ssse3")))
+void
+FsYuvRowNV12Ssse3(const FSYUVCOEFS *pCoefs, const uint8_t *pY,
+                  const uint8_t *pU, const uint8_t *pV, uint8_t *pDst,
+                  unsigned int width)
+{
+   unsigned int   x;
+   __m128i        dupU,
+                  dupV,
+                  uv,
+                  y,
+                  zero = _mm_setzero_si128();
+   FSYUVSSE       sse;
+
+
+   FsYuvSseInit(pCoefs,     &sse);
+   dupU = _mm_setr_epi8(0, -1, 0, -1, 2, -1, 2, -1,
+                        4, -1, 4, -1, 6, -1, 6, -1);
+   dupV = _mm_setr_epi8(1, -1, 1, -1, 3, -1, 3, -1,
+                        5, -1, 5, -1, 7, -1, 7, -1);
+   for (x = 0 ; x + 8 <= width ; x += 8)
+   {
+      y = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(pY + x)),
+                            zero);
+      uv = _mm_loadl_epi64((const __m128i *)(pU + x));
+      FsYuvStore8Sse2(&sse, y, _mm_shuffle_epi8(uv, dupU),
+                      _mm_shuffle_epi8(uv, dupV), pDst + x * 4);
+   }
+   FsYuvRowTail(pCoefs, pY, 1, pU, pU + 1, 2, pDst, x, width);
+}
+
+
+
+
+/*
+ *  FsYuvRowYUY2Ssse3
+ */
+
+__attribute__((target("ssse3")))
+void
+FsYuvRowYUY2Ssse3(const FSYUVCOEFS *pCoefs, const uint8_t *pY,
+                  const uint8_t *pU, const uint8_t *pV, uint8_t *pDst,
+                  unsigned int width)
+{
+   unsigned int   x;
+   __m128i        dupU,
+                  dupV,
+                  spreadY,
+                  yuyv;
+   FSYUVSSE       sse;
+
+
+   FsYuvSseInit(pCoefs,     &sse);
+   spreadY = _mm_setr_epi8(0, -1, 2, -1, 4, -1, 6, -1,
+                           8, -1, 10, -1, 12, -1, 14, -1);
+   dupU = _mm_setr_epi8(1, -1, 1, -1, 5, -1, 5, -1,
+                        9, -1, 9, -1, 13, -1, 13, -1);
+   dupV = _mm_setr_epi8(3, -1, 3, -1, 7, -1, 7, -1,
+                        11, -1, 11, -1, 15, -1, 15, -1);
+   for (x = 0 ; x + 8 <= width ; x += 8)
+   {
+      yuyv = _mm_loadu_si128((const __m128i *)(pY + x * 2));
+      FsYuvStore8Sse2(&sse, _mm_shuffle_epi8(yuyv, spreadY),
+                      _mm_shuffle_epi8(yuyv, dupU),
+                      _mm_shuffle_epi8(yuyv, dupV), pDst + x * 4);
+   }
+   FsYuvRowTail(pCoefs, pY, 2, pY + 1, pY + 3, 4, pDst, x, width);
+}
+
+
+
+
+/*
+ *  FsYuvAvxInit
+ */
+
+__attribute__((target("avx2")))
+static inline void
+FsYuvAvxInit(const FSYUVCOEFS *pCoefs,     FSYUVAVX *pAvx)
+{
+   pAvx->yoff = _mm256_set1_epi16(pCoefs->iYOffset);
+   pAvx->c128 = _mm256_set1_epi16(128);
+   pAvx->round = _mm256_set1_epi32(FSYUV_ROUND);
+   pAvx->cyCrv = _mm256_set1_epi32(FSYUV_PAIR(pCoefs->iCy, pCoefs->iCrv));
+   pAvx->cyCgu = _mm256_set1_epi32(FSYUV_PAIR(pCoefs->iCy, pCoefs->iCgu));
+   pAvx->zeroCgv = _mm256_set1_epi32(FSYUV_PAIR(0, pCoefs->iCgv));
+   pAvx->cyCbu = _mm256_set1_epi32(FSYUV_PAIR(pCoefs->iCy, pCoefs->iCbu));
+   pAvx->max = _mm256_set1_epi16(255);
+   pAvx->alpha = _mm256_set1_epi16((short)0xFF00);
+}
+
+
+
+
+/*
+ *  FsYuvStore16Avx2
+ *
+ *  FsYuvStore8Sse2() for 16 pixels.  The unpacks and packs work within
+ *  each 128 bits lane, which the packs undo, and the final permutes
+ *  put the pixels back in order.
+ */
+
+__attribute__((target("avx2")))
+static inline void
+FsYuvStore16Avx2(const FSYUVAVX *pAvx, __m256i y, __m256i u, __m256i v,
+                 uint8_t *pDst)
+{
+   __m256i  b,
+            bg,
+            g,
+            hi,
+            lo,
+            r,
+            ra,
+            yuHi,
+            yuLo,
+            yvHi,
+            yvLo,
+            zero = _mm256_setzero_si256();
+
+
+   y = _mm256_sub_epi16(y, pAvx->yoff);
+   u = _mm256_sub_epi16(u, pAvx->c128);
+   v = _mm256_sub_epi16(v, pAvx->c128);
+   yuLo = _mm256_unpacklo_epi16(y, u);
+   yuHi = _mm256_unpackhi_epi16(y, u);
+   yvLo = _mm256_unpacklo_epi16(y, v);
+   yvHi = _mm256_unpackhi_epi16(y, v);
+
+   b = _mm256_packs_epi32(
+          _mm256_srai_epi32(_mm256_add_epi32(
+             _mm256_madd_epi16(yuLo, pAvx->cyCbu), pAvx->round), FSYUV_BITS),
+          _mm256_srai_epi32(_mm256_add_epi32(
+             _mm256_madd_epi16(yuHi, pAvx->cyCbu), pAvx->round), FSYUV_BITS));
+   g = _mm256_packs_epi32(
+          _mm256_srai_epi32(_mm256_add_epi32(
+             _mm256_add_epi32(_mm256_madd_epi16(yuLo, pAvx->cyCgu),
+                              _mm256_madd_epi16(yvLo, pAvx->zeroCgv)),
+             pAvx->round), FSYUV_BITS),
+          _mm256_srai_epi32(_mm256_add_epi32(
+             _mm256_add_epi32(_mm256_madd_epi16(yuHi, pAvx->cyCgu),
+                              _mm256_madd_epi16(yvHi, pAvx->zeroCgv)),
+             pAvx->round), FSYUV_BITS));
+   r = _mm256_packs_epi32(
+          _mm256_srai_epi32(_mm256_add_epi32(
+             _mm256_madd_epi16(yvLo, pAvx->cyCrv), pAvx->round), FSYUV_BITS),
+          _mm256_srai_epi32(_mm256_add_epi32(
+             _mm256_madd_epi16(yvHi, pAvx->cyCrv), pAvx->round), FSYUV_BITS));
+
+   b = _mm256_min_epi16(_mm256_max_epi16(b, zero), pAvx->max);
+   g = _mm256_min_epi16(_mm256_max_epi16(g, zero), pAvx->max);
+   r = _mm256_min_epi16(_mm256_max_epi16(r, zero), pAvx->max);
+   bg = _mm256_or_si256(b, _mm256_slli_epi16(g, 8));
+   ra = _mm256_or_si256(r, pAvx->alpha);
+   lo = _mm256_unpacklo_epi16(bg, ra);
+   hi = _mm256_unpackhi_epi16(bg, ra);
+   _mm256_storeu_si256((__m256i *)pDst, _mm256_permute2x128_si256(lo, hi,
+                                                                  0x20));
+   _mm256_storeu_si256((__m256i *)(pDst + 32),
+                       _mm256_permute2x128_si256(lo, hi, 0x31));
+}
+
+
+
+
+/*
+ *  FsYuvDupAvx2
+ */
+
+__attribute__((target("avx2")))
+static inline void
+FsYuvDupAvx2(__m256i uv,     __m256i *pU, __m256i *pV)
+{
+   __m256i  u,
+            v;
+
+
+   u = _mm256_and_si256(uv, _mm256_set1_epi32(0xFFFF));
+   v = _mm256_srli_epi32(uv, 16);
+   *pU = _mm256_or_si256(u, _mm256_slli_epi32(u, 16));
+   *pV = _mm256_or_si256(v, _mm256_slli_epi32(v, 16));
+}
+
+
+
+
+/*
+ *  FsYuvRowI420Avx2
+ */
+
+__attribute__((target("avx2")))
+void
+FsYuvRowI420Avx2(const FSYUVCOEFS *pCoefs, const uint8_t *pY,
+                 const uint8_t *pU, const uint8_t *pV, uint8_t *pDst,
+                 unsigned int width)
+{
+   unsigned int   x;
+   __m128i        u,
+                  v;
+   __m256i        y;
+   FSYUVAVX       avx;
+
+
+   FsYuvAvxInit(pCoefs,     &avx);
+   for (x = 0 ; x + 16 <= width ; x += 16)
+   {
+      y = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(pY + x)));
+      u = _mm_loadl_epi64((const __m128i *)(pU + x / 2));
+      v = _mm_loadl_epi64((const __m128i *)(pV + x / 2));
+      FsYuvStore16Avx2(&avx, y,
+                       _mm256_cvtepu8_epi16(_mm_unpacklo_epi8(u, u)),
+                       _mm256_cvtepu8_epi16(_mm_unpacklo_epi8(v, v)),
+                       pDst + x * 4);
+   }
+   FsYuvRowTail(pCoefs, pY, 1, pU, pV, 1, pDst, x, width);
+}
+
+
+
+
+/*
+ *  FsYuvRowNV12Avx2
+ */
+
+__attribute__((target("avx2")))
+void
+FsYuvRowNV12Avx2(const FSYUVCOEFS *pCoefs, const uint8_t *pY,
+                 const uint8_t *pU, const uint8_t *pV, uint8_t *pDst,
+                 unsigned int width)
+{
+   unsigned int   x;
+   __m256i        u,
+                  v,
+                  y;
+   FSYUVAVX       avx;
+
+
+   FsYuvAvxInit(pCoefs,     &avx);
+   for (x = 0 ; x + 16 <= width ; x += 16)
+   {
+      y = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(pY + x)));
+      FsYuvDupAvx2(_mm256_cvtepu8_epi16(
+                      _mm_loadu_si128((const __m128i *)(pU + x))),     &u, &v);
+      FsYuvStore16Avx2(&avx, y, u, v, pDst + x * 4);
+   }
+   FsYuvRowTail(pCoefs, pY, 1, pU, pU + 1, 2, pDst, x, width);
+}
+
+
+
+
+/*
+ *  FsYuvRowYUY2Avx2
+ */
+
+__attribute__((target("avx2")))
+void
+FsYuvRowYUY2Avx2(const FSYUVCOEFS *pCoefs, const uint8_t *pY,
+                 const uint8_t *pU, const uint8_t *pV, uint8_t *pDst,
+                 unsigned int width)
+{
+   unsigned int   x;
+   __m256i        u,
+                  v,
+                  yuyv;
+   FSYUVAVX       avx;
+
+
+   FsYuvAvxInit(pCoefs,     &avx);
+   for (x = 0 ; x + 16 <= width ; x += 16)
+   {
+      yuyv = _mm256_loadu_si256((const __m256i *)(pY + x * 2));
+      FsYuvDupAvx2(_mm256_srli_epi16(yuyv, 8),     &u, &v);
+      FsYuvStore16Avx2(&avx, _mm256_and_si256(yuyv, _mm256_set1_epi16(0xFF)),
+                       u, v, pDst + x * 4);
+   }
+   FsYuvRowTail(pCoefs, pY, 2, pY + 1, pY + 3, 4, pDst, x, width);
+}
+
+
+
+
+/*
+ *  FsYuvXgetbv
+ */
+
+uint64_t
+FsYuvXgetbv(void)
+{
+   uint32_t eax,
+            edx;
+
+
+   __asm__ volatile ("xgetbv" : "=a" (eax), "=d" (edx) : "c" (0));
+
+   return(((uint64_t)edx << 32) | eax);
+}
+#endif // FSYUV_X86
+
+
+
+
+/*
+ *  Global variables
+ */
+
+// The row converters, NULL when not built for this CPU architecture
+const FSYUVROW gaFsYuvRows[FSYUV_FORMATS][FSYUV_KERNELS] =
+{
+#ifdef FSYUV_X86
+   { FsYuvRowI420Scalar, FsYuvRowI420Sse2, FsYuvRowI420Ssse3,
+     FsYuvRowI420Avx2 },
+   { FsYuvRowNV12Scalar, FsYuvRowNV12Sse2, FsYuvRowNV12Ssse3,
+     FsYuvRowNV12Avx2 },
+   { FsYuvRowYUY2Scalar, FsYuvRowYUY2Sse2, FsYuvRowYUY2Ssse3,
+     FsYuvRowYUY2Avx2 }
+#else
+   { FsYuvRowI420Scalar },
+   { FsYuvRowNV12Scalar },
+   { FsYuvRowYUY2Scalar }
+#endif // FSYUV_X86
+};
+
+
+
+
+/*
+ *  FsYuvFormat
+ *
+ *  The FSYUV_* format of a libvlc chroma, or -1.
+ */
+
+int
+FsYuvFormat(const char *szChroma)
+{
+   int   iFormat = -1;
+
+
+   if (!strncmp(szChroma, "I420", 4) || !strncmp(szChroma, "J420", 4))
+      iFormat = FSYUV_I420;
+   else if (!strncmp(szChroma, "NV12", 4))
+      iFormat = FSYUV_NV12;
+   else if (!strncmp(szChroma, "YUY2", 4))
+      iFormat = FSYUV_YUY2;
+
+   return(iFormat);
+}
+
+
+
+
+/*
+ *  FsYuvBestKernel
+ *
+ *  The fastest kernel cpuid says the CPU, and the OS for AVX2's
+ *  registers, can run.
+ */
+
+int
+FsYuvBestKernel(void)
+{
+   int            iKernel = FSYUV_SCALAR;
+#ifdef FSYUV_X86
+   unsigned int   eax,
+                  ebx,
+                  ecx,
+                  edx;
+
+
+   if (__get_cpuid(1,     &eax, &ebx, &ecx, &edx) && (edx & bit_SSE2))
+   {
+      iKernel = FSYUV_SSE2;
+      if (ecx & bit_SSSE3)
+         iKernel = FSYUV_SSSE3;
+      if ((ecx & bit_OSXSAVE) && (ecx & bit_AVX)
+          && (FsYuvXgetbv() & 6) == 6
+          && __get_cpuid_count(7, 0,     &eax, &ebx, &ecx, &edx)
+          && (ebx & bit_AVX2))
+         iKernel = FSYUV_AVX2;
+   }
+#endif // FSYUV_X86
+
+   return(iKernel);
+}
+
+
+
+
+/*
+ *  FsYuvKernelName
+ */
+
+const char *
+FsYuvKernelName(int iKernel)
+{
+   return(gszFsYuvKernelName[iKernel]);
+}
+
+
+
+
+/*
+ *  FsYuvCoefs
+ *
+ *  Limited range is Y from 16 to 235 and chroma from 16 to 240.
+ */
+
+void
+FsYuvCoefs(int iMatrix, int iFullRange,     FSYUVCOEFS *pCoefs)
+{
+   double   cs,
+            kb,
+            kg,
+            kr,
+            ys;
+
+
+   if (iMatrix == FSYUV_BT709)
+   {
+      kr = 0.2126;
+      kb = 0.0722;
+   }
+   else
+   {
+      kr = 0.299;
+      kb = 0.114;
+   }
+   kg = 1.0 - kr - kb;
+   ys = iFullRange ? 1.0 : 255.0 / 219.0;
+   cs = (iFullRange ? 1.0 : 255.0 / 224.0) * (1 << FSYUV_BITS);
+
+   pCoefs->iYOffset = iFullRange ? 0 : 16;
+   pCoefs->iCy = (int)(ys * (1 << FSYUV_BITS) + 0.5);
+   pCoefs->iCrv = (int)(2.0 * (1.0 - kr) * cs + 0.5);
+   pCoefs->iCgu = -(int)(2.0 * (1.0 - kb) * kb / kg * cs + 0.5);
+   pCoefs->iCgv = -(int)(2.0 * (1.0 - kr) * kr / kg * cs + 0.5);
+   pCoefs->iCbu = (int)(2.0 * (1.0 - kb) * cs + 0.5);
+}
+
+
+
+
+/*
+ *  FsYuvInit
+ *
+ *  Returns 1 when the kernel can't run on this CPU.
+ */
+
+int
+FsYuvInit(int iFormat, int iKernel, int iMatrix, int iFullRange,
+                                                   FSYUV *pYuv)
+{
+   int   iErr = 0;
+
+
+   memset(pYuv, 0, sizeof(FSYUV));
+   if (iFormat < 0 || iFormat >= FSYUV_FORMATS || iKernel < 0
+       || iKernel > FsYuvBestKernel() || !gaFsYuvRows[iFormat][iKernel])
+      iErr = 1;
+   else
+   {
+      pYuv->iFormat = iFormat;
+      pYuv->iKernel = iKernel;
+      pYuv->pfnRow = gaFsYuvRows[iFormat][iKernel];
+      FsYuvCoefs(iMatrix, iFullRange,     &pYuv->coefs);
+   }
+
+   return(iErr);
+}
+
+
+
+
+/*
+ *  FsYuvConvertSlice
+ *
+ *  Converts rows height * iSlice / nSlices up to the next slice's.  The
+ *  rows are independent, so the slices may run at the same time.
+ */
+
+void
+FsYuvConvertSlice(const FSYUV *pYuv, const FSYUVIMAGE *pImage,
+                  uint8_t *pDst, unsigned int iDstPitch, unsigned int width,
+                  unsigned int height, unsigned int iSlice,
+                  unsigned int nSlices)
+{
+   unsigned int   y,
+                  yEnd;
+   const uint8_t  *pU = NULL,
+                  *pV = NULL;
+
+
+   y = height * iSlice / nSlices;
+   yEnd = height * (iSlice + 1) / nSlices;
+   for ( ; y < yEnd ; y++)
+   {
+      if (pYuv->iFormat == FSYUV_I420)
+      {
+         pU = pImage->apPlanes[1] + y / 2 * pImage->aPitches[1];
+         pV = pImage->apPlanes[2] + y / 2 * pImage->aPitches[2];
+      }
+      else if (pYuv->iFormat == FSYUV_NV12)
+         pU = pImage->apPlanes[1] + y / 2 * pImage->aPitches[1];
+      pYuv->pfnRow(&pYuv->coefs, pImage->apPlanes[0]
+                                 + y * pImage->aPitches[0],
+                   pU, pV, pDst + y * iDstPitch, width);
+   }
+}
+
+
+
+
+/*
+ *  FsYuvConvert
+ */
+
+void
+FsYuvConvert(const FSYUV *pYuv, const FSYUVIMAGE *pImage, uint8_t *pDst,
+             unsigned int iDstPitch, unsigned int width, unsigned int height)
+{
+   FsYuvConvertSlice(pYuv, pImage, pDst, iDstPitch, width, height, 0, 1);
+}
@@ -0,0 +1,98 @@
+/*
+ * File:        fsyuv.h
+ *
+ * Author:      fossette
+ *
+ * Description: YUV to BGRA pixel conversion, see fsyuv.c.
+ *
+ */
+
+#ifndef FSYUV_H
+#define FSYUV_H
+
+#include <stdint.h>
+
+
+
+
+/*
+ *  Constants
+ */
+
+// Pixel formats, see FsYuvFormat()
+#define FSYUV_I420               0        // Y, U and V planes, 4:2:0
+#define FSYUV_NV12               1        // Y plane, UV plane, 4:2:0
+#define FSYUV_YUY2               2        // Packed YUYV, 4:2:2
+#define FSYUV_FORMATS            3
+
+// Color matrices
+#define FSYUV_BT601              0
+#define FSYUV_BT709              1
+
+// Kernels, from the slowest, see FsYuvBestKernel()
+#define FSYUV_SCALAR             0
+#define FSYUV_SSE2               1
+#define FSYUV_SSSE3              2
+#define FSYUV_AVX2               3
+#define FSYUV_KERNELS            4
+
+
+
+
+/*
+ *  Types
+ */
+
+// A YUV picture's planes, only the first one for YUY2
+typedef struct
+{
+   const uint8_t  *apPlanes[3];
+   unsigned int   aPitches[3];
+} FSYUVIMAGE;
+
+// Fixed point conversion coefficients, 13 fractional bits
+typedef struct
+{
+   int            iYOffset,
+                  iCy,
+                  iCrv,
+                  iCgu,
+                  iCgv,
+                  iCbu;
+} FSYUVCOEFS;
+
+// Converts a row of width pixels, pV unused by NV12, pU and pV by YUY2
+typedef void (*FSYUVROW)(const FSYUVCOEFS *pCoefs, const uint8_t *pY,
+                         const uint8_t *pU, const uint8_t *pV,
+                         uint8_t *pDst, unsigned int width);
+
+// A conversion ready to go, see FsYuvInit()
+typedef struct
+{
+   int            iFormat,
+                  iKernel;
+   FSYUVCOEFS     coefs;
+   FSYUVROW       pfnRow;
+} FSYUV;
+
+
+
+
+/*
+ *  Prototypes
+ */
+
+int         FsYuvFormat(const char *szChroma);
+int         FsYuvBestKernel(void);
+const char *FsYuvKernelName(int iKernel);
+int         FsYuvInit(int iFormat, int iKernel, int iMatrix, int iFullRange,
+                                                               FSYUV *pYuv);
+void        FsYuvConvert(const FSYUV *pYuv, const FSYUVIMAGE *pImage,
+                         uint8_t *pDst, unsigned int iDstPitch,
+                         unsigned int width, unsigned int height);
+void        FsYuvConvertSlice(const FSYUV *pYuv, const FSYUVIMAGE *pImage,
+                              uint8_t *pDst, unsigned int iDstPitch,
+                              unsigned int width, unsigned int height,
+                              unsigned int iSlice, unsigned int nSlices);
+
+#endif // FSYUV_H